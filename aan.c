@@ -5,6 +5,8 @@
 enum {
 	Hdrsz = 3*4,
 	Bufsize = 8*1024,
+	Nfree = 32,	/* Bufs kept for reuse */
+	Window = 1024*1024,	/* default unacked bytes in flight */
 };
 
 typedef struct Hdr Hdr;
@@ -17,6 +19,7 @@ struct Hdr {
 	uchar	acked[4];	// Number of messages acked
 };
 
+/* hdr and buf are sent in one write, so nothing may come between them */
 struct Buf {
 	Hdr	hdr;
 	uchar	buf[Bufsize];
@@ -41,8 +44,67 @@ struct Client {
 
 	Buf	*unackedhead;
 	Buf	**unackedtail;
+
+	Buf	*free;
+	int	nfree;
+
+	long	window;		/* most unacked bytes before the writer waits */
+	long	unacked;
+	int	blocked;	/* writer waiting for acks */
+	long	inbytes;	/* received since we last acked */
+
+	uvlong	retrans;	/* bytes sent again after reconnecting */
+	ulong	reconnects;
+	ulong	stalls;
 };
 
+extern int	(*aanstats)(char*, int);
+
+static Client	*client;
+
+static Buf*
+getbuf(Client *c)
+{
+	Buf *b;
+
+	qlock(&c->lk);
+	if((b = c->free) != nil){
+		c->free = b->next;
+		c->nfree--;
+	}
+	qunlock(&c->lk);
+	if(b == nil)
+		b = malloc(sizeof(Buf));
+	return b;
+}
+
+/* called with c->lk held */
+static void
+putbuf(Client *c, Buf *b)
+{
+	if(c->nfree >= Nfree){
+		free(b);
+		return;
+	}
+	b->next = c->free;
+	c->free = b;
+	c->nfree++;
+}
+
+/* bytes waiting in the pipe */
+static long
+pending(int fd)
+{
+	Dir *d;
+	long n;
+
+	if((d = dirfstat(fd)) == nil)
+		return 0;
+	n = d->length;
+	free(d);
+	return n;
+}
+
 static void
 reconnect(Client *c)
 {
@@ -64,15 +126,18 @@ Again:
 			sysfatal("dial timed out: %r");
 		sleep(1000);
 	}
+	if(c->unackedhead != nil || c->outmsg != 0)
+		c->reconnects++;
 	for(b = c->unackedhead; b != nil; b = b->next){
-		n = GBIT32(b->hdr.nb);
+		n = Hdrsz+GBIT32(b->hdr.nb);
 		PBIT32(b->hdr.acked, c->inmsg);
-		if(write(c->netfd, &b->hdr, Hdrsz) != Hdrsz
-		|| write(c->netfd, b->buf, n) != n){
+		if(write(c->netfd, &b->hdr, n) != n){
 			print("write error: %r\n");
 			goto Again;
 		}
+		c->retrans += n-Hdrsz;
 	}
+	c->inbytes = 0;
 	qunlock(&c->lk);
 }
 
@@ -81,23 +146,46 @@ aanwriter(void *arg)
 {
 	Client *c = (Client*)arg;
 	Buf *b;
-	int n;
+	int n, k, eof;
 	ulong m;
 
+	eof = 0;
 	for(;;){
-		b = malloc(sizeof(Buf));
+		/* leave what does not fit in the window in the pipe */
+		qlock(&c->lk);
+		while(c->unacked > 0 && c->unacked > c->window-Bufsize){
+			c->blocked = 1;
+			c->stalls++;
+			qunlock(&c->lk);
+			rendezvous(&c->blocked, 0);
+			qlock(&c->lk);
+		}
+		qunlock(&c->lk);
+
+		b = getbuf(c);
 		if(b == nil)
 			break;
-		if((n = read(c->pipefd, b->buf, Bufsize)) < 0){
+		n = 0;
+		if(!eof && (n = read(c->pipefd, b->buf, Bufsize)) < 0){
 			free(b);
 			break;
 		}
+		/* under load, fill the message from what is already waiting */
+		while(n > 0 && n < Bufsize && pending(c->pipefd) > 0){
+			if((k = read(c->pipefd, b->buf+n, Bufsize-n)) <= 0){
+				eof = k == 0;
+				break;
+			}
+			n += k;
+		}
 
 		qlock(&c->lk);
 		m = c->outmsg++;
 		PBIT32(b->hdr.nb, n);
 		PBIT32(b->hdr.msg, m);
 		PBIT32(b->hdr.acked, c->inmsg);
+		c->inbytes = 0;
+		c->unacked += n;
 
 		b->next = nil;
 		if(c->unackedhead == nil)
@@ -106,8 +194,7 @@ aanwriter(void *arg)
 		c->unackedtail = &b->next;
 
 		if(c->netfd < 0
-		|| write(c->netfd, &b->hdr, Hdrsz) != Hdrsz
-		|| write(c->netfd, b->buf, n) != n){
+		|| write(c->netfd, &b->hdr, Hdrsz+n) != Hdrsz+n){
 			qunlock(&c->lk);
 			continue;
 		}
@@ -134,17 +221,59 @@ aansyncer(void *arg)
 			PBIT32(hdr.acked, c->inmsg);
 			PBIT32(hdr.msg, -1);
 			write(c->netfd, &hdr, Hdrsz);
+			c->inbytes = 0;
 		}
 		qunlock(&c->lk);
 	}
 }
 
+/* a's messages were acked: free them, and let the writer go on if it may */
+static void
+acked(Client *c, ulong a, ulong *lastacked)
+{
+	Buf *x;
+	int wake;
+
+	qlock(&c->lk);
+	while((x = c->unackedhead) != nil && (long)(a - *lastacked) > 0){
+		assert((ulong)GBIT32(x->hdr.msg) == *lastacked);
+		c->unackedhead = x->next;
+		c->unacked -= GBIT32(x->hdr.nb);
+		putbuf(c, x);
+		++*lastacked;
+	}
+	wake = c->blocked && (c->unacked == 0 || c->unacked <= c->window-Bufsize);
+	if(wake)
+		c->blocked = 0;
+	qunlock(&c->lk);
+	if(wake)
+		rendezvous(&c->blocked, 0);
+}
+
+/* n more bytes came in: ack now rather than leave half a window to the syncer */
+static void
+ack(Client *c, int n)
+{
+	Hdr hdr;
+
+	qlock(&c->lk);
+	c->inbytes += n;
+	if(c->netfd >= 0 && c->inbytes >= c->window/2){
+		PBIT32(hdr.nb, 0);
+		PBIT32(hdr.acked, c->inmsg);
+		PBIT32(hdr.msg, -1);
+		write(c->netfd, &hdr, Hdrsz);
+		c->inbytes = 0;
+	}
+	qunlock(&c->lk);
+}
+
 static void
 aanreader(void *arg)
 {
 	Client *c = (Client*)arg;
 	ulong a, m, lastacked = 0;
-	Buf *b, *x;
+	Buf *b;
 	int n;
 
 Restart:
@@ -156,8 +285,10 @@ Restart:
 		m = GBIT32(b->hdr.msg);
 		n = GBIT32(b->hdr.nb);
 		if(n == 0){
-			if(m == (ulong)-1)
+			if(m == (ulong)-1){
+				acked(c, a, &lastacked);
 				continue;
+			}
 			goto Closed;
 		} else if(n < 0 || n > Bufsize)
 			goto Closed;
@@ -167,22 +298,12 @@ Restart:
 		if(m != c->inmsg)
 			continue;
 		c->inmsg++;
-
-		if((long)(a - lastacked) > 0){
-			qlock(&c->lk);
-			while((x = c->unackedhead) != nil){
-				assert((ulong)GBIT32(x->hdr.msg) == lastacked);
-				c->unackedhead = x->next;
-				free(x);
-				if(++lastacked == a)
-					break;
-			}
-			qunlock(&c->lk);
-		}
+		acked(c, a, &lastacked);
 
 		if(c->pipefd < 0)
 			goto Closed;
 		write(c->pipefd, b->buf, n);
+		ack(c, n);
 	}
 	free(b);
 	reconnect(c);
@@ -191,6 +312,27 @@ Closed:
 	free(b);
 	if(c->pipefd >= 0)
 		write(c->pipefd, "", 0);
+	/* nothing more will be acked */
+	qlock(&c->lk);
+	c->window = 0x7fffffff;
+	qunlock(&c->lk);
+	acked(c, lastacked, &lastacked);
+}
+
+/* for #c/aan */
+static int
+stats(char *buf, int n)
+{
+	Client *c;
+	char *s;
+
+	if((c = client) == nil)
+		return 0;
+	qlock(&c->lk);
+	s = seprint(buf, buf+n, "window %ld unacked %ld stalls %lud retransmitted %llud reconnects %lud\n",
+		c->window, c->unacked, c->stalls, c->retrans, c->reconnects);
+	qunlock(&c->lk);
+	return s-buf;
 }
 
 int
@@ -198,6 +340,7 @@ aanclient(char *addr, int timeout)
 {
 	Client *c;
 	int pfd[2];
+	char *s;
 
 	if(pipe(pfd) < 0)
 		sysfatal("pipe: %r");
@@ -209,10 +352,19 @@ aanclient(char *addr, int timeout)
 	c->inmsg = 0;
 	c->outmsg = 0;
 	c->timeout = 60;
+	c->window = Window;
+	if((s = getenv("aanwindow")) != nil){
+		c->window = atol(s);
+		if(c->window < Bufsize)
+			c->window = Bufsize;
+		free(s);
+	}
 	reconnect(c);
 	c->timeout = timeout;
 	c->writer = kproc("aanwriter", aanwriter, c);
 	c->reader = kproc("aanreader", aanreader, c);
 	c->syncer = kproc("aansyncer", aansyncer, c);
+	client = c;
+	aanstats = stats;
 	return pfd[0];
 }
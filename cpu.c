@@ -510,6 +510,8 @@ p9authtls(int fd)
 {
 	AuthInfo *ai;
 	TLSconn *conn;
+	char buf[64], *s;
+	int cfd;
 
 	ai = p9any(fd);
 	if(ai == nil)
@@ -524,6 +526,15 @@ p9authtls(int fd)
 	if(fd < 0)
 		sysfatal("tlsClient: %r");
 
+	if((s = getenv("tlscoalesce")) != nil){
+		snprint(buf, sizeof buf, "%s/ctl", conn->dir);
+		if((cfd = open(buf, OWRITE)) < 0 || fprint(cfd, "coalesce %s", s) < 0)
+			fprint(2, "coalesce: %r\n");
+		if(cfd >= 0)
+			close(cfd);
+		free(s);
+	}
+
 	auth_freeAI(ai);
 	free(conn->sessionID);
 	free(conn);
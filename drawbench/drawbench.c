@@ -0,0 +1,778 @@
+/*
+ * drawbench - time the draw device without a display
+ *
+ *	drawbench [-d seconds] [-g widthxheight] [-r recording]... [workload...]
+ *
+ * The kernel is booted as in main.c, with the screen in memory
+ * (screen.c), and the workloads are written as draw messages to
+ * a client's data file in #i, as a program would through /dev/draw,
+ * so drawmesg, libmemlayer and libmemdraw are timed together.
+ * Each workload repeats its operation for about the given time
+ * (default 1 second) and reports ns per operation and Mpixels/s,
+ * counting the bounding box of what each operation draws.
+ * lookup16 and lookup50k draw from one of 16 or of 50000 small
+ * images, so the cost of finding an image by id can be compared.
+ *
+ * A recording holds the writes a program made to its data file,
+ * each as count[4] (little-endian, as in the protocol) followed by
+ * count bytes.  It is replayed start to finish by a new client
+ * each pass and timed per write.
+ */
+#include "u.h"
+#include "lib.h"
+#include "kern/dat.h"
+#include "kern/fns.h"
+#include "user.h"
+#include "draw.h"
+#include "args.h"
+
+enum {
+	Nmsg = 8000,	/* bytes of messages per write */
+	Nbatch = 32,	/* operations between clock reads */
+
+	/* image ids */
+	Opaque = 1,
+	Colour,
+	Offscreen,
+	Argb,
+	Grey8,
+	Font8,
+	Font1,
+	Window,
+	Manyid = 1000,	/* and up, for the lookup workloads */
+
+	Screenid = 1,
+
+	Glyphw = 9,
+	Glyphh = 16,
+	Nglyph = 256,
+	Nstring = 64,	/* characters per string */
+	Nmany = 50000,
+};
+
+typedef struct Work Work;
+struct Work
+{
+	char	*name;
+	vlong	(*op)(int);	/* emit operation i, return pixels */
+	void	(*setup)(void);	/* before timing, if not nil */
+};
+
+char	*argv0;
+char	*geometry;	/* unused; gui-x11 only */
+extern Rectangle	benchr;
+extern ulong	kerndate;
+
+static uchar	msg[Nmsg];
+static int	nmsg;
+static int	datafd;
+static int	nmany;	/* images allocated from Manyid */
+static ulong	seed = 1;
+static char	cwd[512];
+
+static void
+sizebug(void)
+{
+	assert(sizeof(int)==4);
+	assert(sizeof(long)==4);
+	assert(sizeof(ulong)==4);
+	assert(sizeof(vlong)==8);
+}
+
+void
+cpubody(void)
+{
+}
+
+/* the kernel's nsec counts whole seconds */
+static vlong
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static ulong
+rnd(void)
+{
+	seed = seed*1103515245 + 12345;
+	return seed>>8;
+}
+
+static void
+flushmsg(void)
+{
+	if(nmsg == 0)
+		return;
+	if(write(datafd, msg, nmsg) != nmsg)
+		sysfatal("draw write: %r");
+	nmsg = 0;
+}
+
+static uchar*
+bufmsg(int n)
+{
+	uchar *p;
+
+	if(n > Nmsg)
+		sysfatal("draw message of %d bytes", n);
+	if(nmsg+n > Nmsg)
+		flushmsg();
+	p = msg+nmsg;
+	nmsg += n;
+	return p;
+}
+
+static uchar*
+bppoint(uchar *a, Point p)
+{
+	BPLONG(a+0, p.x);
+	BPLONG(a+4, p.y);
+	return a+8;
+}
+
+static uchar*
+bprect(uchar *a, Rectangle r)
+{
+	a = bppoint(a, r.min);
+	return bppoint(a, r.max);
+}
+
+static void
+allocimg(int id, int screenid, ulong chan, int repl, Rectangle r, ulong val)
+{
+	uchar *a;
+
+	a = bufmsg(1+4+4+1+4+1+4*4+4*4+4);
+	a[0] = 'b';
+	BPLONG(a+1, id);
+	BPLONG(a+5, screenid);
+	a[9] = Refbackup;
+	BPLONG(a+10, chan);
+	a[14] = repl;
+	a = bprect(a+15, r);
+	if(repl)
+		r = Rect(-0x3FFFFFFF, -0x3FFFFFFF, 0x3FFFFFFF, 0x3FFFFFFF);
+	a = bprect(a, r);
+	BPLONG(a, val);
+}
+
+/*
+ * Load an image with bytes from gen, a few rows per message.
+ */
+static void
+loadimg(int id, Rectangle r, int depth, int (*gen)(int))
+{
+	uchar *a;
+	int y, dy, i, n, bpl, bpp;
+
+	bpl = bytesperline(r, depth);
+	bpp = depth<8 ? 1 : depth/8;
+	for(y=r.min.y; y<r.max.y; y+=dy){
+		dy = (Nmsg-(1+4+4*4))/bpl;
+		if(dy > r.max.y-y)
+			dy = r.max.y-y;
+		if(dy <= 0)
+			sysfatal("image row too long");
+		n = dy*bpl;
+		a = bufmsg(1+4+4*4+n);
+		a[0] = 'y';
+		BPLONG(a+1, id);
+		a = bprect(a+5, Rect(r.min.x, y, r.max.x, y+dy));
+		for(i=0; i<n; i++)
+			a[i] = gen(i%bpp);
+	}
+}
+
+/* glyph coverage: mostly clear, some solid, the rest edges */
+static int
+genglyph(int c)
+{
+	ulong v;
+
+	USED(c);
+	v = rnd()%8;
+	if(v < 4)
+		return 0;
+	if(v < 6)
+		return 255;
+	return rnd();
+}
+
+/* premultiplied ARGB32, little-endian b g r a */
+static int
+genargb(int c)
+{
+	static int alpha;
+
+	if(c == 0)
+		alpha = rnd()&0xFF;
+	if(c == 3)
+		return alpha;
+	return rnd()%(alpha+1);
+}
+
+static int
+genrgb(int c)
+{
+	USED(c);
+	return rnd();
+}
+
+static void
+drawmsg(int dst, Rectangle r, int src, Point sp, int mask, Point mp)
+{
+	uchar *a;
+
+	a = bufmsg(1+4+4+4+4*4+2*4+2*4);
+	a[0] = 'd';
+	BPLONG(a+1, dst);
+	BPLONG(a+5, src);
+	BPLONG(a+9, mask);
+	a = bprect(a+13, r);
+	a = bppoint(a, sp);
+	bppoint(a, mp);
+}
+
+/* somewhere on the screen for an operation of size s */
+static Point
+place(int i, Point s)
+{
+	int w, h;
+
+	w = Dx(benchr)-s.x;
+	h = Dy(benchr)-s.y;
+	if(w < 1)
+		w = 1;
+	if(h < 1)
+		h = 1;
+	return addpt(benchr.min, Pt((i*37)%w, (i*53)%h));
+}
+
+static vlong
+fill(int i)
+{
+	Point p;
+
+	p = place(i, Pt(256, 256));
+	drawmsg(0, Rect(p.x, p.y, p.x+256, p.y+256), Colour, ZP, Opaque, ZP);
+	return 256*256;
+}
+
+static vlong
+fillsmall(int i)
+{
+	Point p;
+
+	p = place(i, Pt(Glyphw, Glyphh));
+	drawmsg(0, Rect(p.x, p.y, p.x+Glyphw, p.y+Glyphh), Colour, ZP, Opaque, ZP);
+	return Glyphw*Glyphh;
+}
+
+static vlong
+copy(int i)
+{
+	Point p;
+
+	p = place(i, Pt(256, 256));
+	drawmsg(0, Rect(p.x, p.y, p.x+256, p.y+256), Offscreen, Pt(i%256, i%256), Opaque, ZP);
+	return 256*256;
+}
+
+static vlong
+blend(int i)
+{
+	Point p;
+
+	p = place(i, Pt(256, 256));
+	drawmsg(0, Rect(p.x, p.y, p.x+256, p.y+256), Argb, Pt(i%256, i%256), Opaque, ZP);
+	return 256*256;
+}
+
+static vlong
+blendmask(int i)
+{
+	Point p;
+
+	p = place(i, Pt(256, 256));
+	drawmsg(0, Rect(p.x, p.y, p.x+256, p.y+256), Colour, ZP, Grey8, Pt(i%256, i%256));
+	return 256*256;
+}
+
+static vlong
+dostring(int i, int font)
+{
+	uchar *a;
+	Point p;
+	int j;
+
+	p = place(i, Pt(Nstring*Glyphw, Glyphh));
+	a = bufmsg(1+4+4+4+2*4+4*4+2*4+2+Nstring*2);
+	a[0] = 's';
+	BPLONG(a+1, 0);
+	BPLONG(a+5, Colour);
+	BPLONG(a+9, font);
+	a = bppoint(a+13, addpt(p, Pt(0, Glyphh-4)));
+	a = bprect(a, benchr);
+	a = bppoint(a, ZP);
+	BPSHORT(a, Nstring);
+	a += 2;
+	for(j=0; j<Nstring; j++){
+		BPSHORT(a, (i+j*7)%Nglyph);
+		a += 2;
+	}
+	return Nstring*Glyphw*Glyphh;
+}
+
+static vlong
+string8(int i)
+{
+	return dostring(i, Font8);
+}
+
+static vlong
+string1(int i)
+{
+	return dostring(i, Font1);
+}
+
+static vlong
+doellipse(int i, int c)
+{
+	uchar *a;
+	Point p;
+
+	p = place(i, Pt(2*100+4, 2*60+4));
+	a = bufmsg(1+4+4+2*4+4+4+4+2*4+2*4);
+	a[0] = c;
+	BPLONG(a+1, 0);
+	BPLONG(a+5, Colour);
+	a = bppoint(a+9, addpt(p, Pt(102, 62)));
+	BPLONG(a+0, 100);
+	BPLONG(a+4, 60);
+	BPLONG(a+8, 2);
+	a = bppoint(a+12, ZP);
+	BPLONG(a+0, 0);
+	BPLONG(a+4, 0);
+	return 205*125;
+}
+
+static vlong
+ellipseline(int i)
+{
+	return doellipse(i, 'e');
+}
+
+static vlong
+ellipsefill(int i)
+{
+	return doellipse(i, 'E');
+}
+
+static uchar*
+bpcoord(uchar *a, int x)
+{
+	/* the long form: absolute, 23 bits */
+	a[0] = 0x80|(x&0x7F);
+	a[1] = x>>7;
+	a[2] = x>>15;
+	return a+3;
+}
+
+/*
+ * A 16-pointed star in a 256 square.
+ */
+static vlong
+dopoly(int i, int c)
+{
+	static Point star[17];
+	uchar *a;
+	Point p;
+	int j, n, cs, sn;
+
+	if(star[0].x == 0)
+		for(j=0; j<17; j++){
+			n = (j%2) ? 40 : 120;
+			icossin(j*360/16, &cs, &sn);
+			star[j] = Pt(128+n*cs/1024, 128+n*sn/1024);
+		}
+	p = place(i, Pt(256, 256));
+	a = bufmsg(1+4+2+4+4+4+4+2*4+17*2*3);
+	a[0] = c;
+	BPLONG(a+1, 0);
+	BPSHORT(a+5, 16);
+	BPLONG(a+7, c=='P' ? ~0 : Endsquare);
+	BPLONG(a+11, Endsquare);
+	BPLONG(a+15, 1);
+	BPLONG(a+19, Colour);
+	a = bppoint(a+23, ZP);
+	for(j=0; j<17; j++){
+		a = bpcoord(a, p.x+star[j].x);
+		a = bpcoord(a, p.y+star[j].y);
+	}
+	return 256*256;
+}
+
+static vlong
+polyfill(int i)
+{
+	return dopoly(i, 'P');
+}
+
+static vlong
+polyline(int i)
+{
+	return dopoly(i, 'p');
+}
+
+/*
+ * Move a window around the screen: memlorigin exposes what it
+ * leaves and draws what it covers from the backing store.
+ */
+static vlong
+winmove(int i)
+{
+	uchar *a;
+	Rectangle r;
+	Point p;
+
+	r = Rect(0, 0, Dx(benchr)/2, Dy(benchr)/2);
+	p = place(i, r.max);
+	a = bufmsg(1+4+2*4+2*4);
+	a[0] = 'o';
+	BPLONG(a+1, Window);
+	a = bppoint(a+5, ZP);
+	bppoint(a, p);
+	return (vlong)Dx(r)*Dy(r);
+}
+
+/*
+ * Copy one of the first n of many 8x8 images, chosen at random,
+ * so each draw looks up an image the last few did not.
+ */
+static vlong
+lookup(int i, int n)
+{
+	Point p;
+
+	p = place(i, Pt(8, 8));
+	drawmsg(0, Rect(p.x, p.y, p.x+8, p.y+8), Manyid+rnd()%n, ZP, Opaque, ZP);
+	return 8*8;
+}
+
+static vlong
+lookup16(int i)
+{
+	return lookup(i, 16);
+}
+
+static vlong
+lookup50k(int i)
+{
+	return lookup(i, Nmany);
+}
+
+static void
+allocmany(int n)
+{
+	for(; nmany<n; nmany++)
+		allocimg(Manyid+nmany, 0, XRGB32, 0, Rect(0, 0, 8, 8), rnd()<<8|0xFF);
+	flushmsg();
+}
+
+static void
+many16(void)
+{
+	allocmany(16);
+}
+
+static void
+many50k(void)
+{
+	allocmany(Nmany);
+}
+
+static Work work[] = {
+	"fill",	fill,	nil,
+	"fillsmall",	fillsmall,	nil,
+	"copy",	copy,	nil,
+	"blend",	blend,	nil,
+	"blendmask",	blendmask,	nil,
+	"string8",	string8,	nil,
+	"string1",	string1,	nil,
+	"ellipse",	ellipseline,	nil,
+	"ellipsefill",	ellipsefill,	nil,
+	"poly",	polyline,	nil,
+	"polyfill",	polyfill,	nil,
+	"winmove",	winmove,	nil,
+	"lookup16",	lookup16,	many16,
+	"lookup50k",	lookup50k,	many50k,
+};
+
+static void
+flushscreen(void)
+{
+	*bufmsg(1) = 'v';
+	flushmsg();
+}
+
+/*
+ * Open a new client: return its ctl file, which holds the
+ * client open, and set datafd.
+ */
+static int
+newclient(void)
+{
+	char buf[12*12+1], name[64];
+	int fd, id;
+
+	fd = open("#i/draw/new", ORDWR);
+	if(fd < 0)
+		sysfatal("open #i/draw/new: %r");
+	if(read(fd, buf, 12*12) != 12*12)
+		sysfatal("read #i/draw/new: %r");
+	buf[12*12] = 0;
+	id = atoi(buf);
+	snprint(name, sizeof name, "#i/draw/%d/data", id);
+	datafd = open(name, ORDWR);
+	if(datafd < 0)
+		sysfatal("open %s: %r", name);
+	return fd;
+}
+
+/*
+ * Nglyph characters side by side, each loaded from itself.
+ */
+static void
+setupfont(int id, ulong chan)
+{
+	uchar *a;
+	Rectangle r;
+	int i;
+
+	r = Rect(0, 0, Nglyph*Glyphw, Glyphh);
+	allocimg(id, 0, chan, 0, r, DBlack);
+	loadimg(id, r, chantodepth(chan), chan==GREY8 ? genglyph : genrgb);
+	a = bufmsg(1+4+4+1);
+	a[0] = 'i';
+	BPLONG(a+1, id);
+	i = Nglyph;
+	BPLONG(a+5, i);
+	a[9] = Glyphh-4;
+	for(i=0; i<Nglyph; i++){
+		r = Rect(i*Glyphw, 0, (i+1)*Glyphw, Glyphh);
+		a = bufmsg(1+4+4+2+4*4+2*4+1+1);
+		a[0] = 'l';
+		BPLONG(a+1, id);
+		BPLONG(a+5, id);
+		BPSHORT(a+9, i);
+		a = bprect(a+11, r);
+		a = bppoint(a, r.min);
+		a[0] = 0;
+		a[1] = Glyphw;
+	}
+}
+
+static void
+setup(void)
+{
+	uchar *a;
+	Rectangle r;
+
+	newclient();
+	allocimg(Opaque, 0, GREY1, 1, Rect(0,0,1,1), DWhite);
+	allocimg(Colour, 0, RGB24, 1, Rect(0,0,1,1), DMedblue);
+	r = Rect(0, 0, 512, 512);
+	allocimg(Offscreen, 0, XRGB32, 0, r, DWhite);
+	loadimg(Offscreen, r, 32, genrgb);
+	allocimg(Argb, 0, ARGB32, 0, r, DTransparent);
+	loadimg(Argb, r, 32, genargb);
+	allocimg(Grey8, 0, GREY8, 0, r, DBlack);
+	loadimg(Grey8, r, 8, genglyph);
+	setupfont(Font8, GREY8);
+	setupfont(Font1, GREY1);
+
+	/* a screen on the display and one window on it */
+	a = bufmsg(1+4+4+4+1);
+	a[0] = 'A';
+	BPLONG(a+1, Screenid);
+	BPLONG(a+5, 0);
+	BPLONG(a+9, Colour);
+	a[13] = 0;
+	allocimg(Window, Screenid, XRGB32, 0, Rect(0, 0, Dx(benchr)/2, Dy(benchr)/2), DPaleyellow);
+	flushscreen();
+}
+
+static void
+report(char *name, vlong ns, vlong nop, vlong pix)
+{
+	if(nop == 0)
+		nop = 1;
+	if(ns == 0)
+		ns = 1;
+	if(pix < 0)
+		print("%-12s %10lld ops %12.1f ns/op\n", name, nop, (double)ns/nop);
+	else
+		print("%-12s %10lld ops %12.1f ns/op %10.1f Mpix/s\n", name, nop,
+			(double)ns/nop, (double)pix*1000/ns);
+}
+
+static void
+run(Work *w, vlong dur)
+{
+	vlong t0, t, nop, pix;
+	int i;
+
+	if(w->setup != nil)
+		(*w->setup)();
+	pix = 0;
+	nop = 0;
+	flushscreen();
+	t0 = now();
+	do{
+		for(i=0; i<Nbatch; i++)
+			pix += (*w->op)(nop++);
+		flushscreen();
+		t = now()-t0;
+	}while(t < dur);
+	report(w->name, t, nop, pix);
+}
+
+/*
+ * Replay a recording (see above) until dur has passed.
+ */
+static void
+replay(char *file, vlong dur)
+{
+	char name[1024];
+	uchar *buf, *p, *e;
+	vlong t0, t, nw, len;
+	int fd, n, ctl, data, err;
+	Dir *d;
+
+	/* the host's files are under /root, as in main.c */
+	if(file[0] == '/')
+		snprint(name, sizeof name, "/root%s", file);
+	else
+		snprint(name, sizeof name, "/root%s/%s", cwd, file);
+	fd = open(name, OREAD);
+	if(fd < 0)
+		sysfatal("open %s: %r", file);
+	if((d = dirfstat(fd)) == nil)
+		sysfatal("stat %s: %r", file);
+	len = d->length;
+	free(d);
+	buf = malloc(len);
+	if(buf == nil)
+		sysfatal("malloc: %r");
+	if(readn(fd, buf, len) != len)
+		sysfatal("read %s: %r", file);
+	close(fd);
+
+	data = datafd;
+	nw = 0;
+	err = 0;
+	t = 0;
+	do{
+		t0 = now();
+		ctl = newclient();
+		for(p=buf, e=buf+len; p+4 <= e; p+=n){
+			n = p[0] | p[1]<<8 | p[2]<<16 | p[3]<<24;
+			p += 4;
+			if(n < 0 || n > e-p)
+				sysfatal("%s: bad record", file);
+			if(write(datafd, p, n) != n && err++ == 0)
+				fprint(2, "drawbench: %s: %r\n", file);
+			nw++;
+		}
+		close(datafd);
+		close(ctl);
+		t += now()-t0;
+	}while(t < dur);
+	datafd = data;
+	free(buf);
+	report(file, t, nw, -1);
+}
+
+static void
+usage(void)
+{
+	fprint(2, "usage: drawbench [-d seconds] [-g widthxheight] [-r recording]... [workload...]\n");
+	exits("usage");
+}
+
+int
+main(int argc, char **argv)
+{
+	char *rec[16], *p;
+	vlong dur;
+	int i, j, nrec;
+
+	kerndate = seconds();
+	eve = "drawbench";
+	sizebug();
+
+	osinit();
+	procinit0();
+	printinit();
+	chandevreset();
+	chandevinit();
+	quotefmtinstall();
+
+	if(bind("#c", "/dev", MBEFORE) < 0)
+		panic("bind #c: %r");
+	if(bind("#U", "/root", MREPL) < 0)
+		panic("bind #U: %r");
+	if(getcwd(cwd, sizeof cwd) == nil)
+		cwd[0] = 0;
+	if(open("/dev/cons", OREAD) != 0)
+		panic("open0: %r");
+	if(open("/dev/cons", OWRITE) != 1)
+		panic("open1: %r");
+	if(open("/dev/cons", OWRITE) != 2)
+		panic("open2: %r");
+
+	/* after the boot, so that usage can print */
+	dur = 1000000000LL;
+	nrec = 0;
+	ARGBEGIN{
+	case 'd':
+		dur = atof(EARGF(usage()))*1e9;
+		break;
+	case 'g':
+		p = EARGF(usage());
+		benchr = Rect(0, 0, strtol(p, &p, 10), 0);
+		if(*p++ != 'x')
+			usage();
+		benchr.max.y = strtol(p, nil, 10);
+		if(Dx(benchr) < 512 || Dy(benchr) < 256)
+			sysfatal("screen must be at least 512x256");
+		break;
+	case 'r':
+		if(nrec == nelem(rec))
+			usage();
+		rec[nrec++] = EARGF(usage());
+		break;
+	default:
+		usage();
+	}ARGEND
+
+	setup();
+	for(i=0; i<(int)nelem(work); i++){
+		if(argc > 0){
+			for(j=0; j<argc; j++)
+				if(strcmp(argv[j], work[i].name) == 0)
+					break;
+			if(j == argc)
+				continue;
+		}else if(nrec > 0)
+			continue;
+		run(&work[i], dur);
+	}
+	for(i=0; i<nrec; i++)
+		replay(rec[i], dur);
+	exits(nil);
+	return 0;
+}
@@ -0,0 +1,545 @@
+/*
+ * fsbench - time the mount driver against a loopback 9P server
+ *
+ *	fsbench [-d seconds] [-f files] [-l latency] [-n readers] [workload...]
+ *
+ * The kernel is booted as in main.c, and the server runs in this
+ * process on the other end of a pipe.  It serves one synthetic file,
+ * f, and answers each message in the order they came, the given
+ * latency (default 5ms) after it arrived, so that rpcs pile up
+ * in the mount driver as they would on a slow link.  It counts
+ * the messages and the bytes of file data it sends.
+ *
+ *	readers	the given number of procs (default 1000) share one
+ *		open f and pread 64 bytes at a time from it,
+ *		checking what comes back, for about the given time
+ *		(default 1 second); reports reads per second and
+ *		the mean time a read took.  This loads devmnt's tag
+ *		allocation and its dispatch of replies.
+ *
+ *	cache	on a cached mount, reads f through three times:
+ *		cold, again, and after the server has changed its
+ *		qid.vers; reports the time each pass took and the
+ *		bytes of f the server sent for it, which should be
+ *		all of f, none, and all of f again.
+ *
+ *	window	reads f through, cold, on cached mounts that keep
+ *		1, 2, 4, 8 and 16 reads in flight; reports the time
+ *		each took.
+ *
+ *	dirread	makes a directory of the given number of empty files
+ *		(default 100000) under the host's /tmp, eight levels
+ *		down, and lists it through #U for about the given
+ *		time, 8K at a time as a 9P client would; reports the
+ *		time a listing took.  This one does not use the server.
+ */
+#include "u.h"
+#include "lib.h"
+#include "kern/dat.h"
+#include "kern/fns.h"
+#include "user.h"
+#include "args.h"
+
+#undef stat	/* user.h's; the server fills in Fcall.stat */
+
+enum {
+	Msize = 8192+IOHDRSZ,
+	Flen = 1<<20,	/* length of f */
+	Qf = 1,	/* f's qid.path */
+	Nrec = 64,	/* bytes per read for readers */
+};
+
+typedef struct Reply Reply;
+struct Reply
+{
+	Reply	*next;
+	vlong	due;
+	int	n;
+	uchar	buf[Msize];
+};
+
+typedef struct Work Work;
+struct Work
+{
+	char	*name;
+	void	(*run)(vlong);
+};
+
+char	*argv0;
+char	*geometry;	/* unused */
+extern ulong	kerndate;
+
+static int	srvfd;	/* the server's end of the pipe */
+static int	mntfd;	/* the mount's */
+static vlong	latency = 5000000;
+static int	nreader = 1000;
+static int	nfile = 100000;
+
+static struct
+{
+	Lock	lk;
+	Reply	*head;
+	Reply	**tail;
+	ulong	vers;	/* f's qid.vers */
+	vlong	nmsg;	/* messages answered */
+	vlong	nbyte;	/* of file data sent */
+} srv;
+
+static struct
+{
+	Lock	lk;
+	int	fd;
+	int	done;
+	int	stop;
+	int	bad;
+	vlong	nread;
+	vlong	ns;	/* summed over the reads */
+} rd;
+
+void
+cpubody(void)
+{
+}
+
+/* the kernel's nsec counts whole seconds */
+static vlong
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/* byte o of f */
+static uchar
+fbyte(vlong o)
+{
+	return o*7 + (o>>9);
+}
+
+static void
+fqid(Qid *q)
+{
+	q->path = Qf;
+	q->vers = srv.vers;
+	q->type = 0;
+}
+
+/*
+ * Send the replies in order once they are due.
+ */
+static void
+sender(void *a)
+{
+	Reply *r;
+	vlong t;
+
+	USED(a);
+	for(;;){
+		lock(&srv.lk);
+		r = srv.head;
+		t = now();
+		if(r == nil || r->due > t){
+			unlock(&srv.lk);
+			osusleep(r == nil ? 200 : (r->due-t)/1000);
+			continue;
+		}
+		srv.head = r->next;
+		if(srv.head == nil)
+			srv.tail = &srv.head;
+		unlock(&srv.lk);
+		if(write(srvfd, r->buf, r->n) != r->n)
+			panic("fsbench: server write: %r");
+		free(r);
+	}
+}
+
+static void
+reply(Fcall *f)
+{
+	Reply *r;
+
+	r = malloc(sizeof *r);
+	if(r == nil)
+		panic("fsbench: out of memory");
+	r->n = convS2M(f, r->buf, sizeof r->buf);
+	if(r->n == 0)
+		panic("fsbench: convS2M");
+	r->due = now()+latency;
+	r->next = nil;
+	lock(&srv.lk);
+	*srv.tail = r;
+	srv.tail = &r->next;
+	srv.nmsg++;
+	if(f->type == Rread)
+		srv.nbyte += f->count;
+	unlock(&srv.lk);
+}
+
+static void
+server(void *a)
+{
+	static uchar buf[Msize], data[Msize], st[256];
+	Fcall t, r;
+	Dir d;
+	vlong o;
+	int n, i;
+
+	USED(a);
+	for(;;){
+		n = read9pmsg(srvfd, buf, sizeof buf);
+		if(n <= 0)
+			panic("fsbench: server read: %r");
+		if(convM2S(buf, n, &t) != (uint)n)
+			panic("fsbench: convM2S");
+		memset(&r, 0, sizeof r);
+		r.tag = t.tag;
+		r.type = t.type+1;
+		switch(t.type){
+		case Tversion:
+			r.msize = Msize;
+			r.version = "9P2000";
+			break;
+		case Tattach:
+			r.qid = (Qid){0, 0, QTDIR};
+			break;
+		case Twalk:
+			if(t.nwname > 1 || (t.nwname == 1 && strcmp(t.wname[0], "f") != 0)){
+				r.type = Rerror;
+				r.ename = "file does not exist";
+				break;
+			}
+			r.nwqid = t.nwname;
+			if(t.nwname == 1)
+				fqid(&r.wqid[0]);
+			break;
+		case Topen:
+			fqid(&r.qid);
+			break;
+		case Tread:
+			o = t.offset;
+			r.count = t.count;
+			if(r.count > sizeof data)
+				r.count = sizeof data;
+			if(o >= Flen)
+				r.count = 0;
+			else if(o+r.count > Flen)
+				r.count = Flen-o;
+			for(i=0; i<(int)r.count; i++)
+				data[i] = fbyte(o+i);
+			r.data = (char*)data;
+			break;
+		case Tstat:
+			memset(&d, 0, sizeof d);
+			d.name = "f";
+			d.uid = d.gid = d.muid = "fsbench";
+			fqid(&d.qid);
+			d.length = Flen;
+			d.mode = 0444;
+			r.nstat = convD2M(&d, st, sizeof st);
+			r.stat = st;
+			break;
+		case Tclunk:
+		case Tflush:
+			break;
+		default:
+			r.type = Rerror;
+			r.ename = "permission denied";
+			break;
+		}
+		reply(&r);
+	}
+}
+
+static void
+mountsrv(char *spec)
+{
+	int fd;
+
+	if((fd = dup(mntfd, -1)) < 0)
+		sysfatal("dup: %r");
+	if(mount(fd, -1, "/mnt", MREPL, spec) < 0)
+		sysfatal("mount: %r");
+}
+
+static void
+reader(void *a)
+{
+	uchar buf[Nrec];
+	vlong t, ns, nr, o;
+	ulong seed;
+	int i, bad;
+
+	seed = (uintptr)a;
+	bad = 0;
+	ns = 0;
+	for(nr = 0; !bad && !rd.stop; nr++){
+		seed = seed*1103515245 + 12345;
+		o = (seed>>8) % (Flen-Nrec);
+		t = now();
+		if(pread(rd.fd, buf, Nrec, o) != Nrec)
+			bad = 1;
+		ns += now()-t;
+		for(i=0; i<Nrec; i++)
+			if(buf[i] != fbyte(o+i))
+				bad = 1;
+	}
+	lock(&rd.lk);
+	rd.nread += nr;
+	rd.ns += ns;
+	rd.bad += bad;
+	rd.done++;
+	unlock(&rd.lk);
+	pexit("", 0);
+}
+
+static void
+readers(vlong dur)
+{
+	vlong t0, t;
+	int i;
+
+	mountsrv("");
+	memset(&rd, 0, sizeof rd);
+	if((rd.fd = open("/mnt/f", OREAD)) < 0)
+		sysfatal("open /mnt/f: %r");
+	t0 = now();
+	for(i=0; i<nreader; i++)
+		kproc("reader", reader, (void*)(uintptr)(i+1));
+	while(now()-t0 < dur)
+		osmsleep(10);
+	rd.stop = 1;
+	while(rd.done < nreader)
+		osmsleep(1);
+	t = now()-t0;
+	if(rd.bad)
+		sysfatal("readers: %d of %d failed", rd.bad, nreader);
+	close(rd.fd);
+	if(rd.nread == 0)
+		rd.nread = 1;
+	print("%-10s %5d procs %10lld reads %10.0f reads/s %8.2f ms/read\n",
+		"readers", nreader, rd.nread, rd.nread*1e9/t, rd.ns/1e6/rd.nread);
+	unmount(nil, "/mnt");
+}
+
+/* read f through, checking it; returns the bytes the server sent */
+static vlong
+readf(vlong *ns)
+{
+	static uchar buf[8192];
+	vlong o, t, nb;
+	int fd, i, n;
+
+	lock(&srv.lk);
+	nb = srv.nbyte;
+	unlock(&srv.lk);
+	t = now();
+	if((fd = open("/mnt/f", OREAD)) < 0)
+		sysfatal("open /mnt/f: %r");
+	for(o = 0; (n = read(fd, buf, sizeof buf)) > 0; o += n)
+		for(i=0; i<n; i++)
+			if(buf[i] != fbyte(o+i))
+				sysfatal("cache: bad byte at %lld", o+i);
+	if(n < 0)
+		sysfatal("read /mnt/f: %r");
+	if(o != Flen)
+		sysfatal("cache: read %lld bytes, want %d", o, Flen);
+	close(fd);
+	*ns = now()-t;
+	lock(&srv.lk);
+	nb = srv.nbyte-nb;
+	unlock(&srv.lk);
+	return nb;
+}
+
+static void
+cache(vlong dur)
+{
+	static char *pass[] = {"cold", "warm", "new vers"};
+	vlong ns, nb;
+	int i;
+
+	USED(dur);
+	mountsrv("cache");
+	for(i=0; i<(int)nelem(pass); i++){
+		if(i == 2){
+			lock(&srv.lk);
+			srv.vers++;
+			unlock(&srv.lk);
+		}
+		nb = readf(&ns);
+		print("%-10s %-8s %8d bytes %10lld served %8.2f ms\n",
+			"cache", pass[i], Flen, nb, ns/1e6);
+	}
+	unmount(nil, "/mnt");
+}
+
+/* list dir, returning the number of entries */
+static int
+listdir(char *dir)
+{
+	static uchar buf[8192];
+	int fd, n, i, ne;
+
+	if((fd = open(dir, OREAD)) < 0)
+		sysfatal("open %s: %r", dir);
+	ne = 0;
+	while((n = read(fd, buf, sizeof buf)) > 0)
+		for(i = 0; i < n; i += BIT16SZ+GBIT16(buf+i))
+			ne++;
+	if(n < 0)
+		sysfatal("read %s: %r", dir);
+	close(fd);
+	return ne;
+}
+
+static void
+dirlist(vlong dur)
+{
+	static char *sub[] = {"a", "b", "c", "d", "e", "f"};
+	char dir[256], name[300];
+	vlong t0, t;
+	int i, fd, n, np;
+
+	if(bind("#U", "/root", MREPL) < 0)
+		sysfatal("bind #U: %r");
+	n = snprint(dir, sizeof dir, "/root/tmp/fsbench.%llud", now());
+	for(i=0; i<=(int)nelem(sub); i++){
+		if(i > 0)
+			n += snprint(dir+n, sizeof dir-n, "/%s", sub[i-1]);
+		if((fd = create(dir, OREAD, DMDIR|0777)) < 0)
+			sysfatal("create %s: %r", dir);
+		close(fd);
+	}
+	for(i=0; i<nfile; i++){
+		snprint(name, sizeof name, "%s/file%d", dir, i);
+		if((fd = create(name, OWRITE, 0666)) < 0)
+			sysfatal("create %s: %r", name);
+		close(fd);
+	}
+
+	np = 0;
+	t0 = now();
+	do{
+		if((n = listdir(dir)) != nfile)
+			sysfatal("dirread: %d entries, want %d", n, nfile);
+		np++;
+	}while(now()-t0 < dur);
+	t = now()-t0;
+	print("%-10s %8d files %5d listings %8.2f ms/listing\n",
+		"dirread", nfile, np, t/1e6/np);
+
+	for(i=0; i<nfile; i++){
+		snprint(name, sizeof name, "%s/file%d", dir, i);
+		remove(name);
+	}
+	for(i=nelem(sub); i>=0; i--){
+		remove(dir);
+		*strrchr(dir, '/') = 0;
+	}
+	unmount(nil, "/root");
+}
+
+static void
+window(vlong dur)
+{
+	static int win[] = {1, 2, 4, 8, 16};
+	char spec[32];
+	vlong ns, nb;
+	int i;
+
+	USED(dur);
+	for(i=0; i<(int)nelem(win); i++){
+		snprint(spec, sizeof spec, "cache window=%d", win[i]);
+		mountsrv(spec);
+		nb = readf(&ns);
+		print("%-10s %2d rpcs %8d bytes %10lld served %8.2f ms %8.2f MB/s\n",
+			"window", win[i], Flen, nb, ns/1e6, Flen*1e3/ns);
+		unmount(nil, "/mnt");
+	}
+}
+
+static Work work[] = {
+	"readers",	readers,
+	"cache",	cache,
+	"window",	window,
+	"dirread",	dirlist,
+};
+
+static void
+usage(void)
+{
+	fprint(2, "usage: fsbench [-d seconds] [-f files] [-l latency] [-n readers] [workload...]\n");
+	exits("usage");
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, j, p[2];
+	vlong dur;
+
+	kerndate = seconds();
+	eve = "fsbench";
+
+	osinit();
+	procinit0();
+	printinit();
+	chandevreset();
+	chandevinit();
+	quotefmtinstall();
+
+	if(bind("#c", "/dev", MBEFORE) < 0)
+		panic("bind #c: %r");
+	if(open("/dev/cons", OREAD) != 0)
+		panic("open0: %r");
+	if(open("/dev/cons", OWRITE) != 1)
+		panic("open1: %r");
+	if(open("/dev/cons", OWRITE) != 2)
+		panic("open2: %r");
+
+	/* after the boot, so that usage can print */
+	dur = 1000000000LL;
+	ARGBEGIN{
+	case 'd':
+		dur = atof(EARGF(usage()))*1e9;
+		break;
+	case 'f':
+		nfile = atoi(EARGF(usage()));
+		if(nfile < 1)
+			usage();
+		break;
+	case 'l':
+		latency = atof(EARGF(usage()))*1e6;
+		break;
+	case 'n':
+		nreader = atoi(EARGF(usage()));
+		if(nreader < 1)
+			usage();
+		break;
+	default:
+		usage();
+	}ARGEND
+
+	if(pipe(p) < 0)
+		panic("pipe: %r");
+	srvfd = p[0];
+	mntfd = p[1];
+	srv.tail = &srv.head;
+	kproc("server", server, nil);
+	kproc("sender", sender, nil);
+
+	for(i=0; i<(int)nelem(work); i++){
+		if(argc > 0){
+			for(j=0; j<argc; j++)
+				if(strcmp(argv[j], work[i].name) == 0)
+					break;
+			if(j == argc)
+				continue;
+		}
+		(*work[i].run)(dur);
+	}
+	exits(nil);
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include "u.h"
+#include "lib.h"
+#include "dat.h"
+#include "fns.h"
+#include "error.h"
+
+#include <draw.h>
+#include <memdraw.h>
+#include <cursor.h>
+#include "screen.h"
+
+/*
+ * A screen with nothing behind it for drawbench: gscreen lives
+ * in memory and flushing it is free.
+ */
+
+Memimage	*gscreen;
+Rectangle	benchr = {0, 0, 1024, 768};	/* set before the first attach */
+
+static char	*snarf;
+
+void
+flushmemscreen(Rectangle r)
+{
+	USED(r);
+}
+
+void
+screensize(Rectangle r, ulong chan)
+{
+	Memimage *i;
+
+	if((i = allocmemimage(r, chan)) == nil)
+		return;
+	if(gscreen != nil)
+		freememimage(gscreen);
+	gscreen = i;
+	gscreen->clipr = ZR;
+}
+
+void
+screeninit(void)
+{
+	memimageinit();
+	screensize(benchr, XRGB32);
+	if(gscreen == nil)
+		panic("screensize failed");
+	gscreen->clipr = gscreen->r;
+	memfillcolor(gscreen, DWhite);
+	drawbandinit();
+}
+
+Memdata*
+attachscreen(Rectangle *r, ulong *chan, int *depth, int *width, int *softscreen)
+{
+	*r = gscreen->clipr;
+	*chan = gscreen->chan;
+	*depth = gscreen->depth;
+	*width = gscreen->width;
+	*softscreen = 1;
+
+	gscreen->data->ref++;
+	return gscreen->data;
+}
+
+void
+getcolor(ulong i, ulong *r, ulong *g, ulong *b)
+{
+	ulong v;
+
+	v = cmap2rgb(i);
+	*r = (v>>16)&0xFF;
+	*g = (v>>8)&0xFF;
+	*b = v&0xFF;
+}
+
+void
+setcolor(ulong i, ulong r, ulong g, ulong b)
+{
+	USED(i); USED(r); USED(g); USED(b);
+}
+
+void
+mouseset(Point p)
+{
+	USED(p);
+}
+
+void
+setcursor(void)
+{
+}
+
+char*
+clipread(void)
+{
+	if(snarf)
+		return strdup(snarf);
+	return nil;
+}
+
+int
+clipwrite(char *buf)
+{
+	free(snarf);
+	snarf = strdup(buf);
+	return 0;
+}
+
+void
+guimain(void)
+{
+	cpubody();
+}
@@ -0,0 +1,314 @@
+/*
+ * secbench - time libsec's ciphers and digests
+ *
+ *	secbench [-d seconds] [-s recordsize] [cipher...]
+ *
+ * Each cipher seals (or hashes) a buffer of the record size
+ * (default 16384, TLS's largest record) over and over for about
+ * the given time (default 1 second) and reports MB/s, so the
+ * processor-specific code paths in libsec can be compared with
+ * the portable ones.  pbkdf2 counts a round for every 64 bytes
+ * of the record.  The kernel is booted only so print works.
+ */
+#include "u.h"
+#include "lib.h"
+#include "kern/dat.h"
+#include "kern/fns.h"
+#include "user.h"
+#include "libsec.h"
+#include "args.h"
+
+enum {
+	Maxrec = 1<<20,
+	Nbatch = 16,	/* operations between clock reads */
+};
+
+typedef struct Work Work;
+struct Work
+{
+	char	*name;
+	void	(*op)(uchar*, ulong);
+	void	(*seal)(uchar*, ulong);	/* makes sealed for op */
+};
+
+char	*argv0;
+char	*geometry;	/* unused */
+extern ulong	kerndate;
+
+static uchar	key[32];
+static uchar	iv[16];
+static uchar	aad[13];
+static uchar	tag[16];
+static uchar	*sealed;	/* and its tag, for the opens */
+static uchar	sealtag[16];
+static AESstate	aes128, aes256;
+static AESGCMstate	gcm128, gcm256;
+static Chachastate	chacha;
+
+void
+cpubody(void)
+{
+}
+
+/* the kernel's nsec counts whole seconds */
+static vlong
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void
+gcm128seal(uchar *p, ulong n)
+{
+	aesgcm_setiv(&gcm128, iv, 12);
+	aesgcm_encrypt(p, n, aad, sizeof aad, tag, &gcm128);
+}
+
+/*
+ * A record that fails its check is not decrypted, so each
+ * open starts from a copy of one sealed beforehand; the copy
+ * is timed with it.
+ */
+static void
+gcmopen(AESGCMstate *s, uchar *p, ulong n)
+{
+	memmove(p, sealed, n);
+	aesgcm_setiv(s, iv, 12);
+	if(aesgcm_decrypt(p, n, aad, sizeof aad, sealtag, s) != 0)
+		sysfatal("aesgcm_decrypt failed");
+}
+
+static void
+gcm128open(uchar *p, ulong n)
+{
+	gcmopen(&gcm128, p, n);
+}
+
+static void
+gcm256seal(uchar *p, ulong n)
+{
+	aesgcm_setiv(&gcm256, iv, 12);
+	aesgcm_encrypt(p, n, aad, sizeof aad, tag, &gcm256);
+}
+
+static void
+gcm256open(uchar *p, ulong n)
+{
+	gcmopen(&gcm256, p, n);
+}
+
+static void
+cbc128enc(uchar *p, ulong n)
+{
+	aesCBCencrypt(p, n & ~(AESbsize-1), &aes128);
+}
+
+static void
+cbc128dec(uchar *p, ulong n)
+{
+	aesCBCdecrypt(p, n & ~(AESbsize-1), &aes128);
+}
+
+static void
+cbc256enc(uchar *p, ulong n)
+{
+	aesCBCencrypt(p, n & ~(AESbsize-1), &aes256);
+}
+
+static void
+chacha20(uchar *p, ulong n)
+{
+	chacha_encrypt(p, n, &chacha);
+}
+
+static void
+ccpolyseal(uchar *p, ulong n)
+{
+	chacha_setiv(&chacha, iv);
+	ccpoly_encrypt(p, n, aad, sizeof aad, tag, &chacha);
+}
+
+static void
+ccpolyopen(uchar *p, ulong n)
+{
+	memmove(p, sealed, n);
+	chacha_setiv(&chacha, iv);
+	if(ccpoly_decrypt(p, n, aad, sizeof aad, sealtag, &chacha) != 0)
+		sysfatal("ccpoly_decrypt failed");
+}
+
+static void
+poly(uchar *p, ulong n)
+{
+	poly1305(p, n, key, 32, tag, nil);
+}
+
+static void
+dmd5(uchar *p, ulong n)
+{
+	md5(p, n, tag, nil);
+}
+
+static void
+dsha1(uchar *p, ulong n)
+{
+	uchar d[SHA1dlen];
+
+	sha1(p, n, d, nil);
+}
+
+static void
+dsha256(uchar *p, ulong n)
+{
+	uchar d[SHA2_256dlen];
+
+	sha2_256(p, n, d, nil);
+}
+
+static void
+dsha512(uchar *p, ulong n)
+{
+	uchar d[SHA2_512dlen];
+
+	sha2_512(p, n, d, nil);
+}
+
+static void
+hsha256(uchar *p, ulong n)
+{
+	uchar d[SHA2_256dlen];
+
+	hmac_sha2_256(p, n, key, 32, d, nil);
+}
+
+static void
+pbkdf2sha1(uchar *p, ulong n)
+{
+	uchar d[SHA1dlen];
+
+	USED(p);
+	pbkdf2_x(key, 32, iv, 16, (n+63)/64, d, sizeof d, hmac_sha1, SHA1dlen);
+}
+
+static Work work[] = {
+	"aes128gcm-seal",	gcm128seal,	nil,
+	"aes128gcm-open",	gcm128open,	gcm128seal,
+	"aes256gcm-seal",	gcm256seal,	nil,
+	"aes256gcm-open",	gcm256open,	gcm256seal,
+	"aes128cbc-enc",	cbc128enc,	nil,
+	"aes128cbc-dec",	cbc128dec,	nil,
+	"aes256cbc-enc",	cbc256enc,	nil,
+	"chacha20",	chacha20,	nil,
+	"ccpoly-seal",	ccpolyseal,	nil,
+	"ccpoly-open",	ccpolyopen,	ccpolyseal,
+	"poly1305",	poly,	nil,
+	"md5",	dmd5,	nil,
+	"sha1",	dsha1,	nil,
+	"sha256",	dsha256,	nil,
+	"sha512",	dsha512,	nil,
+	"hmac-sha256",	hsha256,	nil,
+	"pbkdf2-sha1",	pbkdf2sha1,	nil,
+};
+
+static void
+run(Work *w, uchar *buf, ulong n, vlong dur)
+{
+	vlong t0, t, nop;
+	int i;
+
+	if(w->seal != nil){
+		memmove(sealed, buf, n);
+		(*w->seal)(sealed, n);
+		memmove(sealtag, tag, sizeof tag);
+	}
+	nop = 0;
+	t0 = now();
+	do{
+		for(i=0; i<Nbatch; i++)
+			(*w->op)(buf, n);
+		nop += Nbatch;
+		t = now()-t0;
+	}while(t < dur);
+	print("%-16s %10lld ops %12.1f ns/op %10.1f MB/s\n", w->name, nop,
+		(double)t/nop, (double)nop*n*1000/t);
+}
+
+static void
+usage(void)
+{
+	fprint(2, "usage: secbench [-d seconds] [-s recordsize] [cipher...]\n");
+	exits("usage");
+}
+
+int
+main(int argc, char **argv)
+{
+	uchar *buf;
+	vlong dur;
+	ulong n;
+	int i, j;
+
+	kerndate = seconds();
+	eve = "secbench";
+
+	osinit();
+	procinit0();
+	printinit();
+	chandevreset();
+	chandevinit();
+
+	if(bind("#c", "/dev", MBEFORE) < 0)
+		panic("bind #c: %r");
+	if(open("/dev/cons", OREAD) != 0)
+		panic("open0: %r");
+	if(open("/dev/cons", OWRITE) != 1)
+		panic("open1: %r");
+	if(open("/dev/cons", OWRITE) != 2)
+		panic("open2: %r");
+
+	/* after the boot, so that usage can print */
+	dur = 1000000000LL;
+	n = 16384;
+	ARGBEGIN{
+	case 'd':
+		dur = atof(EARGF(usage()))*1e9;
+		break;
+	case 's':
+		n = strtoul(EARGF(usage()), nil, 0);
+		if(n == 0 || n > Maxrec)
+			sysfatal("record size must be 1 to %d", Maxrec);
+		break;
+	default:
+		usage();
+	}ARGEND
+
+	for(i=0; i<(int)nelem(key); i++)
+		key[i] = i*7+1;
+	for(i=0; i<(int)nelem(iv); i++)
+		iv[i] = i*3;
+	if((buf = malloc(n)) == nil || (sealed = malloc(n)) == nil)
+		sysfatal("malloc: %r");
+	for(i=0; i<(int)n; i++)
+		buf[i] = i;
+	setupAESstate(&aes128, key, 16, iv);
+	setupAESstate(&aes256, key, 32, iv);
+	setupAESGCMstate(&gcm128, key, 16, iv, 12);
+	setupAESGCMstate(&gcm256, key, 32, iv, 12);
+	setupChachastate(&chacha, key, 32, iv, 12, 20);
+
+	for(i=0; i<(int)nelem(work); i++){
+		if(argc > 0){
+			for(j=0; j<argc; j++)
+				if(strcmp(argv[j], work[i].name) == 0)
+					break;
+			if(j == argc)
+				continue;
+		}
+		run(&work[i], buf, n, dur);
+	}
+	exits(nil);
+	return 0;
+}
@@ -13,8 +13,6 @@
 #define QIDPATH	((((vlong)1)<<48)-1)
 vlong newqid = 0;
 
-void (*fcalls[256])(Fsrpc*);
-
 /* accounting and debugging counters */
 int	filecnt;
 int	freecnt;
@@ -23,6 +21,13 @@ int	qfreecnt;
 int	ncollision;
 int	netfd;
 
+/* work buffers, recycled */
+static Lock	sbuflock;
+static Fsrpc	*sbuflist;
+static Fsrpc	*sbuffree;
+static int	nsbuf;
+static int	sbufwait;	/* the reader waits in getsbuf */
+
 int
 exportfs(int fd)
 {
@@ -35,15 +40,24 @@ exportfs(int fd)
 	fcalls[Tflush] = Xflush;
 	fcalls[Tattach] = Xattach;
 	fcalls[Twalk] = Xwalk;
-	fcalls[Topen] = slave;
+	fcalls[Topen] = slaveopen;
 	fcalls[Tcreate] = Xcreate;
 	fcalls[Tclunk] = Xclunk;
-	fcalls[Tread] = slave;
-	fcalls[Twrite] = slave;
+	fcalls[Tread] = slaveread;
+	fcalls[Twrite] = slavewrite;
 	fcalls[Tremove] = Xremove;
 	fcalls[Tstat] = Xstat;
 	fcalls[Twstat] = Xwstat;
 
+	/*
+	 * these may block on the host file system.  walk and
+	 * stat stay with the reader, as clunk does, so that the
+	 * fids they use are not freed under them.
+	 */
+	slavecall[Topen] = 1;
+	slavecall[Tread] = 1;
+	slavecall[Twrite] = 1;
+
 	srvfd = -1;
 	netfd = fd;
 	//dbg = 1;
@@ -56,11 +70,8 @@ exportfs(int fd)
 
 	messagesize = iounit(netfd);
 	if(messagesize == 0)
-		messagesize = IOUNIT+IOHDRSZ;
+		messagesize = Maxiounit+IOHDRSZ;
 
-	Workq = emallocz(sizeof(Fsrpc)*Nr_workbufs);
-//	for(i=0; i<Nr_workbufs; i++)
-//		Workq[i].buf = emallocz(messagesize);
 	fhash = emallocz(sizeof(Fid*)*FHASHSIZE);
 
 	fmtinstall('F', fcallfmt);
@@ -74,9 +85,6 @@ exportfs(int fd)
 	 */
 	for(;;) {
 		r = getsbuf();
-		if(r == 0)
-			fatal("Out of service buffers");
-			
 		DEBUG(DFD, "read9p...");
 		n = read9pmsg(netfd, r->buf, messagesize);
 		if(n <= 0)
@@ -96,7 +104,12 @@ exportfs(int fd)
 
 if(0) iprint("<- %F\n", &r->work);
 		DEBUG(DFD, "%F\n", &r->work);
-		(fcalls[r->work.type])(r);
+		if(slavecall[r->work.type])
+			slave(r);
+		else{
+			(fcalls[r->work.type])(r);
+			putsbuf(r);
+		}
 	}
 }
 
@@ -129,6 +142,28 @@ if(0) iprint("-> %F\n", t);
 	free(data);
 }
 
+/*
+ * Reply to a read whose n bytes of data were read into
+ * buf after room for the Rread header, saving the copy.
+ */
+void
+replyread(Fcall *r, uchar *buf, int n)
+{
+	int m;
+
+	DEBUG(DFD, "\tRread tag %ud count %d\n", r->tag, n);
+
+	PBIT32(buf, Rreadhdr+n);
+	PBIT8(buf+BIT32SZ, Rread);
+	PBIT16(buf+BIT32SZ+BIT8SZ, r->tag);
+	PBIT32(buf+BIT32SZ+BIT8SZ+BIT16SZ, n);
+	if((m=write(netfd, buf, Rreadhdr+n))!=Rreadhdr+n){
+		iprint("wrote %d got %d (%r)\n", Rreadhdr+n, m);
+		fatal("write");
+	}
+}
+
+/* fslock is held by callers of the fid and File routines */
 Fid *
 getfid(int nr)
 {
@@ -206,38 +241,82 @@ newfid(int nr)
 Fsrpc *
 getsbuf(void)
 {
-	static int ap;
-	int look, rounds;
 	Fsrpc *wb;
-	int small_instead_of_fast = 1;
 
-	if(small_instead_of_fast)
-		ap = 0;	/* so we always start looking at the beginning and reuse buffers */
+	lock(&sbuflock);
+	while(sbuffree == nil && nsbuf >= Nsbuf) {
+		sbufwait = 1;
+		unlock(&sbuflock);
+		while((uintptr)rendezvous(&sbufwait, nil) == ~(uintptr)0)
+			;	/* Interrupted */
+		lock(&sbuflock);
+	}
+	if((wb = sbuffree) != nil)
+		sbuffree = wb->next;
+	else {
+		wb = emallocz(sizeof(Fsrpc));
+		wb->buf = emallocz(messagesize);
+		wb->link = sbuflist;
+		sbuflist = wb;
+		nsbuf++;
+	}
+	wb->next = nil;
+	wb->slave = 0;
+	wb->pid = 0;
+	wb->canint = 0;
+	wb->flushtag = NOTAG;
+	wb->busy = 1;
+	unlock(&sbuflock);
+	return wb;
+}
 
-	for(rounds = 0; rounds < 10; rounds++) {
-		for(look = 0; look < Nr_workbufs; look++) {
-			if(++ap == Nr_workbufs)
-				ap = 0;
-			if(Workq[ap].busy == 0)
-				break;
-		}
+/*
+ * The rpc in wb has been answered; a flush of it
+ * that came meanwhile is answered now.  The reader,
+ * if it is waiting for a buffer, gets this one.
+ */
+void
+putsbuf(Fsrpc *wb)
+{
+	Fcall work, rhdr;
+	int tag, wake;
+
+	lock(&sbuflock);
+	tag = wb->flushtag;
+	wb->busy = 0;
+	wb->next = sbuffree;
+	sbuffree = wb;
+	wake = sbufwait;
+	sbufwait = 0;
+	unlock(&sbuflock);
+	if(wake)
+		rendezvous(&sbufwait, nil);
+
+	if(tag != NOTAG) {
+		work.type = Tflush;
+		work.tag = tag;
+		work.fid = NOFID;
+		reply(&work, &rhdr, 0);
+	}
+}
 
-		if(look == Nr_workbufs){
-			sleep(10 * rounds);
-			continue;
+/* have the slave answering oldtag answer flush tag too */
+int
+flushsbuf(int oldtag, int tag)
+{
+	Fsrpc *w;
+
+	lock(&sbuflock);
+	for(w = sbuflist; w; w = w->link) {
+		if(w->busy && w->slave && w->work.tag == oldtag) {
+			DEBUG(DFD, "\tQ busy %d pid %d can %d\n", w->busy, w->pid, w->canint);
+			w->flushtag = tag;
+			unlock(&sbuflock);
+			return 1;
 		}
-
-		wb = &Workq[ap];
-		wb->pid = 0;
-		wb->canint = 0;
-		wb->flushtag = NOTAG;
-		wb->busy = 1;
-		if(wb->buf == nil)	/* allocate buffers dynamically to keep size down */
-			wb->buf = emallocz(messagesize);
-		return wb;
 	}
-	fatal("No more work buffers");
-	return nil;
+	unlock(&sbuflock);
+	return 0;
 }
 
 void
@@ -271,6 +350,7 @@ Loop:
 		goto Loop;
 }
 
+/* called without fslock, which is let go for the stat */
 File *
 file(File *parent, char *name)
 {
@@ -278,14 +358,17 @@ file(File *parent, char *name)
 	char *path;
 	File *f;
 
+	lock(&fslock);
 	DEBUG(DFD, "\tfile: 0x%p %s name %s\n", parent, parent->name, name);
-
 	path = makepath(parent, name);
+	unlock(&fslock);
+
 	dir = dirstat(path);
 	free(path);
 	if(dir == nil)
 		return nil;
 
+	lock(&fslock);
 	for(f = parent->child; f; f = f->childlist)
 		if(strcmp(name, f->name) == 0)
 			break;
@@ -308,6 +391,7 @@ file(File *parent, char *name)
 	f->qid.path = f->qidt->uniqpath;
 
 	f->inval = 0;
+	unlock(&fslock);
 
 	free(dir);
 
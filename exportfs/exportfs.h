@@ -18,11 +18,14 @@ typedef struct Qidtab Qidtab;
 struct Fsrpc
 {
 	int	busy;		/* Work buffer has pending rpc to service */
+	int	slave;		/* Rpc was handed to the slaves */
 	int	pid;		/* Pid of slave process executing the rpc */
 	int	canint;		/* Interrupt gate */
 	int	flushtag;	/* Tag on which to reply to flush */
 	Fcall work;		/* Plan 9 incoming Fcall */
 	uchar	*buf;	/* Data buffer */
+	Fsrpc	*next;		/* Free list or slave work queue */
+	Fsrpc	*link;		/* All work buffers */
 };
 
 struct Fid
@@ -50,8 +53,7 @@ struct File
 struct Proc
 {
 	int	pid;
-	int	busy;
-	Proc	*next;
+	Proc	*next;		/* Idle slaves */
 };
 
 struct Qidtab
@@ -67,12 +69,14 @@ struct Qidtab
 enum
 {
 	MAXPROC		= 50,
+	Nsbuf		= 2*MAXPROC,	/* work buffers at most; the reader waits for one past that */
 	FHASHSIZE	= 64,
-	Nr_workbufs 	= 50,
 	Fidchunk	= 1000,
 	Npsmpt		= 32,
 	Nqidbits		= 5,
 	Nqidtab		= (1<<Nqidbits),
+	Rreadhdr	= BIT32SZ+BIT8SZ+BIT16SZ+BIT32SZ,	/* size[4] Rread tag[2] count[4] */
+	Maxiounit	= 128*1024,	/* most data per message offered to the mounter */
 };
 
 #define Enomem Exenomem
@@ -93,13 +97,14 @@ extern char Enomem[];
 extern char Emip[];
 extern char Enopsmt[];
 
-Extern Fsrpc	*Workq;
+Extern void	(*fcalls[256])(Fsrpc*);
+Extern int	slavecall[256];	/* Run by the slaves, not the reader */
 Extern int  	dbg;
+Extern Lock	fslock;		/* fids, the File tree, qidtab */
 Extern File	*root;
 Extern File	*psmpt;
 Extern Fid	**fhash;
 Extern Fid	*fidfree;
-Extern Proc	*Proclist;
 Extern char	psmap[Npsmpt];
 Extern Qidtab	*qidtab[Nqidtab];
 Extern ulong	messagesize;
@@ -120,10 +125,13 @@ void Xwstat(Fsrpc*);
 void slave(Fsrpc*);
 
 void	reply(Fcall*, Fcall*, char*);
+void	replyread(Fcall*, uchar*, int);
 Fid 	*getfid(int);
 int	freefid(int);
 Fid	*newfid(int);
 Fsrpc	*getsbuf(void);
+void	putsbuf(Fsrpc*);
+int	flushsbuf(int, int);
 void	initroot(void);
 void	fatal(char*, ...);
 char*	makepath(File*, char*);
@@ -41,7 +41,6 @@ Xversion(Fsrpc *t)
 	rhdr.version = "9P2000";
 	rhdr.msize = t->work.msize;
 	reply(&t->work, &rhdr, 0);
-	t->busy = 0;
 }
 
 void
@@ -50,34 +49,20 @@ Xauth(Fsrpc *t)
 	Fcall rhdr;
 
 	reply(&t->work, &rhdr, "exportfs: authentication not required");
-	t->busy = 0;
 }
 
 void
 Xflush(Fsrpc *t)
 {
-	Fsrpc *w, *e;
 	Fcall rhdr;
 
-	e = &Workq[Nr_workbufs];
-
-	for(w = Workq; w < e; w++) {
-		if(w->work.tag == t->work.oldtag) {
-			DEBUG(DFD, "\tQ busy %d pid %d can %d\n", w->busy, w->pid, w->canint);
-			if(w->busy && w->pid) {
-				w->flushtag = t->work.tag;
-				DEBUG(DFD, "\tset flushtag %d\n", t->work.tag);
-			//	if(w->canint)
-			//		postnote(PNPROC, w->pid, "flush");
-				t->busy = 0;
-				return;
-			}
-		}
+	if(flushsbuf(t->work.oldtag, t->work.tag)) {
+		DEBUG(DFD, "\tset flushtag %d\n", t->work.tag);
+		return;
 	}
 
 	reply(&t->work, &rhdr, 0);
 	DEBUG(DFD, "\tflush reply\n");
-	t->busy = 0;
 }
 
 void
@@ -86,10 +71,11 @@ Xattach(Fsrpc *t)
 	Fcall rhdr;
 	Fid *f;
 
+	lock(&fslock);
 	f = newfid(t->work.fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
 
@@ -98,7 +84,6 @@ Xattach(Fsrpc *t)
 		if(psmpt == 0){
 		Nomount:
 			reply(&t->work, &rhdr, Enopsmt);
-			t->busy = 0;
 			freefid(t->work.fid);
 			return;
 		}
@@ -116,7 +101,6 @@ Xattach(Fsrpc *t)
 		if(amount(nfd, buf, MREPL|MCREATE, t->work.aname) < 0){
 			errstr(buf, sizeof buf);
 			reply(&t->work, &rhdr, buf);
-			t->busy = 0;
 			freefid(t->work.fid);
 			close(nfd);
 			return;
@@ -130,8 +114,8 @@ Xattach(Fsrpc *t)
 	}
 
 	rhdr.qid = f->f->qid;
+	unlock(&fslock);
 	reply(&t->work, &rhdr, 0);
-	t->busy = 0;
 }
 
 Fid*
@@ -165,10 +149,11 @@ Xwalk(Fsrpc *t)
 	File *wf;
 	int i;
 
+	lock(&fslock);
 	f = getfid(t->work.fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
 
@@ -177,6 +162,7 @@ Xwalk(Fsrpc *t)
 		nf = clonefid(f, t->work.newfid);
 		f = nf;
 	}
+	unlock(&fslock);
 
 	rhdr.nwqid = 0;
 	e = nil;
@@ -187,7 +173,9 @@ Xwalk(Fsrpc *t)
 		}
 
 		if(strcmp(t->work.wname[i], "..") == 0) {
+			lock(&fslock);
 			if(f->f->parent == nil) {
+				unlock(&fslock);
 				e = Exmnt;
 				break;
 			}
@@ -202,19 +190,23 @@ Xwalk(Fsrpc *t)
 			e = err;
 			break;
 		}
+		lock(&fslock);
     Accept:
 		freefile(f->f);
 		rhdr.wqid[rhdr.nwqid++] = wf->qid;
 		f->f = wf;
+		unlock(&fslock);
 		continue;
 	}
 
-	if(nf!=nil && (e!=nil || rhdr.nwqid!=t->work.nwname))
+	if(nf!=nil && (e!=nil || rhdr.nwqid!=t->work.nwname)){
+		lock(&fslock);
 		freefid(t->work.newfid);
+		unlock(&fslock);
+	}
 	if(rhdr.nwqid > 0)
 		e = nil;
 	reply(&t->work, &rhdr, e);
-	t->busy = 0;
 }
 
 void
@@ -223,10 +215,11 @@ Xclunk(Fsrpc *t)
 	Fcall rhdr;
 	Fid *f;
 
+	lock(&fslock);
 	f = getfid(t->work.fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
 
@@ -234,8 +227,8 @@ Xclunk(Fsrpc *t)
 		close(f->fid);
 
 	freefid(t->work.fid);
+	unlock(&fslock);
 	reply(&t->work, &rhdr, 0);
-	t->busy = 0;
 }
 
 void
@@ -245,19 +238,27 @@ Xstat(Fsrpc *t)
 	Fcall rhdr;
 	Fid *f;
 	Dir *d;
-	int s;
+	int s, fid;
+	vlong qpath;
 	uchar *statbuf;
 
+	lock(&fslock);
 	f = getfid(t->work.fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
-	if(f->fid >= 0)
-		d = dirfstat(f->fid);
-	else {
+	fid = f->fid;
+	path = nil;
+	if(fid < 0)
 		path = makepath(f->f, "");
+	qpath = f->f->qidt->uniqpath;
+	unlock(&fslock);
+
+	if(fid >= 0)
+		d = dirfstat(fid);
+	else {
 		d = dirstat(path);
 		free(path);
 	}
@@ -265,11 +266,10 @@ Xstat(Fsrpc *t)
 	if(d == nil) {
 		errstr(err, sizeof err);
 		reply(&t->work, &rhdr, err);
-		t->busy = 0;
 		return;
 	}
 
-	d->qid.path = f->f->qidt->uniqpath;
+	d->qid.path = qpath;
 	s = sizeD2M(d);
 	statbuf = emallocz(s);
 	s = convD2M(d, statbuf, s);
@@ -278,7 +278,6 @@ Xstat(Fsrpc *t)
 	rhdr.stat = statbuf;
 	reply(&t->work, &rhdr, 0);
 	free(statbuf);
-	t->busy = 0;
 }
 
 static int
@@ -300,21 +299,21 @@ Xcreate(Fsrpc *t)
 	Fid *f;
 	File *nf;
 
+	lock(&fslock);
 	f = getfid(t->work.fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
-	
-
 	path = makepath(f->f, t->work.name);
+	unlock(&fslock);
+
 	f->fid = create(path, t->work.mode, t->work.perm);
 	free(path);
 	if(f->fid < 0) {
 		errstr(err, sizeof err);
 		reply(&t->work, &rhdr, err);
-		t->busy = 0;
 		return;
 	}
 
@@ -322,17 +321,17 @@ Xcreate(Fsrpc *t)
 	if(nf == 0) {
 		errstr(err, sizeof err);
 		reply(&t->work, &rhdr, err);
-		t->busy = 0;
 		return;
 	}
 
 	f->mode = t->work.mode;
+	lock(&fslock);
 	freefile(f->f);
 	f->f = nf;
 	rhdr.qid = f->f->qid;
+	unlock(&fslock);
 	rhdr.iounit = getiounit(f->fid);
 	reply(&t->work, &rhdr, 0);
-	t->busy = 0;
 }
 
 void
@@ -342,31 +341,33 @@ Xremove(Fsrpc *t)
 	Fcall rhdr;
 	Fid *f;
 
+	lock(&fslock);
 	f = getfid(t->work.fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
-
 	path = makepath(f->f, "");
+	unlock(&fslock);
+
 	DEBUG(DFD, "\tremove: %s\n", path);
 	if(remove(path) < 0) {
 		free(path);
 		errstr(err, sizeof err);
 		reply(&t->work, &rhdr, err);
-		t->busy = 0;
 		return;
 	}
 	free(path);
 
+	lock(&fslock);
 	f->f->inval = 1;
 	if(f->fid >= 0)
 		close(f->fid);
 	freefid(t->work.fid);
+	unlock(&fslock);
 
 	reply(&t->work, &rhdr, 0);
-	t->busy = 0;
 }
 
 void
@@ -379,17 +380,17 @@ Xwstat(Fsrpc *t)
 	char *strings;
 	Dir d;
 
+	lock(&fslock);
 	f = getfid(t->work.fid);
+	unlock(&fslock);
 	if(f == 0) {
 		reply(&t->work, &rhdr, Ebadfid);
-		t->busy = 0;
 		return;
 	}
 	strings = emallocz(t->work.nstat);	/* ample */
 	if(convM2D(t->work.stat, t->work.nstat, &d, strings) <= BIT16SZ){
 		rerrstr(err, sizeof err);
 		reply(&t->work, &rhdr, err);
-		t->busy = 0;
 		free(strings);
 		return;
 	}
@@ -397,7 +398,9 @@ Xwstat(Fsrpc *t)
 	if(f->fid >= 0)
 		s = dirfwstat(f->fid, &d);
 	else {
+		lock(&fslock);
 		path = makepath(f->f, "");
+		unlock(&fslock);
 		s = dirwstat(path, &d);
 		free(path);
 	}
@@ -407,109 +410,90 @@ Xwstat(Fsrpc *t)
 	}
 	else {
 		/* wstat may really be rename */
+		lock(&fslock);
 		if(strcmp(d.name, f->f->name)!=0 && strcmp(d.name, "")!=0){
 			free(f->f->name);
 			f->f->name = estrdup(d.name);
 		}
+		unlock(&fslock);
 		reply(&t->work, &rhdr, 0);
 	}
 	free(strings);
-	t->busy = 0;
 }
 
+/*
+ * The slaves: up to MAXPROC procs taking rpcs from a queue,
+ * or handed one directly when they are idle.  Idle slaves
+ * wait in rendezvous on their pid.
+ */
+static Lock	slavelock;
+static Proc	*idle;
+static Fsrpc	*workq;
+static Fsrpc	**worktail = &workq;
+static int	nslave;
+
 void
 slave(Fsrpc *f)
 {
 	Proc *p;
 	int pid;
-	static int nproc;
-
-	for(;;) {
-		for(p = Proclist; p; p = p->next) {
-			if(p->busy == 0) {
-				f->pid = p->pid;
-				p->busy = 1;
-				pid = (uintptr)rendezvous((void*)(uintptr)p->pid, f);
-				if(pid != p->pid)
-					fatal("rendezvous sync fail");
-				return;
-			}	
-		}
-
-		if(++nproc > MAXPROC)
-			fatal("too many procs");
-
-		pid = kproc("slave", blockingslave, nil);
-		DEBUG(DFD, "slave pid %d\n", pid);
-		if(pid == -1)
-			fatal("kproc");
-
-		p = malloc(sizeof(Proc));
-		if(p == 0)
-			fatal("out of memory");
-
-		p->busy = 0;
-		p->pid = pid;
-		p->next = Proclist;
-		Proclist = p;
 
-DEBUG(DFD, "parent %d rendez\n", pid);
-		rendezvous((void*)(uintptr)pid, p);
-DEBUG(DFD, "parent %d went\n", pid);
+	f->slave = 1;
+	lock(&slavelock);
+	if((p = idle) != nil) {
+		idle = p->next;
+		unlock(&slavelock);
+		pid = (uintptr)rendezvous((void*)(uintptr)p->pid, f);
+		if(pid != p->pid)
+			fatal("rendezvous sync fail");
+		return;
+	}
+	f->next = nil;
+	*worktail = f;
+	worktail = &f->next;
+	if(nslave >= MAXPROC) {
+		unlock(&slavelock);
+		return;
 	}
+	nslave++;
+	unlock(&slavelock);
+
+	pid = kproc("slave", blockingslave, nil);
+	DEBUG(DFD, "slave pid %d\n", pid);
+	if(pid == -1)
+		fatal("kproc");
 }
 
 void
 blockingslave(void *x)
 {
 	Fsrpc *p;
-	Fcall rhdr;
-	Proc *m;
-	int pid;
+	Proc m;
 
 	USED(x);
 
 	notify(flushaction);
 
-	pid = getpid();
-
-DEBUG(DFD, "blockingslave %d rendez\n", pid);
-	m = (Proc*)rendezvous((void*)(uintptr)pid, 0);
-DEBUG(DFD, "blockingslave %d rendez got %p\n", pid, m);
-	
+	m.pid = getpid();
 	for(;;) {
-		p = rendezvous((void*)(uintptr)pid, (void*)(uintptr)pid);
-		if((uintptr)p == ~(uintptr)0)			/* Interrupted */
-			continue;
-
-		DEBUG(DFD, "\tslave: %d %F b %d p %d\n", pid, &p->work, p->busy, p->pid);
-		if(p->flushtag != NOTAG)
-			goto flushme;
-
-		switch(p->work.type) {
-		case Tread:
-			slaveread(p);
-			break;
-
-		case Twrite:
-			slavewrite(p);
-			break;
-
-		case Topen:
-			slaveopen(p);
-			break;
-
-		default:
-			reply(&p->work, &rhdr, "exportfs: slave type error");
-		}
-		if(p->flushtag != NOTAG) {
-flushme:
-			p->work.type = Tflush;
-			p->work.tag = p->flushtag;
-			reply(&p->work, &rhdr, 0);
+		lock(&slavelock);
+		if((p = workq) != nil) {
+			if((workq = p->next) == nil)
+				worktail = &workq;
+			unlock(&slavelock);
+		} else {
+			m.next = idle;
+			idle = &m;
+			unlock(&slavelock);
+			while((uintptr)(p = rendezvous((void*)(uintptr)m.pid, (void*)(uintptr)m.pid)) == ~(uintptr)0)
+				;	/* Interrupted */
 		}
-		p->busy = 0;
-		m->busy = 0;
+		p->pid = m.pid;
+
+		DEBUG(DFD, "\tslave: %d %F b %d p %d\n", m.pid, &p->work, p->busy, p->pid);
+		if(p->flushtag == NOTAG)
+			(fcalls[p->work.type])(p);
+		putsbuf(p);
 	}
 }
 
@@ -531,8 +515,10 @@ slaveopen(Fsrpc *p)
 
 	work = &p->work;
 
+	lock(&fslock);
 	f = getfid(work->fid);
 	if(f == 0) {
+		unlock(&fslock);
 		reply(work, &rhdr, Ebadfid);
 		return;
 	}
@@ -540,8 +526,9 @@ slaveopen(Fsrpc *p)
 		close(f->fid);
 		f->fid = -1;
 	}
-	
 	path = makepath(f->f, "");
+	unlock(&fslock);
+
 	DEBUG(DFD, "\topen: %s %d\n", path, work->mode);
 
 	p->canint = 1;
@@ -559,7 +546,9 @@ slaveopen(Fsrpc *p)
 		reply(work, &rhdr, err);
 		return;
 	}
+	lock(&fslock);
 	f->f->qid = d->qid;
+	unlock(&fslock);
 	free(d);
 	if(f->f->qid.type & QTMOUNT){	/* fork new exportfs for this */
 		f->fid = openmount(f->fid);
@@ -578,13 +567,16 @@ void
 slaveread(Fsrpc *p)
 {
 	Fid *f;
-	int n, r;
+	int n, r, fid;
 	Fcall *work, rhdr;
-	char *data, err[ERRMAX];
+	char err[ERRMAX];
 
 	work = &p->work;
 
+	lock(&fslock);
 	f = getfid(work->fid);
+	fid = f ? f->fid : -1;
+	unlock(&fslock);
 	if(f == 0) {
 		reply(work, &rhdr, Ebadfid);
 		return;
@@ -594,26 +586,20 @@ slaveread(Fsrpc *p)
 	p->canint = 1;
 	if(p->flushtag != NOTAG)
 		return;
-	data = malloc(n);
-	if(data == nil)
-		fatal(Enomem);
 
+	/* the Tread is done with p->buf: read in behind the Rread header */
 	/* can't just call pread, since directories must update the offset */
-	r = pread(f->fid, data, n, work->offset);
+	r = pread(fid, p->buf+Rreadhdr, n, work->offset);
 	p->canint = 0;
 	if(r < 0) {
-		free(data);
 		errstr(err, sizeof err);
 		reply(work, &rhdr, err);
 		return;
 	}
 
-	DEBUG(DFD, "\tread: fd=%d %d bytes\n", f->fid, r);
+	DEBUG(DFD, "\tread: fd=%d %d bytes\n", fid, r);
 
-	rhdr.data = data;
-	rhdr.count = r;
-	reply(work, &rhdr, 0);
-	free(data);
+	replyread(work, p->buf, r);
 }
 
 void
@@ -622,11 +608,14 @@ slavewrite(Fsrpc *p)
 	char err[ERRMAX];
 	Fcall *work, rhdr;
 	Fid *f;
-	int n;
+	int n, fid;
 
 	work = &p->work;
 
+	lock(&fslock);
 	f = getfid(work->fid);
+	fid = f ? f->fid : -1;
+	unlock(&fslock);
 	if(f == 0) {
 		reply(work, &rhdr, Ebadfid);
 		return;
@@ -636,7 +625,7 @@ slavewrite(Fsrpc *p)
 	p->canint = 1;
 	if(p->flushtag != NOTAG)
 		return;
-	n = pwrite(f->fid, work->data, n, work->offset);
+	n = pwrite(fid, work->data, n, work->offset);
 	p->canint = 0;
 	if(n < 0) {
 		errstr(err, sizeof err);
@@ -644,7 +633,7 @@ slavewrite(Fsrpc *p)
 		return;
 	}
 
-	DEBUG(DFD, "\twrite: %d bytes fd=%d\n", n, f->fid);
+	DEBUG(DFD, "\twrite: %d bytes fd=%d\n", n, fid);
 
 	rhdr.count = n;
 	reply(work, &rhdr, 0);
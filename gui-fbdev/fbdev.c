@@ -35,13 +35,19 @@
 
 Memimage *gscreen;
 
-static Rectangle	update_rect;
+enum {
+	Nupdate = 8,
+};
+
+static Rectangle	update_rects[Nupdate];
+static int	nupdate;
 static Rectangle	screenr;
 static struct termios	tcmode;
 static int	startmode;
 static int	altdown;
 static uchar	*fbp;
-static Memimage	*screenimage;
+static int	fbfd = -1;
+static int	vsync = 1;	/* FBIO_WAITFORVSYNC works */
 static Memimage	*backbuf;
 static int	linelength;
 static Point	mousexy;
@@ -61,13 +67,106 @@ static void consfinal(void);
 static void consfinalsig(int sig);
 static int needflush(void *);
 static void ignore0(void *);
+static void fbflushrects(Rectangle*, int);
 static void unblank(void *);
 
+/*
+ * Software cursor.  The sprite is rendered in the frame buffer's
+ * format when the cursor changes, and the pixels under it are
+ * saved when it is drawn and put back before anything is drawn
+ * over it, so moving it touches only the squares it leaves and
+ * enters.
+ */
+typedef struct Sprite Sprite;
+struct Sprite
+{
+	uchar	pix[16*16*4];
+	uchar	set[16*16];
+	Point	offset;
+};
+
+static Sprite	sprite;
+static _Atomic int	cursorchanged = 1;
+static _Atomic int	cursormoved;
+static uchar	under[16*16*4];
+static Rectangle	underr;	/* on screen */
+static int	cursorshown;
+
 static int
 needflush(void *v)
 {
 	USED(v);
-	return atomic_load(&dirty);
+	return atomic_load(&dirty) || atomic_load(&cursormoved) || atomic_load(&cursorchanged);
+}
+
+static uchar*
+fbaddr(Point p)
+{
+	return fbp + p.y*linelength + p.x*depth;
+}
+
+static void
+mksprite(void)
+{
+	int x, y, i, b, clr, set;
+	uint16_t v16;
+	uint32_t v;
+
+	lock(&cursor.lk);
+	for(y = 0; y < 16; y++){
+		for(x = 0; x < 16; x++){
+			b = 128 >> (x%8);
+			clr = cursor.clr[y*2 + x/8] & b;
+			set = cursor.set[y*2 + x/8] & b;
+			v = set ? 0xFF000000 : 0xFFFFFFFF;
+			i = y*16 + x;
+			sprite.set[i] = clr || set;
+			if(depth == 2){
+				v16 = v;
+				memcpy(sprite.pix + i*depth, &v16, depth);
+			}else
+				memcpy(sprite.pix + i*depth, &v, depth);
+		}
+	}
+	sprite.offset = cursor.offset;
+	unlock(&cursor.lk);
+}
+
+static void
+hidecursor(void)
+{
+	int y, n;
+
+	if(!cursorshown)
+		return;
+	n = Dx(underr)*depth;
+	for(y = underr.min.y; y < underr.max.y; y++)
+		memcpy(fbaddr(Pt(underr.min.x, y)), under + (y-underr.min.y)*16*depth, n);
+	cursorshown = 0;
+}
+
+static void
+showcursor(Point p)
+{
+	Rectangle r;
+	Point o;
+	int x, y, i, n;
+
+	o = addpt(p, sprite.offset);
+	r = Rpt(o, addpt(o, Pt(16, 16)));
+	if(rectclip(&r, screenr) == 0)
+		return;
+	n = Dx(r)*depth;
+	for(y = r.min.y; y < r.max.y; y++){
+		memcpy(under + (y-r.min.y)*16*depth, fbaddr(Pt(r.min.x, y)), n);
+		for(x = r.min.x; x < r.max.x; x++){
+			i = (y-o.y)*16 + (x-o.x);
+			if(sprite.set[i])
+				memcpy(fbaddr(Pt(x, y)), sprite.pix + i*depth, depth);
+		}
+	}
+	underr = r;
+	cursorshown = 1;
 }
 
 static void
@@ -135,7 +234,7 @@ fbattach(int fbdevidx)
 
 	screenr = r;
 
-	screenimage = allocmemimage(r, chan);
+	fbfd = fd;
 	backbuf = allocmemimage(r, chan);
 	return backbuf;
 
@@ -212,33 +311,52 @@ eventdetach(struct pollfd pfd[], int npfd)
 		close(pfd[n].fd);
 }
 
-void
-flushmemscreen(Rectangle r)
+static void
+addupdate(Rectangle r)
 {
-	if (rectclip(&r, screenimage->r) == 0)
+	if (rectclip(&r, screenr) == 0)
 		return;
 	if (Dx(r) == 0 || Dy(r) == 0)
 		return;
+	if (nupdate == Nupdate)
+		combinerect(&update_rects[Nupdate-1], r);
+	else
+		update_rects[nupdate++] = r;
+}
+
+void
+flushmemscreen(Rectangle r)
+{
+	fbflushrects(&r, 1);
+}
+
+static void
+fbflushrects(Rectangle *r, int n)
+{
+	int i;
 
 	assert(!canqlock(&drawlock));
 
-	if (Dx(update_rect) == 0 || Dy(update_rect) == 0)
-		update_rect = r;
-	else
-		combinerect(&update_rect, r);
+	for (i = 0; i < n; i++)
+		addupdate(r[i]);
+	if (nupdate == 0)
+		return;
 	atomic_store(&dirty, 1);
 	wakeup(&rendezflush);
 }
 
+/*
+ * Copy the damage from backbuf to the frame buffer.  Only taking
+ * the damage needs drawlock; a draw racing the copy damages
+ * its rectangle again and is copied next time.
+ */
 static void
 fbflush(void *v)
 {
 	USED(v);
-	Rectangle r;
-	int x, y, i;
+	Rectangle r[Nupdate];
+	int i, n, hide, zero;
 	Point p;
-	long fbloc;
-	int x2, y2;
 	ulong del;
 	ulong ms;
 
@@ -249,59 +367,39 @@ fbflush(void *v)
 		qlock(&flushlock);
 
 		ms = ticks();
+		zero = 0;
+		if(vsync && ioctl(fbfd, FBIO_WAITFORVSYNC, &zero) < 0)
+			vsync = 0;
 
 		qlock(&drawlock);
-		r = update_rect;
-		update_rect = Rect(0,0,0,0);
-		memimagedraw(screenimage, r, backbuf, r.min, nil, r.min, S);
+		n = nupdate;
+		memmove(r, update_rects, n*sizeof r[0]);
+		nupdate = 0;
 		atomic_store(&dirty, 0);
 		qunlock(&drawlock);
 
-		p = mousexy;
-
-		// draw cursor
-		for (x = 0; x < 16; x++) {
-			x2 = x + cursor.offset.x;
-			if ((p.x + x2) < 0)
-				continue;
-			if ((p.x + x2) >= screenimage->r.max.x)
-				break;
-			for (y = 0; y < 16; y++) {
-				y2 = y + cursor.offset.y;
-				if ((p.y + y2) < 0)
-					continue;
-				if ((p.y + y2) >= screenimage->r.max.y)
-					break;
-				i = y * 2 + x / 8;
-				fbloc = ((p.y+y2) * screenimage->r.max.x + (p.x+x2)) * depth;
-				if (cursor.clr[i] & (128 >> (x % 8))) {
-					switch (depth) {
-					case 2:
-						*((uint16_t*)(screenimage->data->bdata + fbloc)) = 0xFFFF;
-						break;
-					case 4:
-						*((uint32_t*)(screenimage->data->bdata + fbloc)) = 0xFFFFFFFF;
-						break;
-					}
-				}
-				if (cursor.set[i] & (128 >> (x % 8))) {
-					switch (depth) {
-					case 2:
-						*((uint16_t*)(screenimage->data->bdata + fbloc)) = 0x0000;
-						break;
-					case 4:
-						*((uint32_t*)(screenimage->data->bdata + fbloc)) = 0xFF000000;
-						break;
-					}
-				}
-			}
+		hide = atomic_exchange(&cursormoved, 0);
+		if(atomic_exchange(&cursorchanged, 0)){
+			mksprite();
+			hide = 1;
 		}
-		_fbput(screenimage, r);
+		for (i = 0; i < n && !hide; i++)
+			if (cursorshown && rectXrect(r[i], underr))
+				hide = 1;
+		if(hide)
+			hidecursor();
+		for (i = 0; i < n; i++)
+			_fbput(backbuf, r[i]);
+		p = mousexy;
+		if(!cursorshown)
+			showcursor(p);
 		qunlock(&flushlock);
 
-		ms = ms + del - ticks();
-		if(ms > 0 && ms < del)
-			osmsleep(ms);
+		if(!vsync){
+			ms = ms + del - ticks();
+			if(ms > 0 && ms < del)
+				osmsleep(ms);
+		}
 	}
 }
 
@@ -469,6 +567,7 @@ void
 screeninit(void)
 {
 	memimageinit();
+	flushmemscreenrects = fbflushrects;
 
 	if(fbattach(0) == nil) {
 		panic("cannot open framebuffer: %r");
@@ -553,7 +652,6 @@ ttyswitch(int sig)
 int
 onevent(struct input_event *data)
 {
-	Rectangle old, new;
 	ulong msec;
 	static int buttons;
 	static Point coord;
@@ -565,9 +663,6 @@ onevent(struct input_event *data)
 
 	msec = ticks();
 
-	old.min = mousexy;
-	old.max = addpt(old.min, Pt(16, 16));
-
 	buttons &= ~0x18;
 
 	switch(data->type) {
@@ -708,24 +803,17 @@ onevent(struct input_event *data)
 		return -1;
 	}
 
-	if (mousexy.x < screenimage->r.min.x)
-		mousexy.x = screenimage->r.min.x;
-	if (mousexy.y < screenimage->r.min.y)
-		mousexy.y = screenimage->r.min.y;
-	if (mousexy.x > screenimage->r.max.x)
-		mousexy.x = screenimage->r.max.x;
-	if (mousexy.y > screenimage->r.max.y)
-		mousexy.y = screenimage->r.max.y;
-	
-	new.min = mousexy;
-	new.max = addpt(new.min, Pt(16, 16)); // size of cursor bitmap
-
-	combinerect(&new, old);
-	new.min = subpt(new.min, Pt(16, 16)); // to encompass any cursor->offset
+	if (mousexy.x < screenr.min.x)
+		mousexy.x = screenr.min.x;
+	if (mousexy.y < screenr.min.y)
+		mousexy.y = screenr.min.y;
+	if (mousexy.x > screenr.max.x)
+		mousexy.x = screenr.max.x;
+	if (mousexy.y > screenr.max.y)
+		mousexy.y = screenr.max.y;
 
-	qlock(&drawlock);
-	flushmemscreen(new);
-	qunlock(&drawlock);
+	atomic_store(&cursormoved, 1);
+	wakeup(&rendezflush);
 
 	absmousetrack(mousexy.x, mousexy.y, buttons, msec);
 
@@ -735,18 +823,16 @@ onevent(struct input_event *data)
 void
 mouseset(Point p)
 {
-	qlock(&drawlock);
 	mousexy = p;
-	flushmemscreen(screenr);
-	qunlock(&drawlock);
+	atomic_store(&cursormoved, 1);
+	wakeup(&rendezflush);
 }
 
 void
 setcursor(void)
 {
-	qlock(&drawlock);
-	flushmemscreen(screenr);
-	qunlock(&drawlock);
+	atomic_store(&cursorchanged, 1);
+	wakeup(&rendezflush);
 }
 
 void
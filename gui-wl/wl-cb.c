@@ -90,9 +90,10 @@ wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
 
 	wl = data;
 	wl_callback_destroy(cb);
-	cb = wl_surface_frame(wl->surface);
-	wl_callback_add_listener(cb, &wl_surface_frame_listener, wl);
+	qlock(&drawlock);
+	wl->framepending = 0;
 	wlflush(wl);
+	qunlock(&drawlock);
 }
 
 static void
@@ -361,6 +362,20 @@ static const struct wl_callback_listener wl_surface_frame_listener = {
 	.done = wl_surface_frame_done,
 };
 
+/*
+ * Ask to be told when the compositor wants the next frame;
+ * wlflush holds damage until then.
+ */
+void
+wlframe(Wlwin *wl)
+{
+	struct wl_callback *cb;
+
+	cb = wl_surface_frame(wl->surface);
+	wl_callback_add_listener(cb, &wl_surface_frame_listener, wl);
+	wl->framepending = 1;
+}
+
 static struct wl_keyboard_listener keyboard_listener = {
 	.keymap = keyboard_keymap,
 	.enter = keyboard_enter,
@@ -763,7 +778,6 @@ wlsetcb(Wlwin *wl)
 {
 	struct wl_registry *registry;
 	struct xdg_surface *xdg_surface;
-	struct wl_callback *cb;
 	struct zxdg_toplevel_decoration_v1 *deco;
 
 	//Wayland doesn't do keyboard repeat, but also may
@@ -804,9 +818,6 @@ wlsetcb(Wlwin *wl)
 
 	xdg_toplevel_set_app_id(wl->xdg_toplevel, "drawterm");
 
-	cb = wl_surface_frame(wl->surface);
-	wl_callback_add_listener(cb, &wl_surface_frame_listener, wl);
-
 	if(wl->data_device_manager != nil && wl->seat != nil){
 		wl->data_device = wl_data_device_manager_get_data_device(wl->data_device_manager, wl->seat);
 		wl_data_device_add_listener(wl->data_device, &data_device_listener, wl);
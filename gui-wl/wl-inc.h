@@ -1,4 +1,5 @@
 typedef struct Wlwin Wlwin;
+typedef struct Wlbuf Wlbuf;
 typedef struct Clipboard Clipboard;
 typedef struct Csd Csd;
 
@@ -42,6 +43,25 @@ enum{
 	Aenter2,
 };
 
+enum {
+	Ndamage = 8,
+	Nbuf = 2,
+};
+
+/*
+ * A screen buffer in the shm pool.  The compositor reads it
+ * from commit until release, so we draw into another meanwhile,
+ * and each remembers what it missed.
+ */
+struct Wlbuf {
+	Wlwin *wl;
+	struct wl_buffer *buffer;
+	uchar *data;
+	int busy;
+	Rectangle damage[Ndamage];	/* of gscreen, not yet copied here */
+	int ndamage;
+};
+
 enum CsdSizes {
 	csd_bar_height = 24,
 	csd_button_width = 16,
@@ -61,8 +81,9 @@ struct Wlwin {
 	int mony;
 	Mouse mouse;
 	Clipboard clip;
-	Rectangle r;
-	int dirty;
+	Rectangle damage[Ndamage];	/* for the next commit */
+	int ndamage;
+	int framepending;	/* committed, frame callback not yet done */
 	int alt; /* Kalt state */
 	int maximized;
 
@@ -78,7 +99,7 @@ struct Wlwin {
 	struct xdg_wm_base *xdg_wm_base;
 	struct xdg_toplevel *xdg_toplevel;
 	struct wl_shm_pool *pool;
-	struct wl_buffer *screenbuffer;
+	Wlbuf buf[Nbuf];
 	struct wl_buffer *cursorbuffer;
 	struct wl_shm *shm;
 	struct wl_seat *seat;
@@ -109,7 +130,9 @@ void wlsetsnarf(Wlwin*, char*);
 void wlsetmouse(Wlwin*, Point);
 void wldrawcursor(Wlwin*, Cursorinfo*);
 void wlresize(Wlwin*, int, int);
+void wldamage(Wlwin*, Rectangle);
 void wlflush(Wlwin*);
+void wlframe(Wlwin*);
 void wlclose(Wlwin*);
 void wltogglemaximize(Wlwin*);
 void wlminimize(Wlwin*);
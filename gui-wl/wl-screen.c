@@ -26,6 +26,7 @@
 #undef close
 
 static Wlwin *gwin;
+static void wlflushmemscreenrects(Rectangle*, int);
 
 Memimage *gscreen;
 
@@ -101,41 +102,109 @@ wlupdatecsdrects(Wlwin *wl)
 }
 
 static void
-wlfillrect(Wlwin *wl, Rectangle rect, uint32_t color)
+wlfillrect(Wlwin *wl, uchar *buf, Rectangle rect, uint32_t color)
 {
 	Point p;
-	uint32_t *data = wl->shm_data;
+	uint32_t *data = (uint32_t*)buf;
 
 	for(p.y = rect.min.y; p.y < rect.max.y; p.y++)
 		for(p.x = rect.min.x; p.x < rect.max.x; p.x++)
 			data[p.y * wl->dx + p.x] = color;
 }
 
+/*
+ * The decorations are outside gscreen, so they are
+ * drawn into every buffer rather than copied.
+ */
 static void
 wldrawcsd(Wlwin *wl)
 {
+	uchar *data;
+	int i;
+
 	if(!wl->client_side_deco)
 		return;
-	wlfillrect(wl, wl->csd_rects.bar, 0xAAAAAA);
-	wlfillrect(wl, wl->csd_rects.button_close, DRed >> 8);
-	wlfillrect(wl, wl->csd_rects.button_maximize, DGreen >> 8);
-	wlfillrect(wl, wl->csd_rects.button_minimize, DYellow >> 8);
+	for(i = 0; i < Nbuf; i++){
+		data = wl->buf[i].data;
+		wlfillrect(wl, data, wl->csd_rects.bar, 0xAAAAAA);
+		wlfillrect(wl, data, wl->csd_rects.button_close, DRed >> 8);
+		wlfillrect(wl, data, wl->csd_rects.button_maximize, DGreen >> 8);
+		wlfillrect(wl, data, wl->csd_rects.button_minimize, DYellow >> 8);
+	}
+	wldamage(wl, wl->csd_rects.bar);
+}
+
+static void
+adddamage(Rectangle *d, int *nd, Rectangle r)
+{
+	if(*nd == Ndamage){
+		combinerect(&d[Ndamage-1], r);
+		return;
+	}
+	d[(*nd)++] = r;
+}
+
+/*
+ * Note r for the next commit and, where it is in
+ * gscreen, for each buffer to copy before its next use.
+ */
+void
+wldamage(Wlwin *wl, Rectangle r)
+{
+	Rectangle g;
+	int i;
+
+	adddamage(wl->damage, &wl->ndamage, r);
+	g = r;
+	if(gscreen == nil || !rectclip(&g, gscreen->r))
+		return;
+	for(i = 0; i < Nbuf; i++)
+		adddamage(wl->buf[i].damage, &wl->buf[i].ndamage, g);
 }
 
+/*
+ * Commit the damage in a free buffer, unless the compositor
+ * has yet to ask for the next frame or holds every buffer;
+ * wl_surface_frame_done and wlbufrelease try again.
+ * Called with drawlock held.
+ */
 void
 wlflush(Wlwin *wl)
 {
+	Rectangle r;
 	Point p;
+	Wlbuf *b;
+	int i;
 
-	wl_surface_attach(wl->surface, wl->screenbuffer, 0, 0);
-	if(wl->dirty){
-		p.x = wl->r.min.x;
-		for(p.y = wl->r.min.y; p.y < wl->r.max.y; p.y++)
-			memcpy(wl->shm_data+(p.y*wl->dx+p.x)*4, byteaddr(gscreen, p), Dx(wl->r)*4);
-		wl_surface_damage(wl->surface, p.x, wl->r.min.y, Dx(wl->r), Dy(wl->r));
-		wl->dirty = 0;
+	if(wl->framepending || wl->ndamage == 0)
+		return;
+	b = nil;
+	for(i = 0; i < Nbuf; i++)
+		if(!wl->buf[i].busy){
+			b = &wl->buf[i];
+			break;
+		}
+	if(b == nil)
+		return;
+
+	for(i = 0; i < b->ndamage; i++){
+		r = b->damage[i];
+		p.x = r.min.x;
+		for(p.y = r.min.y; p.y < r.max.y; p.y++)
+			memcpy(b->data+(p.y*wl->dx+p.x)*4, byteaddr(gscreen, p), Dx(r)*4);
+	}
+	b->ndamage = 0;
+
+	wl_surface_attach(wl->surface, b->buffer, 0, 0);
+	for(i = 0; i < wl->ndamage; i++){
+		r = wl->damage[i];
+		wl_surface_damage(wl->surface, r.min.x, r.min.y, Dx(r), Dy(r));
 	}
+	wl->ndamage = 0;
+	wlframe(wl);
 	wl_surface_commit(wl->surface);
+	b->busy = 1;
+	wl_display_flush(wl->display);
 }
 
 void  _screenresize(Rectangle);
@@ -159,10 +228,10 @@ wlresize(Wlwin *wl, int x, int y)
 	screenresize(r);
 
 	qlock(&drawlock);
-	wl->dirty = 1;
-	wl->r = r;
-	wlflush(wl);
+	wl->ndamage = 0;
+	wldamage(wl, Rect(0, 0, wl->dx, wl->dy));
 	wldrawcsd(wl);
+	wlflush(wl);
 	qunlock(&drawlock);
 }
 
@@ -190,7 +259,6 @@ wlattach(char *label)
 	memimageinit();
 	wlsetcb(wl);
 	wlupdatecsdrects(wl);
-	wlflush(wl);
 	wlsettitle(wl, label);
 
 	r = Rect(0, wl->csd_rects.bar.max.y, wl->dx, wl->dy);
@@ -203,8 +271,8 @@ wlattach(char *label)
 	kproc("wldispatch", dispatchproc, wl);
 	qlock(&drawlock);
 	terminit();
-	wlflush(wl);
 	wldrawcsd(wl);
+	wlflush(wl);
 	qunlock(&drawlock);
 	return wl;
 }
@@ -212,6 +280,7 @@ wlattach(char *label)
 void
 screeninit(void)
 {
+	flushmemscreenrects = wlflushmemscreenrects;
 	wlattach("drawterm");
 }
 
@@ -237,8 +306,17 @@ attachscreen(Rectangle *r, ulong *chan, int *depth, int *width, int *softscreen)
 void
 flushmemscreen(Rectangle r)
 {
-	gwin->dirty = 1;
-	gwin->r = r;
+	wldamage(gwin, r);
+	wlflush(gwin);
+}
+
+static void
+wlflushmemscreenrects(Rectangle *r, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		wldamage(gwin, r[i]);
 	wlflush(gwin);
 }
 
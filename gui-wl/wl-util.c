@@ -47,6 +47,9 @@ wlcreateshm(off_t size)
 	return fd;
 }
 
+/*
+ * The pool holds the cursor, then Nbuf screen buffers.
+ */
 void
 wlallocpool(Wlwin *wl)
 {
@@ -54,47 +57,80 @@ wlallocpool(Wlwin *wl)
 	int depth;
 	int fd;
 
-	if(wl->pool != nil)
+	if(wl->pool != nil){
 		wl_shm_pool_destroy(wl->pool);
+		munmap(wl->shm_data, wl->poolsize);
+	}
 
 	depth = 4;
-	screensize = wl->monx * wl->mony * depth;
+	screensize = wl->monx * wl->mony;
+	if(screensize < wl->dx * wl->dy)
+		screensize = wl->dx * wl->dy;
+	screensize *= depth;
 	cursorsize = 16 * 16 * depth;
 
-	fd = wlcreateshm(screensize+cursorsize);
+	fd = wlcreateshm(Nbuf*screensize+cursorsize);
 	if(fd < 0)
 		panic("could not mk_shm_fd");
-	ftruncate(fd, screensize+cursorsize);
+	ftruncate(fd, Nbuf*screensize+cursorsize);
 
-	wl->shm_data = mmap(nil, screensize+cursorsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	wl->shm_data = mmap(nil, Nbuf*screensize+cursorsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	if(wl->shm_data == MAP_FAILED)
 		panic("could not mmap shm_data");
 
-	wl->pool = wl_shm_create_pool(wl->shm, fd, screensize+cursorsize);
-	wl->poolsize = screensize+cursorsize;
+	wl->pool = wl_shm_create_pool(wl->shm, fd, Nbuf*screensize+cursorsize);
+	wl->poolsize = Nbuf*screensize+cursorsize;
 	close(fd);
 }
 
+static void
+wlbufrelease(void *data, struct wl_buffer *buffer)
+{
+	Wlbuf *b;
+
+	USED(buffer);
+	b = data;
+	qlock(&drawlock);
+	b->busy = 0;
+	wlflush(b->wl);
+	qunlock(&drawlock);
+}
+
+static const struct wl_buffer_listener wlbuflistener = {
+	.release = wlbufrelease,
+};
+
 void
 wlallocbuffer(Wlwin *wl)
 {
-	int depth;
+	int depth, cursorsize;
 	int size;
+	int i;
+	Wlbuf *b;
 
 	depth = 4;
 	size = wl->dx * wl->dy * depth;
-	if(wl->pool == nil || size+(16*16*depth) > wl->poolsize)
+	cursorsize = 16 * 16 * depth;
+	if(wl->pool == nil || Nbuf*size+cursorsize > wl->poolsize)
 		wlallocpool(wl);
 
-	assert(size+(16*16*depth) <= wl->poolsize);
+	assert(Nbuf*size+cursorsize <= wl->poolsize);
 
-	if(wl->screenbuffer != nil)
-		wl_buffer_destroy(wl->screenbuffer);
 	if(wl->cursorbuffer != nil)
 		wl_buffer_destroy(wl->cursorbuffer);
-
-	wl->screenbuffer = wl_shm_pool_create_buffer(wl->pool, 0, wl->dx, wl->dy, wl->dx*4, WL_SHM_FORMAT_XRGB8888);
-	wl->cursorbuffer = wl_shm_pool_create_buffer(wl->pool, size, 16, 16, 16*4, WL_SHM_FORMAT_ARGB8888);
+	wl->cursorbuffer = wl_shm_pool_create_buffer(wl->pool, 0, 16, 16, 16*4, WL_SHM_FORMAT_ARGB8888);
+
+	for(i=0; i<Nbuf; i++){
+		b = &wl->buf[i];
+		if(b->buffer != nil)
+			wl_buffer_destroy(b->buffer);
+		b->wl = wl;
+		b->data = (uchar*)wl->shm_data + cursorsize + i*size;
+		b->buffer = wl_shm_pool_create_buffer(wl->pool, cursorsize + i*size, wl->dx, wl->dy, wl->dx*4, WL_SHM_FORMAT_XRGB8888);
+		wl_buffer_add_listener(b->buffer, &wlbuflistener, b);
+		b->busy = 0;
+		b->ndamage = 0;
+	}
 }
 
 enum {
@@ -112,7 +148,7 @@ wldrawcursor(Wlwin *wl, Cursorinfo *c)
 	u32int *buf;
 	uint16_t clr[16], set[16];
 
-	buf = wl->shm_data+(wl->dx*wl->dy*4);
+	buf = wl->shm_data;
 	for(i=0,j=0; i < 16; i++,j+=2){
 		clr[i] = c->clr[j]<<8 | c->clr[j+1];
 		set[i] = c->set[j]<<8 | c->set[j+1];
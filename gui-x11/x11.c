@@ -28,6 +28,9 @@ typedef struct Cursor Cursor;
 #include <X11/StringDefs.h>
 #include <X11/keysym.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include "keysym2ucs.h"
 
 #undef	Font
@@ -50,6 +53,33 @@ static	Drawable	xscreenid;
 static	XImage*		xscreenimage;
 static	Visual		*xvis;
 
+/*
+ * MIT-SHM.  When the server can attach our memory, gscreen lives
+ * in a shared segment and flushmemscreen puts it straight to the
+ * window.  The server reads the segment after XShmPutImage returns,
+ * so at most Nshmput puts are left outstanding, counted down by
+ * their completion events.
+ */
+enum {
+	Nshmput = 2,
+};
+
+typedef struct Xshmseg Xshmseg;
+struct Xshmseg
+{
+	XShmSegmentInfo	si;
+	Memdata*	md;
+	Xshmseg*	next;
+};
+
+static	int		xshm;		/* using MIT-SHM */
+static	int		xshmevent;	/* ShmCompletion event type */
+static	int		xshmbusy;	/* puts not yet completed */
+static	int		xshmerr;
+static	XShmSegmentInfo	xshminfo;	/* gscreen's segment */
+static	Memdata*	xshmdata;
+static	Xshmseg*	xshmold;	/* previous gscreens', until devdraw lets go */
+
 extern char		*geometry;	/* defined in main.c */
 
 #include "../glenda-t.xbm"
@@ -165,15 +195,190 @@ panicshutup(XDisplay *d)
 }
 
 
-void
-flushmemscreen(Rectangle r)
+static int
+xshmerror(XDisplay *d, XErrorEvent *e)
+{
+	USED(d);
+	USED(e);
+	xshmerr = 1;
+	return 0;
+}
+
+static Bool
+isxshmdone(XDisplay *d, XEvent *e, XPointer a)
+{
+	USED(d);
+	USED(a);
+	return e->type == xshmevent;
+}
+
+/*
+ * Wait until no more than n puts are outstanding.
+ */
+static void
+xshmwait(int n)
+{
+	XEvent e;
+
+	while(xshmbusy > 0 && XCheckIfEvent(xdisplay, &e, isxshmdone, nil))
+		xshmbusy--;
+	while(xshmbusy > n){
+		XIfEvent(xdisplay, &e, isxshmdone, nil);
+		xshmbusy--;
+	}
+}
+
+static void
+xshminit(void)
+{
+	if(!XShmQueryExtension(xdisplay))
+		return;
+	/* the server reads our bytes as they are */
+	if(ImageByteOrder(xdisplay) != LSBFirst || chantodepth(xscreenchan) < 8)
+		return;
+	if(xtblbit && xscreenchan == CMAP8)
+		return;
+	xshmevent = XShmGetEventBase(xdisplay) + ShmCompletion;
+	xshm = 1;
+}
+
+static void
+xshmdetach(XShmSegmentInfo *si, Memdata **md)
+{
+	if(si->shmaddr == nil)
+		return;
+	xshmwait(0);
+	XShmDetach(xdisplay, si);
+	XSync(xdisplay, False);
+	shmdt(si->shmaddr);
+	free(*md);
+	*md = nil;
+	memset(si, 0, sizeof *si);
+}
+
+/*
+ * A gscreen replaced by screensize is freed, but attachscreen
+ * gave devdraw a reference to its data, and images drawn from
+ * the screen may hold it still.  The segment is kept until the
+ * last of those is gone.
+ */
+static void
+xshmretire(XShmSegmentInfo *si, Memdata **md)
+{
+	Xshmseg *s;
+
+	if(si->shmaddr == nil)
+		return;
+	if((s = malloc(sizeof *s)) == nil)
+		panic("out of memory");
+	s->si = *si;
+	s->md = *md;
+	s->next = xshmold;
+	xshmold = s;
+	memset(si, 0, sizeof *si);
+	*md = nil;
+}
+
+static void
+xshmreap(void)
+{
+	Xshmseg *s, **l;
+
+	for(l = &xshmold; (s = *l) != nil;){
+		if(s->md->ref > 0){
+			l = &s->next;
+			continue;
+		}
+		*l = s->next;
+		xshmdetach(&s->si, &s->md);
+		free(s);
+	}
+}
+
+/*
+ * Like xallocmemimage, but in a segment the server has attached.
+ * Fails if the server cannot attach it (it is remote) or lays
+ * the image out differently from a Memimage.
+ */
+static Memimage*
+xshmallocmemimage(Rectangle r, ulong chan, XImage **X, XShmSegmentInfo *si, Memdata **dp)
+{
+	int (*handler)(XDisplay*, XErrorEvent*);
+	Memdata *md;
+	Memimage *m;
+	XImage *xi;
+
+	memset(si, 0, sizeof *si);
+	xi = XShmCreateImage(xdisplay, xvis, xscreendepth, ZPixmap, nil, si, Dx(r), Dy(r));
+	if(xi == nil)
+		return nil;
+	if(xi->bytes_per_line != wordsperline(r, chantodepth(chan))*(int)sizeof(ulong)){
+		XDestroyImage(xi);
+		return nil;
+	}
+	si->shmid = shmget(IPC_PRIVATE, xi->bytes_per_line*xi->height, IPC_CREAT|0600);
+	if(si->shmid < 0){
+		XDestroyImage(xi);
+		return nil;
+	}
+	si->shmaddr = shmat(si->shmid, nil, 0);
+	if(si->shmaddr == (char*)-1){
+		shmctl(si->shmid, IPC_RMID, nil);
+		XDestroyImage(xi);
+		return nil;
+	}
+	xi->data = si->shmaddr;
+	si->readOnly = True;
+
+	xshmerr = 0;
+	handler = XSetErrorHandler(xshmerror);
+	XShmAttach(xdisplay, si);
+	XSync(xdisplay, False);
+	XSetErrorHandler(handler);
+	shmctl(si->shmid, IPC_RMID, nil);	/* goes when both sides detach */
+
+	md = nil;
+	m = nil;
+	if(!xshmerr && (md = mallocz(sizeof(Memdata), 1)) != nil){
+		md->ref = 1;
+		md->bdata = (uchar*)si->shmaddr;
+		md->allocd = 0;		/* freed by xshmdetach */
+		m = allocmemimaged(r, chan, md);
+	}
+	if(m == nil){
+		if(!xshmerr){
+			XShmDetach(xdisplay, si);
+			XSync(xdisplay, False);
+		}
+		shmdt(si->shmaddr);
+		free(md);
+		xi->data = NULL;
+		XDestroyImage(xi);
+		return nil;
+	}
+	md->imref = m;
+	*dp = md;
+	*X = xi;
+	return m;
+}
+
+/*
+ * Put r, already clipped, on the window.  The server handles
+ * requests in order, so with MIT-SHM only the last put of a
+ * flush asks for a completion event.
+ */
+static void
+xputrect(Rectangle r, int last)
 {
 	int x, y;
 	uchar *p;
 
-	assert(!canqlock(&drawlock));
-	if(rectclip(&r, gscreen->clipr) == 0)
+	if(xshm){
+		XShmPutImage(xdisplay, xdrawable, xgccopy, xscreenimage, r.min.x, r.min.y, r.min.x, r.min.y, Dx(r), Dy(r), last);
+		if(last)
+			xshmbusy++;
 		return;
+	}
 
 	if(xtblbit && gscreen->chan == CMAP8)
 		for(y=r.min.y; y<r.max.y; y++)
@@ -188,9 +393,38 @@ flushmemscreen(Rectangle r)
 				*p = x11toplan9[*p];
 
 	XCopyArea(xdisplay, xscreenid, xdrawable, xgccopy, r.min.x, r.min.y, Dx(r), Dy(r), r.min.x, r.min.y);
+}
+
+static void
+xflushmemscreenrects(Rectangle *rp, int n)
+{
+	Rectangle r;
+	int i, last;
+
+	assert(!canqlock(&drawlock));
+	last = -1;
+	for(i=0; i<n; i++)
+		if(rectXrect(rp[i], gscreen->clipr))
+			last = i;
+	if(last < 0)
+		return;
+
+	if(xshm)
+		xshmwait(Nshmput-1);
+	for(i=0; i<=last; i++){
+		r = rp[i];
+		if(rectclip(&r, gscreen->clipr))
+			xputrect(r, i == last);
+	}
 	XFlush(xdisplay);
 }
 
+void
+flushmemscreen(Rectangle r)
+{
+	xflushmemscreenrects(&r, 1);
+}
+
 void
 screeninit(void)
 {
@@ -298,6 +532,8 @@ screeninit(void)
 		panic("unknown screen pixel format");
 
 	initmap(xdisplay, screen, xvis);
+	xshminit();
+	flushmemscreenrects = xflushmemscreenrects;
 
 	x = y = 0;
 	r = ZR;
@@ -383,6 +619,51 @@ screeninit(void)
 	qunlock(&drawlock);
 }
 
+/*
+ * The old gscreen is freed here but devdraw may hold its data,
+ * so its segment is retired rather than detached.
+ */
+static int
+xshmscreensize(Rectangle r, ulong chan)
+{
+	XShmSegmentInfo si;
+	Memimage *mi;
+	Memdata *md;
+	XImage *xi;
+	GC gc;
+
+	gc = creategc(xdrawable);
+	if(gc == NULL)
+		return 0;
+	mi = xshmallocmemimage(r, chan, &xi, &si, &md);
+	if(mi == nil){
+		XFreeGC(xdisplay, gc);
+		return 0;
+	}
+
+	if(gscreen != nil){
+		xshmwait(0);
+		xscreenimage->data = NULL;	/* segment or freememimage's */
+		XDestroyImage(xscreenimage);
+		freememimage(gscreen);
+
+		XFreeGC(xdisplay, xgccopy);
+		if(xscreenid != 0)
+			XFreePixmap(xdisplay, xscreenid);
+	}
+	xshmretire(&xshminfo, &xshmdata);
+
+	xscreenimage = xi;
+	xscreenid = 0;
+	xgccopy = gc;
+	xshminfo = si;
+	xshmdata = md;
+
+	gscreen = mi;
+	gscreen->clipr = ZR;
+	return 1;
+}
+
 void
 screensize(Rectangle r, ulong chan)
 {
@@ -391,6 +672,13 @@ screensize(Rectangle r, ulong chan)
 	XImage *xi;
 	GC gc;
 
+	xshmreap();
+	if(xshm){
+		if(xshmscreensize(r, chan))
+			return;
+		xshm = 0;	/* remote server; put through the pixmap */
+	}
+
 	pix = XCreatePixmap(xdisplay, xdrawable, Dx(r), Dy(r), xscreendepth);
 	if(pix == 0)
 		return;
@@ -414,8 +702,10 @@ screensize(Rectangle r, ulong chan)
 		freememimage(gscreen);
 
 		XFreeGC(xdisplay, xgccopy);
-		XFreePixmap(xdisplay, xscreenid);
+		if(xscreenid != 0)
+			XFreePixmap(xdisplay, xscreenid);
 	}
+	xshmretire(&xshminfo, &xshmdata);
 
 	xscreenimage = xi;
 	xscreenid = pix;
@@ -4,6 +4,7 @@ typedef struct	Memsubfont Memsubfont;
 typedef struct	Memlayer Memlayer;
 typedef struct	Memcmap Memcmap;
 typedef struct	Memdrawparam	Memdrawparam;
+typedef struct	Memglyph	Memglyph;
 
 /*
  * Memdata is allocated from main pool, but .data from the image pool.
@@ -107,6 +108,17 @@ struct	Memdrawparam
 	ulong sdval;	/* sval in dst format */
 };
 
+/*
+ * One character of a string for memdrawglyphs: the draw of r
+ * from sp in the colour through mp in the font image.
+ */
+struct	Memglyph
+{
+	Rectangle	r;
+	Point	sp;
+	Point	mp;
+};
+
 /*
  * Memimage management
  */
@@ -131,12 +143,15 @@ extern int		memsetchan(Memimage*, ulong);
  * Graphics
  */
 extern void	memdraw(Memimage*, Rectangle, Memimage*, Point, Memimage*, Point, int);
+extern int	memdrawglyphs(Memimage*, Memimage*, Memimage*, Memglyph*, int, int);
 extern void	memline(Memimage*, Point, Point, int, int, int, Memimage*, Point, int);
 extern void	mempoly(Memimage*, Point*, int, int, int, int, Memimage*, Point, int);
 extern void	memfillpoly(Memimage*, Point*, int, int, Memimage*, Point, int);
 extern void	_memfillpolysc(Memimage*, Point*, int, int, Memimage*, Point, int, int, int, int);
 extern void	memimagedraw(Memimage*, Rectangle, Memimage*, Point, Memimage*, Point, int);
+extern int	memimageglyphs(Memimage*, Memimage*, Memimage*, Memglyph*, int, int);
 extern int	hwdraw(Memdrawparam*);
+extern int	hwdrawstats(char*, int);
 extern void	memimageline(Memimage*, Point, Point, int, int, int, Memimage*, Point, int);
 extern void	_memimageline(Memimage*, Point, Point, int, int, int, Memimage*, Point, Rectangle, int);
 extern Point	memimagestring(Memimage*, Point, Memimage*, Point, Memsubfont*, char*);
@@ -169,3 +184,13 @@ extern	Memcmap	*memdefcmap;
  * Kernel interface
  */
 void		memimagemove(void*, void*);
+
+/*
+ * Large draws are split into horizontal bands of at least
+ * memdrawbandmin pixels, memdrawnband at most, and handed to
+ * memdrawbandfn, which must call fn(arg, i) for each 0 ≤ i < n,
+ * possibly in parallel, and return when all have finished.
+ */
+extern int	memdrawnband;
+extern int	memdrawbandmin;
+extern void	(*memdrawbandfn)(void (*fn)(void*, int), void *arg, int n);
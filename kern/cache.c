@@ -0,0 +1,357 @@
+#include	"u.h"
+#include	"lib.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	"error.h"
+
+/*
+ * File data read from MCACHE mounts, in CBLOCK pieces at
+ * CBLOCK-aligned offsets, kept by (c->dev, qid.path) and
+ * thrown away least recently used first.  A piece shorter
+ * than CBLOCK is the end of the file.  What is kept of a file
+ * holds for the qid.vers it was read at; copen drops it when
+ * the server has another.
+ */
+
+enum
+{
+	Nfhash = 128,
+	Nphash = 1024,
+	Maxpages = 1<<30,	/* cache.max fits a long */
+};
+
+typedef struct Cfile Cfile;
+typedef struct Cpage Cpage;
+
+struct Cfile
+{
+	Cfile	*hash;
+	ulong	dev;
+	uvlong	path;
+	ulong	vers;
+	Cpage	*pages;
+};
+
+struct Cpage
+{
+	Cpage	*hash;
+	Cpage	*fnext;		/* Cfile.pages */
+	Cpage	*next;		/* lru, most recent first */
+	Cpage	*prev;
+	Cfile	*f;
+	ulong	bno;
+	int	len;
+	uchar	data[CBLOCK];
+};
+
+static struct
+{
+	Lock	lk;
+	long	max;		/* pages */
+	long	n;
+	Cfile	*fhash[Nfhash];
+	Cpage	*phash[Nphash];
+	Cpage	*head;
+	Cpage	*tail;
+} cache;
+
+void
+cinit(vlong bytes)
+{
+	if(bytes < 0)
+		bytes = 0;
+	if(bytes/CBLOCK > Maxpages)
+		bytes = (vlong)Maxpages*CBLOCK;
+	cache.max = bytes/CBLOCK;
+}
+
+int
+cenabled(void)
+{
+	return cache.max > 0;
+}
+
+static Cfile**
+fhash(ulong dev, uvlong path)
+{
+	return &cache.fhash[(dev^path)%Nfhash];
+}
+
+static Cpage**
+phash(Cfile *f, ulong bno)
+{
+	return &cache.phash[(f->dev^f->path^bno)%Nphash];
+}
+
+static Cfile*
+cfile(Chan *c)
+{
+	Cfile *f;
+
+	for(f = *fhash(c->dev, c->qid.path); f != nil; f = f->hash)
+		if(f->dev == c->dev && f->path == c->qid.path)
+			return f;
+	return nil;
+}
+
+static Cpage*
+cpage(Cfile *f, ulong bno)
+{
+	Cpage *p;
+
+	for(p = *phash(f, bno); p != nil; p = p->hash)
+		if(p->f == f && p->bno == bno)
+			return p;
+	return nil;
+}
+
+static void
+lruout(Cpage *p)
+{
+	if(p->prev != nil)
+		p->prev->next = p->next;
+	else
+		cache.head = p->next;
+	if(p->next != nil)
+		p->next->prev = p->prev;
+	else
+		cache.tail = p->prev;
+	p->next = p->prev = nil;
+}
+
+static void
+lruin(Cpage *p)
+{
+	p->prev = nil;
+	p->next = cache.head;
+	if(cache.head != nil)
+		cache.head->prev = p;
+	else
+		cache.tail = p;
+	cache.head = p;
+}
+
+static void
+fileout(Cfile *f)
+{
+	Cfile **l;
+
+	for(l = fhash(f->dev, f->path); *l != nil; l = &(*l)->hash)
+		if(*l == f){
+			*l = f->hash;
+			break;
+		}
+	free(f);
+}
+
+static void
+pageout(Cpage *p)
+{
+	Cpage **l;
+	Cfile *f;
+
+	f = p->f;
+	for(l = phash(f, p->bno); *l != nil; l = &(*l)->hash)
+		if(*l == p){
+			*l = p->hash;
+			break;
+		}
+	for(l = &f->pages; *l != nil; l = &(*l)->fnext)
+		if(*l == p){
+			*l = p->fnext;
+			break;
+		}
+	lruout(p);
+	p->f = nil;
+	cache.n--;
+}
+
+static void
+drop(Cfile *f)
+{
+	Cpage *p;
+
+	while((p = f->pages) != nil){
+		pageout(p);
+		free(p);
+	}
+	fileout(f);
+}
+
+/* a page for f's block bno: a new one, or the oldest */
+static Cpage*
+pagein(Cfile *f, ulong bno)
+{
+	Cpage *p, **l;
+	Cfile *g;
+
+	if((p = cpage(f, bno)) != nil)
+		pageout(p);
+	else if(cache.n >= cache.max && (p = cache.tail) != nil){
+		g = p->f;
+		pageout(p);
+		if(g != f && g->pages == nil)
+			fileout(g);
+	}else if((p = malloc(sizeof(Cpage))) == nil)
+		return nil;
+	p->f = f;
+	p->bno = bno;
+	l = phash(f, bno);
+	p->hash = *l;
+	*l = p;
+	p->fnext = f->pages;
+	f->pages = p;
+	lruin(p);
+	cache.n++;
+	return p;
+}
+
+/* c has been opened: forget what was kept of another version */
+void
+copen(Chan *c)
+{
+	Cfile *f;
+
+	lock(&cache.lk);
+	if((f = cfile(c)) != nil && f->vers != c->qid.vers)
+		drop(f);
+	unlock(&cache.lk);
+}
+
+/*
+ * Copy what is kept of c from off: the byte count, 0 at the
+ * end of the file, or -1 if the first block is not here.
+ */
+long
+cread(Chan *c, uchar *buf, long n, vlong off)
+{
+	Cfile *f;
+	Cpage *p;
+	long cnt, k, o;
+
+	lock(&cache.lk);
+	if((f = cfile(c)) == nil || f->vers != c->qid.vers){
+		unlock(&cache.lk);
+		return -1;
+	}
+	for(cnt = 0; cnt < n; ){
+		if((p = cpage(f, off/CBLOCK)) == nil)
+			break;
+		lruout(p);
+		lruin(p);
+		o = off%CBLOCK;
+		if(o >= p->len){
+			unlock(&cache.lk);
+			return cnt;
+		}
+		k = p->len - o;
+		if(k > n-cnt)
+			k = n-cnt;
+		memmove(buf+cnt, p->data+o, k);
+		cnt += k;
+		off += k;
+		if(p->len < CBLOCK)
+			break;
+	}
+	unlock(&cache.lk);
+	if(cnt == 0)
+		return -1;
+	return cnt;
+}
+
+/*
+ * Keep n bytes of c read at the CBLOCK-aligned off; eof if
+ * the file ended there, so the last piece may be short.
+ */
+void
+cupdate(Chan *c, uchar *buf, long n, vlong off, int eof)
+{
+	Cfile *f, **l;
+	Cpage *p;
+	long k;
+
+	if(cache.max <= 0 || off%CBLOCK != 0)
+		return;
+	lock(&cache.lk);
+	if((f = cfile(c)) != nil && f->vers != c->qid.vers){
+		drop(f);
+		f = nil;
+	}
+	if(f == nil){
+		if((f = malloc(sizeof(Cfile))) == nil){
+			unlock(&cache.lk);
+			return;
+		}
+		f->dev = c->dev;
+		f->path = c->qid.path;
+		f->vers = c->qid.vers;
+		l = fhash(f->dev, f->path);
+		f->hash = *l;
+		*l = f;
+	}
+	for(; n >= 0; n -= k){
+		k = n;
+		if(k > CBLOCK)
+			k = CBLOCK;
+		if(k < CBLOCK && !eof)
+			break;
+		if((p = pagein(f, off/CBLOCK)) == nil)
+			break;
+		memmove(p->data, buf, k);
+		p->len = k;
+		if(k < CBLOCK)
+			break;
+		buf += k;
+		off += k;
+	}
+	if(f->pages == nil)
+		fileout(f);
+	unlock(&cache.lk);
+}
+
+/*
+ * c was written from off: forget the blocks written and
+ * where the file ended, which may have moved.
+ */
+void
+cwrite(Chan *c, long n, vlong off)
+{
+	Cfile *f;
+	Cpage *p, *next;
+
+	lock(&cache.lk);
+	if((f = cfile(c)) != nil){
+		for(p = f->pages; p != nil; p = next){
+			next = p->fnext;
+			if(p->len == CBLOCK)
+			if((vlong)(p->bno+1)*CBLOCK <= off || (vlong)p->bno*CBLOCK >= off+n)
+				continue;
+			pageout(p);
+			free(p);
+		}
+		if(f->pages == nil)
+			fileout(f);
+	}
+	unlock(&cache.lk);
+}
+
+/* c was truncated, removed, or changed by wstat */
+void
+cdrop(Chan *c)
+{
+	Cfile *f;
+
+	lock(&cache.lk);
+	if((f = cfile(c)) != nil)
+		drop(f);
+	unlock(&cache.lk);
+}
+
+char*
+cprint(char *s, char *e)
+{
+	lock(&cache.lk);
+	s = seprint(s, e, "data %ld of %ld blocks\n", cache.n, cache.max);
+	unlock(&cache.lk);
+	return s;
+}
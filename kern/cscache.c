@@ -0,0 +1,304 @@
+#include	"u.h"
+#include	"lib.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	"error.h"
+
+#include	"devip.h"
+
+/*
+ * Host names looked up for #I/cs, kept for $csttl seconds
+ * (failures for at most Negttl), since getaddrinfo does not
+ * say how long its answer holds.  Lookups run on a few procs
+ * of their own; a name being looked up is looked up once, and
+ * whoever asks for it meanwhile waits for that answer.  A proc
+ * interrupted while waiting leaves the lookup to finish.
+ */
+
+enum
+{
+	Nhash = 64,
+	Maxname = 512,	/* then start over */
+	Nresolver = 4,
+	Ttl = 60,
+	Negttl = 10,
+	Maxaddr = 8,
+};
+
+typedef struct Csname Csname;
+typedef struct Cswait Cswait;
+
+struct Cswait
+{
+	Cswait	*next;
+	Rendez	r;
+	int	done;
+};
+
+struct Csname
+{
+	Csname	*hash;
+	Csname	*qnext;		/* waiting for a resolver */
+	char	*name;
+	int	pending;
+	int	ref;		/* procs waiting */
+	Cswait	*wait;
+	ulong	expire;		/* ticks */
+	int	naddr;
+	char	*addr[Maxaddr];
+};
+
+typedef struct Resolver Resolver;
+struct Resolver
+{
+	Rendez	r;
+};
+
+int	(*csresolve)(char*, char**, int) = so_gethostbyname;
+
+static struct
+{
+	Lock	lk;
+	int	ttl;		/* ms */
+	Csname	*hash[Nhash];
+	int	nname;
+	Csname	*qhead;
+	Csname	**qtail;
+	int	nproc;
+	int	idle;
+	Resolver	proc[Nresolver];
+	ulong	hit;
+	ulong	neghit;
+	ulong	miss;
+	ulong	joined;
+} cs;
+
+static Csname**
+cshash(char *name)
+{
+	ulong h;
+
+	for(h = 0; *name != '\0'; name++)
+		h = h*31 + *name;
+	return &cs.hash[h%Nhash];
+}
+
+static void
+csfree(Csname *n)
+{
+	int i;
+
+	for(i=0; i<n->naddr; i++)
+		free(n->addr[i]);
+	free(n->name);
+	free(n);
+}
+
+/* drop the names no one is looking up or waiting for */
+static void
+csflush(void)
+{
+	Csname *n, **l;
+	int i;
+
+	for(i=0; i<Nhash; i++)
+		for(l = &cs.hash[i]; (n = *l) != nil; ){
+			if(n->pending || n->ref > 0){
+				l = &n->hash;
+				continue;
+			}
+			*l = n->hash;
+			cs.nname--;
+			csfree(n);
+		}
+}
+
+static int
+queued(void *a)
+{
+	USED(a);
+	return cs.qhead != nil;
+}
+
+static void
+resolver(void *a)
+{
+	Resolver *r;
+	Csname *n;
+	Cswait *w;
+	char *addr[Maxaddr];
+	int i, naddr;
+
+	r = a;
+	for(;;){
+		while(waserror())
+			;
+		sleep(&r->r, queued, nil);
+		poperror();
+
+		lock(&cs.lk);
+		if((n = cs.qhead) == nil){
+			unlock(&cs.lk);
+			continue;
+		}
+		cs.qhead = n->qnext;
+		cs.idle--;
+		unlock(&cs.lk);
+
+		naddr = (*csresolve)(n->name, addr, Maxaddr);
+
+		lock(&cs.lk);
+		cs.idle++;
+		for(i=0; i<naddr; i++)
+			n->addr[i] = addr[i];
+		n->naddr = naddr;
+		n->expire = ticks() + (naddr > 0 ? cs.ttl : (cs.ttl < Negttl*1000 ? cs.ttl : Negttl*1000));
+		n->pending = 0;
+		while((w = n->wait) != nil){
+			n->wait = w->next;
+			w->done = 1;
+			wakeup(&w->r);
+		}
+		unlock(&cs.lk);
+	}
+}
+
+/* called with cs.lk held */
+static void
+enqueue(Csname *n)
+{
+	int i;
+
+	n->pending = 1;
+	n->qnext = nil;
+	if(cs.qhead == nil)
+		cs.qtail = &cs.qhead;
+	*cs.qtail = n;
+	cs.qtail = &n->qnext;
+	if(cs.idle == 0 && cs.nproc < Nresolver){
+		cs.idle++;
+		kproc("resolver", resolver, &cs.proc[cs.nproc++]);
+	}
+	for(i=0; i<cs.nproc; i++)
+		wakeup(&cs.proc[i].r);
+}
+
+static int
+answered(void *a)
+{
+	return ((Cswait*)a)->done;
+}
+
+static void
+unwait(Csname *n, Cswait *w)
+{
+	Cswait **l;
+
+	lock(&cs.lk);
+	for(l = &n->wait; *l != nil; l = &(*l)->next)
+		if(*l == w){
+			*l = w->next;
+			break;
+		}
+	n->ref--;
+	unlock(&cs.lk);
+}
+
+/*
+ * Look host up as so_gethostbyname would: up to n addresses,
+ * each to be freed, in addr; 0 if there are none.
+ */
+int
+cslookup(char *host, char **addr, int n)
+{
+	Csname *n1, **l;
+	Cswait w;
+	int i;
+
+	if(cs.ttl == 0)
+		return (*csresolve)(host, addr, n);
+
+	lock(&cs.lk);
+	l = cshash(host);
+	for(n1 = *l; n1 != nil; n1 = n1->hash)
+		if(strcmp(n1->name, host) == 0)
+			break;
+	if(n1 != nil && !n1->pending && (long)(n1->expire - ticks()) <= 0){
+		/* stale: look it up again */
+		for(i=0; i<n1->naddr; i++)
+			free(n1->addr[i]);
+		n1->naddr = 0;
+		enqueue(n1);
+		cs.miss++;
+	}else if(n1 == nil){
+		if(cs.nname >= Maxname)
+			csflush();
+		if((n1 = malloc(sizeof(Csname))) == nil || (n1->name = strdup(host)) == nil){
+			free(n1);
+			unlock(&cs.lk);
+			error(Enomem);
+		}
+		n1->hash = *l;
+		*l = n1;
+		cs.nname++;
+		enqueue(n1);
+		cs.miss++;
+	}else if(n1->pending)
+		cs.joined++;
+	else if(n1->naddr > 0)
+		cs.hit++;
+	else
+		cs.neghit++;
+	n1->ref++;
+	if(n1->pending){
+		w.done = 0;
+		memset(&w.r, 0, sizeof w.r);
+		w.next = n1->wait;
+		n1->wait = &w;
+		unlock(&cs.lk);
+		if(waserror()){
+			unwait(n1, &w);
+			nexterror();
+		}
+		sleep(&w.r, answered, &w);
+		poperror();
+		lock(&cs.lk);
+	}
+	for(i=0; i<n1->naddr && i<n; i++)
+		if((addr[i] = strdup(n1->addr[i])) == nil)
+			break;
+	n1->ref--;
+	unlock(&cs.lk);
+	return i;
+}
+
+/* forget every answer */
+void
+csrefresh(void)
+{
+	lock(&cs.lk);
+	csflush();
+	unlock(&cs.lk);
+}
+
+char*
+csprint(char *s, char *e)
+{
+	lock(&cs.lk);
+	s = seprint(s, e, "hit %lud neghit %lud miss %lud joined %lud names %d resolvers %d\n",
+		cs.hit, cs.neghit, cs.miss, cs.joined, cs.nname, cs.nproc);
+	unlock(&cs.lk);
+	return s;
+}
+
+void
+csinit(void)
+{
+	char *s;
+
+	cs.ttl = Ttl*1000;
+	if((s = getenv("csttl")) != nil)
+		cs.ttl = atoi(s)*1000;
+	if(cs.ttl < 0)
+		cs.ttl = 0;
+}
@@ -16,6 +16,7 @@ typedef struct DevConf	DevConf;
 typedef struct Label	Label;
 typedef struct Log	Log;
 typedef struct Logflag	Logflag;
+typedef struct Metacache	Metacache;
 typedef struct Mount	Mount;
 typedef struct Mntrpc	Mntrpc;
 typedef struct Mntwalk	Mntwalk;
@@ -262,10 +263,16 @@ struct Mnt
 	Chan	*c;		/* Channel to file service */
 	Proc	*rip;		/* Reader in progress */
 	Mntrpc	*queue;		/* Queue of pending requests on this channel */
+	Mntrpc	**tagrpc[256];	/* the same by tag: [tag>>8][tag&0xFF] */
 	ulong	id;		/* Multiplexer id for channel check */
 	Mnt	*list;		/* Free list */
 	int	flags;		/* cache */
 	int	msize;		/* data + IOHDRSZ */
+	int	window;		/* rpcs in flight on MCACHE chans */
+	Metacache	*meta;	/* what MCACHE chans have been told */
+	QLock	deferlk;	/* walking deferred chans to their fids */
+	uvlong	cachehit;	/* bytes read from cache.c */
+	uvlong	cachemiss;	/* bytes read for it from the server */
 	char	*version;			/* 9P version */
 	Queue	*q;		/* input queue */
 };
@@ -397,6 +404,7 @@ enum
 	NUMSIZE	=	12,		/* size of formatted number */
 	MB =		(1024*1024),
 	READSTR =	1000,		/* temporary buffer size for device reads */
+	CBLOCK =	8192,		/* unit of file data in cache.c */
 };
 
 extern	int	cpuserver;
@@ -12,6 +12,7 @@
 #undef read
 
 void	(*screenputs)(char*, int) = 0;
+int	(*aanstats)(char*, int) = 0;
 
 Kmesg	kmesg;			/* console messages */
 Queue*	kbdq;			/* unprocessed console input */
@@ -335,6 +336,7 @@ kbdputc(Queue *q, int c)
 
 enum{
 	Qdir,
+	Qaan,
 	Qbintime,
 	Qcons,
 	Qconsctl,
@@ -342,6 +344,7 @@ enum{
 	Qkmesg,
 	Qkprint,
 	Qhostdomain,
+	Qmntcache,
 	Qhostowner,
 	Qnull,
 	Qosversion,
@@ -363,6 +366,7 @@ enum
 
 static Dirtab consdir[]={
 	".",	{Qdir, 0, QTDIR},	0,		DMDIR|0555,
+	"aan",		{Qaan, 0, 0},	0,		0444,
 	"bintime",	{Qbintime, 0, 0},	24,		0664,
 	"cons",		{Qcons, 0, 0},	0,		0660,
 	"consctl",	{Qconsctl, 0, 0},	0,		0220,
@@ -371,6 +375,7 @@ static Dirtab consdir[]={
 	"hostowner",	{Qhostowner, 0, 0},	0,	0664,
 	"kmesg",	{Qkmesg, 0, 0},	0,		0440,
 	"kprint",	{Qkprint, 0, QTEXCL},	0,	DMEXCL|0440,
+	"mntcache",	{Qmntcache, 0, 0},	0,		0444,
 	"null",		{Qnull, 0, 0},	0,		0666,
 	"osversion",	{Qosversion, 0, 0},	0,		0444,
 	"random",	{Qrandom, 0, 0},	0,		0444,
@@ -678,6 +683,36 @@ consread(Chan *c, void *buf, long n, vlong off)
 		poperror();
 		return n;
 
+	case Qaan:
+		if(aanstats == 0)
+			return 0;
+		b = malloc(READSTR);
+		if(b == nil)
+			error(Enomem);
+		aanstats(b, READSTR);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		n = readstr((ulong)offset, buf, n, b);
+		free(b);
+		poperror();
+		return n;
+
+	case Qmntcache:
+		b = malloc(READSTR);
+		if(b == nil)
+			error(Enomem);
+		mntcachestats(b, READSTR);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		n = readstr((ulong)offset, buf, n, b);
+		free(b);
+		poperror();
+		return n;
+
 	case Qzero:
 		memset(buf, 0, n);
 		return n;
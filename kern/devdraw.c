@@ -16,6 +16,7 @@ enum
 	Qtopdir		= 0,
 	Qnew,
 	Qwinname,
+	Qstats,
 	Q3rd,
 	Q2nd,
 	Qcolormap,
@@ -54,8 +55,7 @@ struct Draw
 	int		clientid;
 	int		nclient;
 	Client**	client;
-	int		nname;
-	DName*		name;
+	DName*		name[NHASH];
 	int		vers;
 	int		softscreen;
 };
@@ -63,7 +63,9 @@ struct Draw
 struct Client
 {
 	Ref		r;
-	DImage*		dimage[NHASH];
+	DImage**	dimage;		/* nhash chains, grown with nimage */
+	int		nhash;
+	int		nimage;
 	CScreen*	cscreen;
 	Refresh*	refresh;
 	Rendez		refrend;
@@ -97,6 +99,7 @@ struct DName
 	Client		*client;
 	DImage*		dimage;
 	int		vers;
+	DName*		next;
 };
 
 struct FChar
@@ -156,10 +159,18 @@ static	DImage*	screendimage;
 static	char	screenname[40];
 static	int	screennameid;
 
-static	Rectangle	flushrect;
-static	int		waste;
-static	DScreen*	dscreen;
+/*
+ * Damage to the screen not yet flushed: a few disjoint rectangles,
+ * so that updates far apart are not flushed as their bounding box.
+ */
+enum {
+	Nflush = 8,
+};
+static	Rectangle	flushrects[Nflush];
+static	int		nflush;
+static	DScreen*	dscreen[NHASH];
 extern	void		flushmemscreen(Rectangle);
+	void		(*flushmemscreenrects)(Rectangle*, int);
 	void		drawmesg(Client*, void*, int);
 	void		drawuninstall(Client*, int);
 	void		drawfreedimage(DImage*);
@@ -249,6 +260,12 @@ drawgen(Chan *c, char *n, Dirtab *d, int nd, int s, Dir *dp)
 			devdir(c, q, "winname", 0, eve, 0444, dp);
 			return 1;
 		}
+		if(s == 2){
+	case Qstats:
+			mkqid(&q, Qstats, 0, QTFILE);
+			devdir(c, q, "drawstats", 0, eve, 0444, dp);
+			return 1;
+		}
 		return -1;
 	}
 
@@ -354,47 +371,70 @@ drawrefresh(Memimage *i, Rectangle r, void *v)
 	}
 }
 
+static int
+area(Rectangle r)
+{
+	return Dx(r)*Dy(r);
+}
+
+/*
+ * Absorb r into a if:
+ *	total area is small
+ *	waste is less than half total area
+ * 	rectangles touch
+ */
+static int
+absorbs(Rectangle a, Rectangle r)
+{
+	Rectangle u;
+	int au, waste;
+
+	u = a;
+	combinerect(&u, r);
+	au = area(u);
+	/*
+	 * Area of waste is area of the bb minus the areas
+	 * of the two, which we assume are not waste.
+	 * This could be negative, but that's OK.
+	 */
+	waste = au - area(a) - area(r);
+	return au<=1024 || waste*2<au || rectXrect(a, r);
+}
+
 static void
 addflush(Rectangle r)
 {
-	int abb, ar, anbb;
-	Rectangle nbb;
+	int i, best, w, bw;
+	Rectangle u;
 
 	if(sdraw.softscreen==0 || screenimage == nil || !rectclip(&r, screenimage->r))
 		return;
-	if(flushrect.min.x >= flushrect.max.x){
-		flushrect = r;
-		waste = 0;
+	/* growing r may make it absorb rectangles already passed */
+	for(i=0; i<nflush; i++)
+		if(absorbs(flushrects[i], r)){
+			combinerect(&r, flushrects[i]);
+			flushrects[i] = flushrects[--nflush];
+			i = -1;
+		}
+	if(nflush < Nflush){
+		flushrects[nflush++] = r;
 		return;
 	}
-	nbb = flushrect;
-	combinerect(&nbb, r);
-	ar = Dx(r)*Dy(r);
-	abb = Dx(flushrect)*Dy(flushrect);
-	anbb = Dx(nbb)*Dy(nbb);
-	/*
-	 * Area of new waste is area of new bb minus area of old bb,
-	 * less the area of the new segment, which we assume is not waste.
-	 * This could be negative, but that's OK.
-	 */
-	waste += anbb-abb - ar;
-	if(waste < 0)
-		waste = 0;
-	/*
-	 * absorb if:
-	 *	total area is small
-	 *	waste is less than half total area
-	 * 	rectangles touch
-	 */
-	if(anbb<=1024 || waste*2<anbb || rectXrect(flushrect, r)){
-		flushrect = nbb;
-		return;
+	/* full: merge with the rectangle that wastes least */
+	best = 0;
+	bw = 0;
+	for(i=0; i<nflush; i++){
+		u = flushrects[i];
+		combinerect(&u, r);
+		w = area(u) - area(flushrects[i]);
+		if(i == 0 || w < bw){
+			best = i;
+			bw = w;
+		}
 	}
-	/* emit current state */
-	if(flushrect.min.x < flushrect.max.x)
-		flushmemscreen(flushrect);
-	flushrect = r;
-	waste = 0;
+	combinerect(&r, flushrects[best]);
+	flushrects[best] = flushrects[--nflush];
+	addflush(r);
 }
 
 static
@@ -404,7 +444,7 @@ dstflush(int dstid, Memimage *dst, Rectangle r)
 	Memlayer *l;
 
 	if(dstid == 0){
-		combinerect(&flushrect, r);
+		addflush(r);
 		return;
 	}
 	if(screenimage == nil || dst == nil || (l = dst->layer) == nil)
@@ -421,9 +461,16 @@ dstflush(int dstid, Memimage *dst, Rectangle r)
 void
 drawflush(void)
 {
-	if(screenimage && flushrect.min.x < flushrect.max.x)
-		flushmemscreen(flushrect);
-	flushrect = Rect(10000, 10000, -10000, -10000);
+	int i;
+
+	if(screenimage && nflush > 0){
+		if(flushmemscreenrects != nil)
+			flushmemscreenrects(flushrects, nflush);
+		else
+			for(i=0; i<nflush; i++)
+				flushmemscreen(flushrects[i]);
+	}
+	nflush = 0;
 }
 
 int
@@ -434,14 +481,23 @@ drawcmp(char *a, char *b, int n)
 	return memcmp(a, b, n);
 }
 
+static int
+drawnamehash(char *str, int n)
+{
+	ulong h;
+
+	h = 0;
+	while(--n >= 0)
+		h = h*31 + (uchar)*str++;
+	return h&HASHMASK;
+}
+
 DName*
 drawlookupname(int n, char *str)
 {
-	DName *name, *ename;
+	DName *name;
 
-	name = sdraw.name;
-	ename = &name[sdraw.nname];
-	for(; name<ename; name++)
+	for(name=sdraw.name[drawnamehash(str, n)]; name; name=name->next)
 		if(drawcmp(name->name, str, n) == 0)
 			return name;
 	return 0;
@@ -470,7 +526,7 @@ drawlookup(Client *client, int id, int checkname)
 {
 	DImage *d;
 
-	d = client->dimage[id&HASHMASK];
+	d = client->dimage[id&(client->nhash-1)];
 	while(d){
 		if(d->id == id){
 			if(checkname && !drawgoodname(d))
@@ -487,7 +543,7 @@ drawlookupdscreen(int id)
 {
 	DScreen *s;
 
-	s = dscreen;
+	s = dscreen[id&HASHMASK];
 	while(s){
 		if(s->id == id)
 			return s;
@@ -532,6 +588,32 @@ allocdimage(Memimage *i)
 	return d;
 }
 
+/*
+ * Double the image hash when the chains average two images.
+ * Ids are mostly small and dense, so the low bits spread them.
+ */
+static void
+drawrehash(Client *client)
+{
+	DImage **t, *d;
+	int i, n;
+
+	n = client->nhash*2;
+	t = malloc(n*sizeof(DImage*));
+	if(t == 0)
+		return;	/* keep the longer chains */
+	memset(t, 0, n*sizeof(DImage*));
+	for(i=0; i<client->nhash; i++)
+		while((d = client->dimage[i]) != nil){
+			client->dimage[i] = d->next;
+			d->next = t[d->id&(n-1)];
+			t[d->id&(n-1)] = d;
+		}
+	free(client->dimage);
+	client->dimage = t;
+	client->nhash = n;
+}
+
 Memimage*
 drawinstall(Client *client, int id, Memimage *i, DScreen *dscreen)
 {
@@ -542,8 +624,10 @@ drawinstall(Client *client, int id, Memimage *i, DScreen *dscreen)
 		return 0;
 	d->id = id;
 	d->dscreen = dscreen;
-	d->next = client->dimage[id&HASHMASK];
-	client->dimage[id&HASHMASK] = d;
+	d->next = client->dimage[id&(client->nhash-1)];
+	client->dimage[id&(client->nhash-1)] = d;
+	if(++client->nimage > 2*client->nhash)
+		drawrehash(client);
 	return i;
 }
 
@@ -587,9 +671,9 @@ drawinstallscreen(Client *client, DScreen *d, int id, DImage *dimage, DImage *df
 		d->id = id;
 		d->screen = s;
 		d->public = public;
-		d->next = dscreen;
+		d->next = dscreen[id&HASHMASK];
 		d->owner = client;
-		dscreen = d;
+		dscreen[id&HASHMASK] = d;
 	}
 	c->dscreen = d;
 	d->ref++;
@@ -601,36 +685,54 @@ drawinstallscreen(Client *client, DScreen *d, int id, DImage *dimage, DImage *df
 void
 drawdelname(DName *name)
 {
-	int i;
+	DName **l;
 
+	for(l=&sdraw.name[drawnamehash(name->name, strlen(name->name))]; *l; l=&(*l)->next)
+		if(*l == name){
+			*l = name->next;
+			break;
+		}
 	free(name->name);
-	i = name-sdraw.name;
-	memmove(name, name+1, (sdraw.nname-(i+1))*sizeof(DName));
-	sdraw.nname--;
+	free(name);
+}
+
+/*
+ * Delete the names given by client, or those of dimage.
+ */
+static void
+drawdelnames(Client *client, DImage *dimage)
+{
+	DName **l, *name;
+	int i;
+
+	for(i=0; i<NHASH; i++){
+		l = &sdraw.name[i];
+		while((name = *l) != nil){
+			if((client && name->client == client) || (dimage && name->dimage == dimage)){
+				*l = name->next;
+				free(name->name);
+				free(name);
+			}else
+				l = &name->next;
+		}
+	}
 }
 
 void
 drawfreedscreen(DScreen *this)
 {
-	DScreen *ds, *next;
+	DScreen **l;
 
 	this->ref--;
 	if(this->ref < 0)
 		print("negative ref in drawfreedscreen\n");
 	if(this->ref > 0)
 		return;
-	ds = dscreen;
-	if(ds == this){
-		dscreen = this->next;
-		goto Found;
-	}
-	while((next = ds->next) != nil){
-		if(next == this){
-			ds->next = this->next;
+	for(l=&dscreen[this->id&HASHMASK]; *l; l=&(*l)->next)
+		if(*l == this){
+			*l = this->next;
 			goto Found;
 		}
-		ds = next;
-	}
 	error(Enodrawimage);
 
     Found:
@@ -645,7 +747,6 @@ drawfreedscreen(DScreen *this)
 void
 drawfreedimage(DImage *dimage)
 {
-	int i;
 	Memimage *l;
 	DScreen *ds;
 
@@ -656,11 +757,7 @@ drawfreedimage(DImage *dimage)
 		return;
 
 	/* any names? */
-	for(i=0; i<sdraw.nname; )
-		if(sdraw.name[i].dimage == dimage)
-			drawdelname(sdraw.name+i);
-		else
-			i++;
+	drawdelnames(nil, dimage);
 	if(dimage->fromname){	/* acquired by name; owned by someone else*/
 		drawfreedimage(dimage->fromname);
 		goto Return;
@@ -711,48 +808,36 @@ drawuninstallscreen(Client *client, CScreen *this)
 void
 drawuninstall(Client *client, int id)
 {
-	DImage *d, *next;
+	DImage **l, *d;
 
-	d = client->dimage[id&HASHMASK];
-	if(d == 0)
-		error(Enodrawimage);
-	if(d->id == id){
-		client->dimage[id&HASHMASK] = d->next;
-		drawfreedimage(d);
-		return;
-	}
-	while((next = d->next) != nil){
-		if(next->id == id){
-			d->next = next->next;
-			drawfreedimage(next);
+	for(l=&client->dimage[id&(client->nhash-1)]; (d = *l) != nil; l=&d->next)
+		if(d->id == id){
+			*l = d->next;
+			client->nimage--;
+			drawfreedimage(d);
 			return;
 		}
-		d = next;
-	}
 	error(Enodrawimage);
 }
 
 void
 drawaddname(Client *client, DImage *di, int n, char *str)
 {
-	DName *name, *ename, *new, *t;
+	DName *new;
+	int h;
 
-	name = sdraw.name;
-	ename = &name[sdraw.nname];
-	for(; name<ename; name++)
-		if(drawcmp(name->name, str, n) == 0)
-			error(Enameused);
-	t = smalloc((sdraw.nname+1)*sizeof(DName));
-	memmove(t, sdraw.name, sdraw.nname*sizeof(DName));
-	free(sdraw.name);
-	sdraw.name = t;
-	new = &sdraw.name[sdraw.nname++];
+	if(drawlookupname(n, str) != nil)
+		error(Enameused);
+	new = smalloc(sizeof(DName));
 	new->name = smalloc(n+1);
 	memmove(new->name, str, n);
 	new->name[n] = 0;
 	new->dimage = di;
 	new->client = client;
 	new->vers = ++sdraw.vers;
+	h = drawnamehash(str, n);
+	new->next = sdraw.name[h];
+	sdraw.name[h] = new;
 }
 
 Client*
@@ -780,6 +865,13 @@ drawnewclient(void)
 	if(cl == 0)
 		return 0;
 	memset(cl, 0, sizeof(Client));
+	cl->dimage = malloc(NHASH*sizeof(DImage*));
+	if(cl->dimage == 0){
+		free(cl);
+		return 0;
+	}
+	memset(cl->dimage, 0, NHASH*sizeof(DImage*));
+	cl->nhash = NHASH;
 	cl->slot = i;
 	cl->clientid = ++sdraw.clientid;
 	cl->op = SoverD;
@@ -862,21 +954,31 @@ drawpoint(Point *p, uchar *a)
 	p->y = BGLONG(a+1*4);
 }
 
+static void
+drawglyph(Memglyph *g, Point p, Point sp, DImage *font, FChar *fc)
+{
+	g->r.min.x = p.x+fc->left;
+	g->r.min.y = p.y-(font->ascent-fc->miny);
+	g->r.max.x = g->r.min.x+(fc->maxx-fc->minx);
+	g->r.max.y = g->r.min.y+(fc->maxy-fc->miny);
+	g->sp.x = sp.x+fc->left;
+	g->sp.y = sp.y+fc->miny;
+	g->mp = Pt(fc->minx, fc->miny);
+}
+
 Point
 drawchar(Memimage *dst, Memimage *rdst, Point p, Memimage *src, Point *sp, DImage *font, int index, int op)
 {
 	FChar *fc;
+	Memglyph g;
 	Rectangle r;
 	Point sp1;
 	static Memimage *tmp;
 
 	fc = &font->fchar[index];
-	r.min.x = p.x+fc->left;
-	r.min.y = p.y-(font->ascent-fc->miny);
-	r.max.x = r.min.x+(fc->maxx-fc->minx);
-	r.max.y = r.min.y+(fc->maxy-fc->miny);
-	sp1.x = sp->x+fc->left;
-	sp1.y = sp->y+fc->miny;
+	drawglyph(&g, p, *sp, font, fc);
+	r = g.r;
+	sp1 = g.sp;
 
 	/*
 	 * If we're drawing greyscale fonts onto a VGA screen,
@@ -895,11 +997,11 @@ drawchar(Memimage *dst, Memimage *rdst, Point p, Memimage *src, Point *sp, DImag
 				goto fallback;
 		}
 		memdraw(tmp, Rect(0,0,Dx(r),Dy(r)), rdst, r.min, memopaque, ZP, S);
-		memdraw(tmp, Rect(0,0,Dx(r),Dy(r)), src, sp1, font->image, Pt(fc->minx, fc->miny), op);
+		memdraw(tmp, Rect(0,0,Dx(r),Dy(r)), src, sp1, font->image, g.mp, op);
 		memdraw(dst, r, tmp, ZP, memopaque, ZP, S);
 	}else{
 	fallback:
-		memdraw(dst, r, src, sp1, font->image, Pt(fc->minx, fc->miny), op);
+		memdraw(dst, r, src, sp1, font->image, g.mp, op);
 	}
 
 	p.x += fc->width;
@@ -907,6 +1009,52 @@ drawchar(Memimage *dst, Memimage *rdst, Point p, Memimage *src, Point *sp, DImag
 	return p;
 }
 
+enum {
+	Nglyph = 64,	/* characters per memdrawglyphs */
+};
+
+/*
+ * Draw the ni characters at u as drawchar would, but in runs
+ * of Nglyph handed to memdrawglyphs, which skips the per-draw
+ * setup when dst is unobscured and src is a colour.
+ */
+static Point
+drawstring(Memimage *dst, Memimage *rdst, Point p, Memimage *src, Point *sp, DImage *font, uchar *u, int ni, int op)
+{
+	Memglyph g[Nglyph];
+	FChar *fc;
+	Point p0, sp0;
+	int i, n, fast;
+
+	fast = !(ishwimage(dst) && !ishwimage(rdst) && font->image->depth > 1);
+	while(ni > 0){
+		n = ni;
+		if(n > Nglyph)
+			n = Nglyph;
+		if(fast){
+			p0 = p;
+			sp0 = *sp;
+			for(i=0; i<n; i++){
+				fc = &font->fchar[BGSHORT(u+2*i)];
+				drawglyph(&g[i], p, *sp, font, fc);
+				p.x += fc->width;
+				sp->x += fc->width;
+			}
+			if(!memdrawglyphs(dst, src, font->image, g, n, op)){
+				fast = 0;
+				p = p0;
+				*sp = sp0;
+			}
+		}
+		if(!fast)
+			for(i=0; i<n; i++)
+				p = drawchar(dst, rdst, p, src, sp, font, BGSHORT(u+2*i), op);
+		u += 2*n;
+		ni -= n;
+	}
+	return p;
+}
+
 static DImage*
 makescreenimage(void)
 {
@@ -1030,6 +1178,7 @@ drawopen(Chan *c, int omode)
 
 	switch(QID(c->qid)){
 	case Qwinname:
+	case Qstats:
 		break;
 
 	case Qnew:
@@ -1040,7 +1189,7 @@ drawopen(Chan *c, int omode)
 		if(cl->busy)
 			error(Einuse);
 		cl->busy = 1;
-		flushrect = Rect(10000, 10000, -10000, -10000);
+		nflush = 0;
 		dn = drawlookupname(strlen(screenname), screenname);
 		if(dn == 0)
 			error("draw: cannot happen 2");
@@ -1098,16 +1247,12 @@ drawclose(Chan *c)
 			free(r);
 		}
 		/* free names */
-		for(i=0; i<sdraw.nname; )
-			if(sdraw.name[i].client == cl)
-				drawdelname(sdraw.name+i);
-			else
-				i++;
+		drawdelnames(cl, nil);
 		while(cl->cscreen)
 			drawuninstallscreen(cl, cl->cscreen);
 		/* all screens are freed, so now we can free images */
 		dp = cl->dimage;
-		for(i=0; i<NHASH; i++){
+		for(i=0; i<cl->nhash; i++){
 			while((d = *dp) != nil){
 				*dp = d->next;
 				drawfreedimage(d);
@@ -1116,12 +1261,27 @@ drawclose(Chan *c)
 		}
 		sdraw.client[cl->slot] = 0;
 		drawflush();	/* to erase visible, now dead windows */
+		free(cl->dimage);
 		free(cl);
 	}
 	dunlock();
 	poperror();
 }
 
+static long
+drawreadstats(vlong off, void *a, long n)
+{
+	char *buf;
+
+	buf = smalloc(8192);
+	dlock();
+	hwdrawstats(buf, 8192);
+	dunlock();
+	n = readstr(off, a, n, buf);
+	free(buf);
+	return n;
+}
+
 long
 drawread(Chan *c, void *a, long n, vlong off)
 {
@@ -1139,6 +1299,8 @@ drawread(Chan *c, void *a, long n, vlong off)
 		return devdirread(c, a, n, 0, 0, drawgen);
 	if(QID(c->qid) == Qwinname)
 		return readstr(off, a, n, screenname);
+	if(QID(c->qid) == Qstats)
+		return drawreadstats(off, a, n);
 
 	cl = drawclient(c);
 	dlock();
@@ -1943,6 +2105,11 @@ drawmesg(Client *client, void *av, int n)
 			m += ni*2;
 			if(n < m)
 				error(Eshortdraw);
+			for(j=0; j<ni; j++){
+				ci = BGSHORT(u+2*j);
+				if(ci<0 || ci>=font->nfchar)
+					error(Eindex);
+			}
 			clipr = dst->clipr;
 			dst->clipr = r;
 			op = drawclientop(client);
@@ -1955,29 +2122,11 @@ drawmesg(Client *client, void *av, int n)
 				r.min.y = p.y-font->ascent;
 				r.max.x = p.x;
 				r.max.y = r.min.y+Dy(font->image->r);
-				j = ni;
-				while(--j >= 0){
-					ci = BGSHORT(u);
-					if(ci<0 || ci>=font->nfchar){
-						dst->clipr = clipr;
-						error(Eindex);
-					}
-					r.max.x += font->fchar[ci].width;
-					u += 2;
-				}
+				for(j=0; j<ni; j++)
+					r.max.x += font->fchar[BGSHORT(u+2*j)].width;
 				memdraw(dst, r, bg, q, memopaque, ZP, op);
-				u -= 2*ni;
-			}
-			q = p;
-			while(--ni >= 0){
-				ci = BGSHORT(u);
-				if(ci<0 || ci>=font->nfchar){
-					dst->clipr = clipr;
-					error(Eindex);
-				}
-				q = drawchar(dst, bg, q, src, &sp, font, ci, op);
-				u += 2;
 			}
+			q = drawstring(dst, bg, p, src, &sp, font, u, ni, op);
 			dst->clipr = clipr;
 			p.y -= font->ascent;
 			dstflush(dstid, dst, Rect(p.x, p.y, q.x, p.y+Dy(font->image->r)));
@@ -27,7 +27,11 @@ struct Ufsinfo
 	vlong	offset;
 	QLock	oq;
 	char*	path;
-	char nextname[NAME_MAX];
+	int	nseq;		/* reads in a row, for read-ahead */
+	uchar*	dirbuf;		/* entries read so far, as 9P stat */
+	ulong	ndirbuf;
+	ulong	adirbuf;
+	int	direof;
 };
 
 static	Qid	fsqid(struct stat *);
@@ -181,6 +185,10 @@ fsopen(Chan *c, int mode)
 			error(Eperm);
 		if((uif->dir = opendir(uif->path)) == NULL)
 			error(strerror(errno));
+		uif->dirbuf = nil;
+		uif->ndirbuf = 0;
+		uif->adirbuf = 0;
+		uif->direof = 0;
 	}	
 	else {
 		int m = fsomode(omode & 3);
@@ -190,6 +198,7 @@ fsopen(Chan *c, int mode)
 			error(strerror(errno));
 	}
 	uif->offset = 0;
+	uif->nseq = 0;
 
 	c->offset = 0;
 	c->mode = omode;
@@ -246,11 +255,16 @@ fscreate(Chan *c, char *name, int mode, ulong perm)
 	c->qid = fsqid(&stbuf);
 	uif->fd = fd;
 	uif->dir = dir;
+	uif->dirbuf = nil;
+	uif->ndirbuf = 0;
+	uif->adirbuf = 0;
+	uif->direof = 0;
 	poperror();
 
 	free(uif->path);
 	uif->path = path;
 	uif->offset = 0;
+	uif->nseq = 0;
 	poperror();
 
 	c->offset = 0;
@@ -266,9 +280,10 @@ fsclose(Chan *c)
 
 	uif = c->aux;
 	if(c->flag & COPEN) {
-		if(c->qid.type & QTDIR)
+		if(c->qid.type & QTDIR){
 			closedir(uif->dir);
-		else
+			free(uif->dirbuf);
+		}else
 			close(uif->fd);
 		c->flag &= ~COPEN;
 		if(c->flag & CRCLOSE) {
@@ -280,11 +295,37 @@ fsclose(Chan *c)
 	free(uif);
 }
 
+/*
+ * Tell the host to read ahead once reads on c follow each
+ * other, and to stop when they jump about.  This is only
+ * advice: racing readers may confuse it, but not the data.
+ */
+static void
+fsreadahead(Ufsinfo *uif, vlong offset, long n)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+	if(offset == uif->offset){
+		if(uif->nseq++ == 2)
+			posix_fadvise(uif->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}else{
+		if(uif->nseq > 2)
+			posix_fadvise(uif->fd, 0, 0, POSIX_FADV_NORMAL);
+		uif->nseq = 0;
+	}
+#endif
+	uif->offset = offset+n;
+}
+
+/*
+ * Reads and writes give their offset to the host, so
+ * several may be under way on one chan at once.  Pipes
+ * and devices that cannot seek are read and written in turn.
+ */
 static long
 fsread(Chan *c, void *va, long n, vlong offset)
 {
-	int fd;
-	vlong r;
+	long r;
+	int e;
 	Ufsinfo *uif;
 
 /*print("fsread %s\n", chanpath(c));*/
@@ -292,60 +333,41 @@ fsread(Chan *c, void *va, long n, vlong offset)
 		return fsdirread(c, va, n, offset);
 
 	uif = c->aux;
-	qlock(&uif->oq);
-	if(waserror()) {
+	r = pread(uif->fd, va, n, offset);
+	if(r < 0 && errno == ESPIPE){
+		qlock(&uif->oq);
+		r = read(uif->fd, va, n);
+		e = errno;
 		qunlock(&uif->oq);
-		nexterror();
+		errno = e;
 	}
-	fd = uif->fd;
-	if(uif->offset != offset) {
-		r = lseek(fd, offset, 0);
-		if(r < 0)
-			error(strerror(errno));
-		uif->offset = offset;
-	}
-
-	n = read(fd, va, n);
-	if(n < 0)
+	if(r < 0)
 		error(strerror(errno));
+	fsreadahead(uif, offset, r);
 
-	uif->offset += n;
-	qunlock(&uif->oq);
-	poperror();
-
-	return n;
+	return r;
 }
 
 static long
 fswrite(Chan *c, void *va, long n, vlong offset)
 {
-	int fd;
-	vlong r;
+	long r;
+	int e;
 	Ufsinfo *uif;
 
 	uif = c->aux;
-	qlock(&uif->oq);
-	if(waserror()) {
+	r = pwrite(uif->fd, va, n, offset);
+	if(r < 0 && errno == ESPIPE){
+		qlock(&uif->oq);
+		r = write(uif->fd, va, n);
+		e = errno;
 		qunlock(&uif->oq);
-		nexterror();
+		errno = e;
 	}
-	fd = uif->fd;
-	if(uif->offset != offset) {
-		r = lseek(fd, offset, 0);
-		if(r < 0)
-			error(strerror(errno));
-		uif->offset = offset;
-	}
-
-	n = write(fd, va, n);
-	if(n < 0)
+	if(r < 0)
 		error(strerror(errno));
 
-	uif->offset += n;
-	qunlock(&uif->oq);
-	poperror();
-
-	return n;
+	return r;
 }
 
 static void
@@ -496,66 +518,35 @@ isdots(char *name)
 	return 0;
 }
 
-static int
-p9readdir(char *name, Ufsinfo *uif)
-{
-	struct dirent *de;
-	
-	if(uif->nextname[0]){
-		strcpy(name, uif->nextname);
-		uif->nextname[0] = 0;
-		return 1;
-	}
-
-	de = readdir(uif->dir);
-	if(de == NULL)
-		return 0;
-		
-	strcpy(name, de->d_name);
-	return 1;
-}
-
-static ulong
-fsdirread(Chan *c, uchar *va, int count, ulong offset)
+/*
+ * Read on in the directory until uif->dirbuf holds want bytes
+ * of entries or all of them.  Entries are stated relative to
+ * the open directory rather than by full path.
+ */
+static void
+fsdirfill(Chan *c, Ufsinfo *uif, ulong want)
 {
-	int i;
 	Dir d;
-	long n;
-	char de[NAME_MAX];
+	int n;
+	uchar *b;
+	struct dirent *de;
 	struct stat stbuf;
-	Ufsinfo *uif;
-
-/*print("fsdirread %s\n", chanpath(c));*/
-	i = 0;
-	uif = c->aux;
-
-	errno = 0;
-	if(uif->offset != offset) {
-		if(offset != 0)
-			error("bad offset in fsdirread");
-		uif->offset = offset;  /* sync offset */
-		uif->nextname[0] = 0;
-		rewinddir(uif->dir);
-	}
-
-	while(i+BIT16SZ < count) {
-		char *p;
 
-		if(!p9readdir(de, uif))
+	while(!uif->direof && uif->ndirbuf < want) {
+		if((de = readdir(uif->dir)) == NULL) {
+			uif->direof = 1;
 			break;
-
-		if(de[0]==0 || isdots(de))
+		}
+		if(de->d_name[0]==0 || isdots(de->d_name))
 			continue;
 
-		d.name = de;
-		p = catpath(uif->path, de);
-		if(stat(p, &stbuf) < 0) {
-			/* fprint(2, "dir: bad path %s\n", path); */
+		if(fstatat(dirfd(uif->dir), de->d_name, &stbuf, 0) < 0) {
+			/* fprint(2, "dir: bad entry %s\n", de->d_name); */
 			/* but continue... probably a bad symlink */
 			memset(&stbuf, 0, sizeof stbuf);
 		}
-		free(p);
 
+		d.name = de->d_name;
 		d.uid = eve;
 		d.gid = eve;
 		d.muid = eve;
@@ -566,15 +557,72 @@ fsdirread(Chan *c, uchar *va, int count, ulong offset)
 		d.length = stbuf.st_size;
 		d.type = 'U';
 		d.dev = c->dev;
-		n = convD2M(&d, (uchar*)va+i, count-i);
-		if(n == BIT16SZ){
-			strcpy(uif->nextname, de);
-			break;
+
+		n = sizeD2M(&d);
+		if(uif->ndirbuf+n > uif->adirbuf) {
+			b = realloc(uif->dirbuf, 2*uif->adirbuf+n+8192);
+			if(b == nil)
+				error(Enomem);
+			uif->dirbuf = b;
+			uif->adirbuf = 2*uif->adirbuf+n+8192;
 		}
-		i += n;
+		uif->ndirbuf += convD2M(&d, uif->dirbuf+uif->ndirbuf, n);
+	}
+}
+
+/* is offset where an entry in uif->dirbuf starts? */
+static int
+fsdiroff(Ufsinfo *uif, ulong offset)
+{
+	ulong o;
+
+	if(offset == uif->offset)
+		return offset <= uif->ndirbuf;
+	for(o = 0; o < offset && o+BIT16SZ <= uif->ndirbuf; )
+		o += BIT16SZ+GBIT16(uif->dirbuf+o);
+	return o == offset;
+}
+
+/*
+ * The entries are kept as they are read, so a read at an
+ * offset already seen is served again without going back
+ * to the host.  Reading from 0 again after the end starts over.
+ */
+static ulong
+fsdirread(Chan *c, uchar *va, int count, ulong offset)
+{
+	int i, n;
+	Ufsinfo *uif;
+
+/*print("fsdirread %s\n", chanpath(c));*/
+	uif = c->aux;
+	qlock(&uif->oq);
+	if(waserror()) {
+		qunlock(&uif->oq);
+		nexterror();
+	}
+
+	if(offset == 0 && uif->direof && uif->offset == uif->ndirbuf) {
+		rewinddir(uif->dir);
+		uif->ndirbuf = 0;
+		uif->direof = 0;
+		uif->offset = 0;
 	}
+
+	fsdirfill(c, uif, offset+count);
+	if(!fsdiroff(uif, offset))
+		error("bad offset in fsdirread");
+
+	for(i = 0; offset+i+BIT16SZ <= uif->ndirbuf; i += n) {
+		n = BIT16SZ+GBIT16(uif->dirbuf+offset+i);
+		if(i+n > count)
+			break;
+	}
+	memmove(va, uif->dirbuf+offset, i);
 /*print("got %d\n", i);*/
-	uif->offset += i;
+	uif->offset = offset+i;
+	qunlock(&uif->oq);
+	poperror();
 	return i;
 }
 
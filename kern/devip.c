@@ -240,6 +240,7 @@ void
 ipinit(void)
 {
 	osipinit();
+	csinit();
 
 	newproto("udp", S_UDP, 10);
 	newproto("tcp", S_TCP, 30);
@@ -812,6 +813,17 @@ cswrite(Chan *c, void *a, long n, vlong offset)
 	}
 	memmove(s, a, n);
 	s[n] = 0;
+	if(strcmp(s, "refresh") == 0){
+		csrefresh();
+		goto Out;
+	}
+	if(strcmp(s, "stats") == 0){
+		ns = malloc(READSTR);
+		if(ns == nil)
+			error(Enomem);
+		csprint(ns, ns+READSTR);
+		goto Set;
+	}
 	nf = getfields(s, f, nelem(f), 0, "!");
 	if(nf != 3)
 		error("can't translate");
@@ -828,7 +840,7 @@ cswrite(Chan *c, void *a, long n, vlong offset)
 			ips[0] = smprint("%I", ip);
 			nips = 1;
 		} else {
-			nips = so_gethostbyname(f[1], ips, nelem(ips));
+			nips = cslookup(f[1], ips, nelem(ips));
 			if(nips <= 0)
 				error("no translation for host found");
 		}
@@ -841,8 +853,10 @@ cswrite(Chan *c, void *a, long n, vlong offset)
 			ns = ips[0];
 		}
 	}
+Set:
 	free(c->aux);
 	c->aux = ns;
+Out:
 	poperror();
 	free(s);
 	return n;
@@ -14,3 +14,9 @@ int		so_recv(int, void*, int, int);
 int		so_accept(int, unsigned char*, unsigned short*);
 int		so_getservbyname(char*, char*, char*);
 int		so_gethostbyname(char*, char**, int);
+
+int		cslookup(char*, char**, int);
+char*		csprint(char*, char*);
+void		csrefresh(void);
+void		csinit(void);
+extern int	(*csresolve)(char*, char**, int);
@@ -15,13 +15,14 @@
  * connection.
  */
 
-#define MAXRPC	(IOHDRSZ+32768)
+#define MAXRPC	(IOHDRSZ+128*1024)
 #define MAXRPC0 (IOHDRSZ+8192)	/* maximum size of Tversion/Rversion pair */
 
 struct Mntrpc
 {
 	Chan*	c;		/* Channel for whom we are working */
 	Mntrpc*	list;		/* Free/pending list */
+	Mntrpc*	prev;		/* pending list */
 	Fcall	request;	/* Outgoing file system protocol message */
 	Fcall 	reply;		/* Incoming reply */
 	Mnt*	m;		/* Mount device during rpc */
@@ -33,9 +34,59 @@ struct Mntrpc
 
 enum
 {
-	TAGSHIFT = 5,
+	Nwindow = 8,	/* default Mnt.window */
+	Maxwindow = 32,
+	Maxdir = 256*1024,	/* largest listing cached */
+	Maxcacheio = 32*CBLOCK,	/* most read at once for cache.c */
+
+	TAGSHIFT = 8,	/* Mnt.tagrpc */
 	TAGMASK = (1<<TAGSHIFT)-1,
-	NMASK = (64*1024)>>TAGSHIFT,
+};
+
+/*
+ * Rpcs in flight on an open chan of an MCACHE mount (c->aux),
+ * in offset order: reads ahead of a sequential reader, or
+ * writes that have been sent but not answered (write-behind).
+ */
+typedef struct Mntwin Mntwin;
+struct Mntwin
+{
+	QLock	ql;
+	Rendez	z;		/* the rpcs here wake their waiter on this */
+	int	type;		/* Tread or Twrite */
+	int	n;
+	Mntrpc	*r[Maxwindow];
+	ulong	used;		/* bytes of r[0]'s reply already read */
+	vlong	next;		/* offset after the last read */
+	int	seq;		/* reads in a row starting at next */
+	char	err[ERRMAX];	/* a write that failed, for the next writer */
+};
+
+/*
+ * An unopened chan on an MCACHE mount walked to from the
+ * metadata cache has no fid on the server until it needs one;
+ * then mntundefer walks to it from base, which has.
+ */
+typedef struct Mntdefer Mntdefer;
+struct Mntdefer
+{
+	Chan	*base;
+	int	nname;
+	char	*name[MAXWELEM];
+};
+
+/*
+ * Reading an open directory of an MCACHE mount: its listing
+ * from the cache, or what has been read of it so far.
+ */
+typedef struct Mntdir Mntdir;
+struct Mntdir
+{
+	uchar	*buf;
+	long	n;
+	QLock	ql;
+	int	cached;		/* reads come from buf */
+	int	filling;	/* reads from the server are kept */
 };
 
 static struct Mntalloc
@@ -47,35 +98,77 @@ static struct Mntalloc
 	ulong	nrpcfree;
 	ulong	nrpcused;
 	ulong	id;
-	u32int	tagmask[NMASK];
+	int	tagnext;	/* lowest tag never handed out */
+	int	ntagfree;
+	ushort	tagfree[NOTAG];	/* tags given back */
 } mntalloc;
 
 static Chan*	mntchan(void);
 static Mnt*	mntchk(Chan*);
+static Mntdefer*	mntdefer(Chan*);
+static void	mntdeferfree(Chan*);
 static void	mntdirfix(uchar*, Chan*);
+static void	mntdirfree(Chan*);
+static long	mntdirread(Mnt*, Chan*, uchar*, long, vlong);
+static int	mntpaged(Chan*);
+static long	mntpageread(Mnt*, Chan*, uchar*, long, vlong);
 static Mntrpc*	mntflushalloc(Mntrpc*);
 static Mntrpc*	mntflushfree(Mnt*, Mntrpc*);
 static void	mntfree(Mntrpc*);
 static void	mntgate(Mnt*);
+static Metacache*	mntmeta(Mnt*, Chan*);
+static void	mntqadd(Mnt*, Mntrpc*);
+static void	mntqdel(Mnt*, Mntrpc*);
+static Mntrpc*	mntqlook(Mnt*, int);
 static void	mntqrm(Mnt*, Mntrpc*);
 static Mntrpc*	mntralloc(Chan*);
 static long	mntrdwr(int, Chan*, void*, long, vlong);
 static int	mntrpcread(Mnt*, Mntrpc*);
-static void	mountio(Mnt*, Mntrpc*);
+static void	mntundefer(Mnt*, Chan*);
+static int	mntwalkmeta(Mnt*, Metacache*, Chan*, Walkqid*, char**, int);
+static Mntwin*	mntwin(Mnt*, Chan*);
+static void	mntwinfree(Mnt*, Chan*, char*);
+static long	mntwinread(Mnt*, Chan*, Mntwin*, uchar*, long, vlong);
+static void	mntwinsync(Mnt*, Chan*);
+static long	mntwinwrite(Mnt*, Chan*, Mntwin*, uchar*, long, vlong);
+static void	mountio(Mnt*, Mntrpc*, int);
 static void	mountmux(Mnt*, Mntrpc*);
+static void	mountrecv(Mnt*, Mntrpc*);
+static void	mountreply(Mnt*, Mntrpc*);
 static void	mountrpc(Mnt*, Mntrpc*);
+static void	mountsend(Mnt*, Mntrpc*);
 static int	rpcattn(void*);
 
 char	Esbadstat[] = "invalid directory entry received from server";
 char	Enoversion[] = "version not established for mount channel";
 
+static int	mntwindow = Nwindow;
+static ulong	mntcachettl = 2000;
+static int	mntcachemem = 16;	/* MB */
 
 static void
 mntreset(void)
 {
+	char *s;
+	int n;
+
+	if((s = getenv("mntwindow")) != nil)
+		mntwindow = atoi(s);
+	if(mntwindow < 1)
+		mntwindow = 1;
+	if(mntwindow > Maxwindow)
+		mntwindow = Maxwindow;
+	if((s = getenv("mntcachettl")) != nil){
+		n = atoi(s);
+		mntcachettl = n < 0 ? 0 : n;
+	}
+	if((s = getenv("mntcachemem")) != nil){
+		n = atoi(s);
+		mntcachemem = n < 0 ? 0 : n;
+	}
+	cinit((vlong)mntcachemem*MB);
 	mntalloc.id = 1;
-	mntalloc.tagmask[0] = 1;			/* don't allow 0 as a tag */
-	mntalloc.tagmask[NMASK-1] = 0x80000000;		/* don't allow NOTAG */
+	mntalloc.tagnext = 1;		/* don't allow 0 as a tag */
 	fmtinstall('F', fcallfmt);
 	fmtinstall('D', dirfmt);
 /* We can't install %M since eipfmt does and is used in the kernel [sape] */
@@ -222,6 +315,9 @@ mntversion(Chan *c, char *version, int msize, int returnlen)
 	m->id = mntalloc.id++;
 	m->q = q;
 	m->msize = f.msize;
+	m->window = mntwindow;
+	m->cachehit = 0;
+	m->cachemiss = 0;
 	unlock(&mntalloc.lk);
 
 	if(returnlen > 0)
@@ -296,6 +392,43 @@ mntauth(Chan *c, char *spec)
 
 }
 
+/*
+ * Options for the mount at the front of spec, each ended by
+ * a space or the end of spec; the rest is the aname.
+ *	cache		as if mounted MCACHE
+ *	window=n	keep up to n reads or writes in flight on a
+ *			file, rather than $mntwindow
+ */
+static char*
+mntopts(Mnt *m, char *spec, int *flags)
+{
+	char *p;
+	long n;
+
+	if(spec == nil)
+		return nil;
+	for(;;){
+		if(strncmp(spec, "cache", 5) == 0 && (spec[5] == ' ' || spec[5] == 0)){
+			*flags |= MCACHE;
+			spec += 5;
+		}else if(strncmp(spec, "window=", 7) == 0 && spec[7] >= '0' && spec[7] <= '9'){
+			n = strtol(spec+7, &p, 10);
+			if(*p != ' ' && *p != 0)
+				break;
+			if(n < 1)
+				n = 1;
+			if(n > Maxwindow)
+				n = Maxwindow;
+			m->window = n;
+			spec = p;
+		}else
+			break;
+		while(*spec == ' ')
+			spec++;
+	}
+	return spec;
+}
+
 Chan*
 mntattach(Chan *c, Chan *ac, char *spec, int flags)
 {
@@ -312,6 +445,7 @@ mntattach(Chan *c, Chan *ac, char *spec, int flags)
 		if(m == nil)
 			error(Enoversion);
 	}
+	spec = mntopts(m, spec, &flags);
 
 	c = mntchan();
 	if(waserror()) {
@@ -382,6 +516,7 @@ mntwalk(Chan *c, Chan *nc, char **name, int nname)
 	Mnt *m;
 	Mntrpc *r;
 	Walkqid *wq;
+	Metacache *mc;
 
 	if(nc != nil)
 		print("mntwalk: nc != nil\n");
@@ -398,6 +533,14 @@ mntwalk(Chan *c, Chan *nc, char **name, int nname)
 
 	alloc = 0;
 	m = mntchk(c);
+	mc = nil;
+	if(nc == nil && (mc = mntmeta(m, c)) != nil){
+		if(mntwalkmeta(m, mc, c, wq, name, nname)){
+			poperror();
+			return wq;
+		}
+		mntundefer(m, c);
+	}
 	r = mntralloc(c);
 	if(nc == nil){
 		nc = devclone(c);
@@ -449,6 +592,8 @@ mntwalk(Chan *c, Chan *nc, char **name, int nname)
 	wq->nqid = r->reply.nwqid;
 	for(i=0; i<wq->nqid; i++)
 		wq->qid[i] = r->reply.wqid[i];
+	if(mc != nil)
+		metawalked(mc, &c->qid, name, wq->nqid, wq->qid);
 
     Return:
 	poperror();
@@ -457,15 +602,167 @@ mntwalk(Chan *c, Chan *nc, char **name, int nname)
 	return wq;
 }
 
+/*
+ * The cache of what c's mount has said, if c is on an
+ * MCACHE mount and the cache is not turned off.
+ */
+static Metacache*
+mntmeta(Mnt *m, Chan *c)
+{
+	Metacache *mc;
+
+	if((c->flag&CCACHE) == 0 || mntcachettl == 0)
+		return nil;
+	if(m->meta != nil)
+		return m->meta;
+	mc = metaalloc(mntcachettl);
+	lock(&m->lk);
+	if(m->meta == nil){
+		m->meta = mc;
+		mc = nil;
+	}
+	unlock(&m->lk);
+	metafree(mc);
+	return m->meta;
+}
+
+/* the walk still to be done for c, if it has no fid yet */
+static Mntdefer*
+mntdefer(Chan *c)
+{
+	if(c->flag&COPEN)
+		return nil;
+	return c->aux;
+}
+
+static void
+mntdeferfree(Chan *c)
+{
+	Mntdefer *d;
+
+	d = c->aux;
+	c->aux = nil;
+	cclose(d->base);
+	free(d);
+}
+
+/*
+ * If every name is in the cache, make wq->clone a chan
+ * that will be walked to from c, or from where c would be,
+ * when it is used.
+ */
+static int
+mntwalkmeta(Mnt *m, Metacache *mc, Chan *c, Walkqid *wq, char **name, int nname)
+{
+	Mntdefer *d, *od;
+	Chan *nc;
+	char *p, *e;
+	int i, n, len;
+
+	if(!metawalk(mc, &c->qid, name, nname, wq->qid))
+		return 0;
+	qlock(&m->deferlk);
+	n = 0;
+	if((od = mntdefer(c)) != nil)
+		n = od->nname;
+	if(n+nname > MAXWELEM){
+		qunlock(&m->deferlk);
+		return 0;
+	}
+	len = 0;
+	for(i=0; i<n; i++)
+		len += strlen(od->name[i])+1;
+	for(i=0; i<nname; i++)
+		len += strlen(name[i])+1;
+	d = smalloc(sizeof(Mntdefer)+len);
+	p = (char*)&d[1];
+	e = p+len;
+	for(i=0; i<n+nname; i++){
+		d->name[i] = p;
+		p = strecpy(p, e, i < n ? od->name[i] : name[i-n])+1;
+	}
+	d->nname = n+nname;
+	d->base = od != nil ? od->base : c;
+	incref(&d->base->ref);
+	qunlock(&m->deferlk);
+
+	nc = devclone(c);
+	nc->type = c->type;
+	nc->mchan = c->mchan;
+	incref(&c->mchan->ref);
+	nc->flag |= CCACHE;
+	nc->aux = d;
+	if(nname > 0)
+		nc->qid = wq->qid[nname-1];
+	wq->clone = nc;
+	wq->nqid = nname;
+	return 1;
+}
+
+/* give c the fid it was promised */
+static void
+mntundefer(Mnt *m, Chan *c)
+{
+	Mntdefer *d;
+	Mntrpc *r;
+
+	if(mntdefer(c) == nil)
+		return;
+	qlock(&m->deferlk);
+	if((d = mntdefer(c)) == nil){
+		qunlock(&m->deferlk);
+		return;
+	}
+	r = mntralloc(c);
+	if(waserror()){
+		mntfree(r);
+		qunlock(&m->deferlk);
+		nexterror();
+	}
+	r->request.type = Twalk;
+	r->request.fid = d->base->fid;
+	r->request.newfid = c->fid;
+	r->request.nwname = d->nname;
+	memmove(r->request.wname, d->name, d->nname*sizeof(char*));
+	mountrpc(m, r);
+	if(r->reply.nwqid != d->nname){
+		/* it's gone since it was cached */
+		if(m->meta != nil)
+			metaflush(m->meta, &c->qid, 1);
+		error(Enonexist);
+	}
+	if(d->nname > 0)
+		c->qid = r->reply.wqid[d->nname-1];
+	if(m->meta != nil)
+		metawalked(m->meta, &d->base->qid, d->name, d->nname, r->reply.wqid);
+	c->aux = nil;
+	poperror();
+	mntfree(r);
+	qunlock(&m->deferlk);
+	cclose(d->base);
+	free(d);
+}
+
 static int
 mntstat(Chan *c, uchar *dp, int n)
 {
 	Mnt *m;
 	Mntrpc *r;
+	Metacache *mc;
+	int ns;
 
 	if(n < BIT16SZ)
 		error(Eshortstat);
 	m = mntchk(c);
+	mntwinsync(m, c);
+	if((mc = mntmeta(m, c)) != nil && (ns = metastat(mc, &c->qid, dp, n)) > 0){
+		if(ns > BIT16SZ){
+			validstat(dp, ns);
+			mntdirfix(dp, c);
+		}
+		return ns;
+	}
+	mntundefer(m, c);
 	r = mntralloc(c);
 	if(waserror()) {
 		mntfree(r);
@@ -474,6 +771,8 @@ mntstat(Chan *c, uchar *dp, int n)
 	r->request.type = Tstat;
 	r->request.fid = c->fid;
 	mountrpc(m, r);
+	if(mc != nil)
+		metastated(mc, r->reply.stat, r->reply.nstat);
 
 	if(r->reply.nstat > n){
 		n = BIT16SZ;
@@ -494,8 +793,10 @@ mntopencreate(int type, Chan *c, char *name, int omode, ulong perm)
 {
 	Mnt *m;
 	Mntrpc *r;
+	Metacache *mc;
 
 	m = mntchk(c);
+	mntundefer(m, c);
 	r = mntralloc(c);
 	if(waserror()) {
 		mntfree(r);
@@ -510,7 +811,23 @@ mntopencreate(int type, Chan *c, char *name, int omode, ulong perm)
 	}
 	mountrpc(m, r);
 
+	if((mc = mntmeta(m, c)) != nil){
+		if(type == Tcreate){
+			metaflush(mc, &c->qid, 0);
+			metawalked(mc, &c->qid, &name, 1, &r->reply.qid);
+		}else
+			metaqid(mc, &r->reply.qid);
+		if(omode & (OTRUNC|ORCLOSE))
+			metaflush(mc, &r->reply.qid, (omode&ORCLOSE) != 0);
+	}
+
 	c->qid = r->reply.qid;
+	if(mntpaged(c)){
+		if(type == Tcreate || (omode&OTRUNC) != 0)
+			cdrop(c);
+		else
+			copen(c);
+	}
 	c->offset = 0;
 	c->mode = openmode(omode);
 	c->iounit = r->reply.iounit;
@@ -540,8 +857,24 @@ mntclunk(Chan *c, int t)
 {
 	Mnt *m;
 	Mntrpc *r;
+	char err[ERRMAX];
 
 	m = mntchk(c);
+	if(mntdefer(c) != nil){
+		/* no fid to clunk */
+		if(t == Tclunk){
+			mntdeferfree(c);
+			return;
+		}
+		if(waserror()){
+			mntdeferfree(c);
+			nexterror();
+		}
+		mntundefer(m, c);
+		poperror();
+	}
+	mntwinfree(m, c, err);
+	mntdirfree(c);
 	r = mntralloc(c);
 	if(waserror()) {
 		mntfree(r);
@@ -550,8 +883,14 @@ mntclunk(Chan *c, int t)
 	r->request.type = t;
 	r->request.fid = c->fid;
 	mountrpc(m, r);
+	if(t == Tremove && m->meta != nil && (c->flag&CCACHE) != 0)
+		metaflush(m->meta, &c->qid, 1);
+	if(t == Tremove && mntpaged(c))
+		cdrop(c);
 	mntfree(r);
 	poperror();
+	if(err[0] != '\0')
+		error(err);
 }
 
 void
@@ -559,11 +898,17 @@ muxclose(Mnt *m)
 {
 	Mnt *f, **l;
 	Mntrpc *r;
+	Metacache *mc;
+	ulong i;
 
 	while((r = m->queue) != nil){
 		m->queue = r->list;
 		mntfree(r);
 	}
+	for(i = 0; i < nelem(m->tagrpc); i++){
+		free(m->tagrpc[i]);
+		m->tagrpc[i] = nil;
+	}
 	m->id = 0;
 	free(m->version);
 	m->version = nil;
@@ -581,7 +926,10 @@ muxclose(Mnt *m)
 	}
 	m->list = mntalloc.mntfree;
 	mntalloc.mntfree = m;
+	mc = m->meta;
+	m->meta = nil;
 	unlock(&mntalloc.lk);
+	metafree(mc);
 }
 
 static void
@@ -603,6 +951,8 @@ mntwstat(Chan *c, uchar *dp, int n)
 	Mntrpc *r;
 
 	m = mntchk(c);
+	mntwinsync(m, c);
+	mntundefer(m, c);
 	r = mntralloc(c);
 	if(waserror()) {
 		mntfree(r);
@@ -613,6 +963,10 @@ mntwstat(Chan *c, uchar *dp, int n)
 	r->request.nstat = n;
 	r->request.stat = dp;
 	mountrpc(m, r);
+	if(m->meta != nil && (c->flag&CCACHE) != 0)
+		metaflush(m->meta, &c->qid, 1);
+	if(mntpaged(c))
+		cdrop(c);
 	poperror();
 	mntfree(r);
 	return n;
@@ -623,9 +977,16 @@ mntread(Chan *c, void *buf, long n, vlong off)
 {
 	uchar *p, *e;
 	int dirlen;
+	Mnt *m;
 
 	p = buf;
-	n = mntrdwr(Tread, c, p, n, off);
+	m = mntchk(c);
+	if((c->qid.type & QTDIR) != 0 && mntmeta(m, c) != nil)
+		n = mntdirread(m, c, p, n, off);
+	else if(mntpaged(c))
+		n = mntpageread(m, c, p, n, off);
+	else
+		n = mntrdwr(Tread, c, p, n, off);
 	if(c->qid.type & QTDIR) {
 		for(e = &p[n]; p+BIT16SZ < e; p += dirlen){
 			dirlen = BIT16SZ+GBIT16(p);
@@ -643,7 +1004,161 @@ mntread(Chan *c, void *buf, long n, vlong off)
 static long
 mntwrite(Chan *c, void *buf, long n, vlong off)
 {
-	return mntrdwr(Twrite, c, buf, n, off);
+	Mnt *m;
+
+	n = mntrdwr(Twrite, c, buf, n, off);
+	m = mntchk(c);
+	if(m->meta != nil && (c->flag&CCACHE) != 0)
+		metaflush(m->meta, &c->qid, 0);
+	if(mntpaged(c))
+		cwrite(c, n, off);
+	return n;
+}
+
+/* whether c's data goes through cache.c */
+static int
+mntpaged(Chan *c)
+{
+	return (c->flag&CCACHE) != 0 && (c->qid.type&(QTDIR|QTAPPEND|QTEXCL)) == 0 && cenabled();
+}
+
+/*
+ * Read c from cache.c; what it lacks is read from the server
+ * in whole CBLOCKs and kept.
+ */
+static long
+mntpageread(Mnt *m, Chan *c, uchar *buf, long n, vlong off)
+{
+	uchar *b;
+	long cnt, k, nr, nb;
+	vlong bo;
+
+	for(cnt = 0; cnt < n; cnt += k){
+		if((k = cread(c, buf+cnt, n-cnt, off)) >= 0){
+			lock(&m->lk);
+			m->cachehit += k;
+			unlock(&m->lk);
+			if(k == 0)
+				break;
+			off += k;
+			continue;
+		}
+		bo = off - off%CBLOCK;
+		nb = ROUND(off+n-cnt-bo, CBLOCK);
+		if(nb > Maxcacheio)
+			nb = Maxcacheio;
+		b = smalloc(nb);
+		if(waserror()){
+			free(b);
+			nexterror();
+		}
+		nr = mntrdwr(Tread, c, b, nb, bo);
+		cupdate(c, b, nr, bo, nr < nb);
+		k = 0;
+		if(nr > off-bo){
+			k = nr - (off-bo);
+			if(k > n-cnt)
+				k = n-cnt;
+			memmove(buf+cnt, b+(off-bo), k);
+		}
+		poperror();
+		free(b);
+		lock(&m->lk);
+		m->cachemiss += nr;
+		unlock(&m->lk);
+		off += k;
+		if(nr < nb && k < n-cnt){
+			cnt += k;
+			break;
+		}
+	}
+	return cnt;
+}
+
+/*
+ * Read directory c through the cache: a listing read from
+ * the start is kept, and a later open of the same version
+ * of the directory is answered from it.
+ */
+static long
+mntdirread(Mnt *m, Chan *c, uchar *buf, long n, vlong off)
+{
+	Mntdir *d;
+	uchar *p, *e;
+	long l, k;
+
+	if((d = c->aux) == nil){
+		d = smalloc(sizeof(Mntdir));
+		lock(&c->lk);
+		if(c->aux == nil){
+			c->aux = d;
+			d = nil;
+		}
+		unlock(&c->lk);
+		free(d);
+		d = c->aux;
+	}
+	qlock(&d->ql);
+	if(waserror()){
+		d->filling = 0;
+		qunlock(&d->ql);
+		nexterror();
+	}
+	if(off == 0){
+		free(d->buf);
+		d->buf = metadir(m->meta, &c->qid, &d->n);
+		d->cached = d->buf != nil;
+		d->filling = !d->cached;
+		if(!d->cached)
+			d->n = 0;
+	}
+	if(d->cached){
+		/* whole entries only */
+		if(off > d->n)
+			off = d->n;
+		p = d->buf+off;
+		e = d->buf+d->n;
+		for(l = 0; p+l+BIT16SZ <= e; l += k){
+			k = BIT16SZ+GBIT16(p+l);
+			if(l+k > n || p+l+k > e)
+				break;
+		}
+		if(l == 0 && p+BIT16SZ <= e)
+			error(Eshort);
+		memmove(buf, p, l);
+		n = l;
+	}else{
+		n = mntrdwr(Tread, c, buf, n, off);
+		if(d->filling){
+			if(off != d->n || d->n+n > Maxdir)
+				d->filling = 0;
+			else if(n == 0){
+				metadirred(m->meta, &c->qid, d->buf, d->n);
+				d->filling = 0;
+			}else if((p = realloc(d->buf, d->n+n)) == nil)
+				d->filling = 0;
+			else{
+				memmove(p+d->n, buf, n);
+				d->buf = p;
+				d->n += n;
+			}
+		}
+	}
+	poperror();
+	qunlock(&d->ql);
+	return n;
+}
+
+static void
+mntdirfree(Chan *c)
+{
+	Mntdir *d;
+
+	if((c->flag&COPEN) == 0 || (c->qid.type&QTDIR) == 0 || (d = c->aux) == nil)
+		return;
+	c->aux = nil;
+	free(d->buf);
+	free(d);
 }
 
 static long
@@ -651,10 +1166,27 @@ mntrdwr(int type, Chan *c, void *buf, long n, vlong off)
 {
 	Mnt *m;
  	Mntrpc *r;
+	Mntwin *w;
 	char *uba;
 	ulong cnt, nr, nreq;
 
 	m = mntchk(c);
+	if((w = mntwin(m, c)) != nil){
+		qlock(&w->ql);
+		if(waserror()){
+			w->seq = 0;
+			qunlock(&w->ql);
+			nexterror();
+		}
+		if(type == Tread)
+			n = mntwinread(m, c, w, buf, n, off);
+		else
+			n = mntwinwrite(m, c, w, buf, n, off);
+		poperror();
+		qunlock(&w->ql);
+		return n;
+	}
+
 	uba = buf;
 	cnt = 0;
 
@@ -692,15 +1224,279 @@ mntrdwr(int type, Chan *c, void *buf, long n, vlong off)
 	return cnt;
 }
 
+/*
+ * The window of chan c, if its i/o is pipelined: only on MCACHE
+ * mounts, where the server is taken to hold ordinary files, so
+ * that reading ahead or answering writes late does no harm.
+ */
+static Mntwin*
+mntwin(Mnt *m, Chan *c)
+{
+	Mntwin *w;
+
+	if((c->flag&(CCACHE|COPEN)) != (CCACHE|COPEN) || (c->qid.type&QTDIR) != 0 || m->window <= 1)
+		return nil;
+	if(c->aux != nil)
+		return c->aux;
+	w = smalloc(sizeof(Mntwin));
+	lock(&c->lk);
+	if(c->aux == nil){
+		c->aux = w;
+		w = nil;
+	}
+	unlock(&c->lk);
+	free(w);
+	return c->aux;
+}
+
 static void
-mountrpc(Mnt *m, Mntrpc *r)
+mntwinsend(Mnt *m, Chan *c, Mntwin *w, int type, vlong off, void *data, ulong count)
 {
-	int t;
+	Mntrpc *r;
 
-	r->reply.tag = 0;
-	r->reply.type = Tmax;	/* can't ever be a valid message type */
+	r = mntralloc(c);
+	r->request.type = type;
+	r->request.fid = c->fid;
+	r->request.offset = off;
+	r->request.data = data;
+	r->request.count = count;
+	r->z = &w->z;
+	if(waserror()){
+		mntqrm(m, r);
+		mntfree(r);
+		nexterror();
+	}
+	mountsend(m, r);
+	poperror();
+	w->type = type;
+	w->r[w->n++] = r;
+}
 
-	mountio(m, r);
+static void
+mntwinpop(Mntwin *w)
+{
+	mntfree(w->r[0]);
+	w->n--;
+	memmove(&w->r[0], &w->r[1], w->n*sizeof(w->r[0]));
+	w->used = 0;
+}
+
+/*
+ * Wait for the first rpc in the window and check its reply.
+ * One that failed is dropped.
+ */
+static Mntrpc*
+mntwinwait(Mnt *m, Mntwin *w)
+{
+	Mntrpc *r;
+
+	r = w->r[0];
+	if(waserror()){
+		mntwinpop(w);
+		nexterror();
+	}
+	mountio(m, r, 1);
+	mountreply(m, r);
+	if(r->request.type == Twrite && r->reply.count != r->request.count)
+		error("short write");
+	poperror();
+	return r;
+}
+
+/*
+ * Wait out the rpcs in the window.  Reads ahead are thrown
+ * away; the first write to fail is kept for mntwinerr.
+ */
+static void
+mntwindrain(Mnt *m, Mntwin *w)
+{
+	while(w->n > 0){
+		if(waserror()){
+			if(w->type == Twrite && w->err[0] == '\0')
+				strecpy(w->err, w->err+sizeof w->err, up->errstr);
+			continue;
+		}
+		mntwinwait(m, w);
+		poperror();
+		mntwinpop(w);
+	}
+}
+
+static void
+mntwinerr(Mntwin *w)
+{
+	char err[ERRMAX];
+
+	if(w->err[0] == '\0')
+		return;
+	strecpy(err, err+sizeof err, w->err);
+	w->err[0] = '\0';
+	error(err);
+}
+
+/*
+ * Keep up to m->window reads in flight: what the caller asked
+ * for, and once it has read sequentially, whole iounits beyond.
+ */
+static long
+mntwinread(Mnt *m, Chan *c, Mntwin *w, uchar *uba, long n, vlong off)
+{
+	Mntrpc *r;
+	vlong o;
+	ulong cnt, nr, k;
+	int eof;
+
+	if(w->n > 0)
+	if(w->type != Tread || off != w->r[0]->request.offset+w->used)
+		mntwindrain(m, w);
+	if(off == w->next && off != 0)
+		w->seq++;
+	else
+		w->seq = 0;
+
+	for(cnt = 0; n > 0; cnt += k){
+		while(w->n < m->window){
+			o = off;
+			if(w->n > 0){
+				r = w->r[w->n-1];
+				o = r->request.offset+r->request.count;
+			}
+			if(w->seq == 0 && o >= off+n)
+				break;
+			k = c->iounit;
+			if(w->seq == 0 && k > off+n-o)
+				k = off+n-o;
+			mntwinsend(m, c, w, Tread, o, nil, k);
+		}
+
+		r = mntwinwait(m, w);
+		nr = r->reply.count;
+		if(nr > r->request.count)
+			nr = r->request.count;
+		eof = nr < r->request.count;
+		k = nr - w->used;
+		if(k > (ulong)n)
+			k = n;
+		k = readblist(r->b, uba, k, w->used);
+		w->used += k;
+		uba += k;
+		off += k;
+		n -= k;
+		if(w->used == nr){
+			mntwinpop(w);
+			if(eof){
+				/* the rest of the window read past the end */
+				mntwindrain(m, w);
+				cnt += k;
+				break;
+			}
+		}
+	}
+	w->next = off;
+	return cnt;
+}
+
+/*
+ * Writes return once sent, up to m->window of them in flight,
+ * so their errors are deferred: a failed or short write is
+ * reported by the next write on the chan, or by a stat, wstat
+ * or clunk, which wait for all of them.  A write fails as soon
+ * as it sees an earlier one's failure, in the window or kept.
+ * close(2) discards clunk's error, as cclose does any, so a
+ * program that must know its writes landed stats the file
+ * before closing it.
+ */
+static long
+mntwinwrite(Mnt *m, Chan *c, Mntwin *w, uchar *uba, long n, vlong off)
+{
+	ulong cnt, k;
+
+	if(w->n > 0 && w->type != Twrite)
+		mntwindrain(m, w);
+	mntwinerr(w);
+	w->seq = 0;
+	for(cnt = 0; cnt < (ulong)n; cnt += k){
+		/* replies already in raise their errors here */
+		while(w->n > 0 && (w->n >= m->window || w->r[0]->done)){
+			mntwinwait(m, w);
+			mntwinpop(w);
+		}
+		k = n - cnt;
+		if(k > c->iounit)
+			k = c->iounit;
+		mntwinsend(m, c, w, Twrite, off+cnt, uba+cnt, k);
+	}
+	return n;
+}
+
+/* finish the i/o in flight on c before an rpc that should see it */
+static void
+mntwinsync(Mnt *m, Chan *c)
+{
+	Mntwin *w;
+
+	if((c->flag&COPEN) == 0 || (c->qid.type&QTDIR) != 0 || (w = c->aux) == nil)
+		return;
+	qlock(&w->ql);
+	if(waserror()){
+		qunlock(&w->ql);
+		nexterror();
+	}
+	mntwindrain(m, w);
+	mntwinerr(w);
+	poperror();
+	qunlock(&w->ql);
+}
+
+/* drain and free c's window, leaving in err any write's failure */
+static void
+mntwinfree(Mnt *m, Chan *c, char *err)
+{
+	Mntwin *w;
+
+	err[0] = '\0';
+	if((c->flag&COPEN) == 0 || (c->qid.type&QTDIR) != 0 || (w = c->aux) == nil)
+		return;
+	c->aux = nil;
+	mntwindrain(m, w);
+	strecpy(err, err+ERRMAX, w->err);
+	free(w);
+}
+
+/* for #c/mntcache */
+int
+mntcachestats(char *buf, int n)
+{
+	Mnt *m;
+	char *s, *e;
+
+	s = buf;
+	e = buf+n;
+	s = cprint(s, e);
+	lock(&mntalloc.lk);
+	for(m = mntalloc.list; m != nil; m = m->list){
+		if(m->meta == nil && m->cachehit+m->cachemiss == 0)
+			continue;
+		s = seprint(s, e, "%s", chanpath(m->c));
+		if(m->meta != nil)
+			s = metaprint(m->meta, s, e);
+		s = seprint(s, e, " data %llud %llud\n", m->cachehit, m->cachemiss);
+	}
+	unlock(&mntalloc.lk);
+	return s-buf;
+}
+
+static void
+mountrpc(Mnt *m, Mntrpc *r)
+{
+	mountio(m, r, 0);
+	mountreply(m, r);
+}
+
+static void
+mountreply(Mnt *m, Mntrpc *r)
+{
+	int t;
 
 	t = r->reply.type;
 	switch(t) {
@@ -719,12 +1515,13 @@ mountrpc(Mnt *m, Mntrpc *r)
 	}
 }
 
+/*
+ * Send r, unless it already has been, and wait for the reply.
+ * An interrupted rpc is flushed.
+ */
 static void
-mountio(Mnt *m, Mntrpc *r)
+mountio(Mnt *m, Mntrpc *r, int sent)
 {
-	Block *b;
-	int n;
-
 	while(waserror()) {
 		if(m->rip == up)
 			mntgate(m);
@@ -740,14 +1537,41 @@ mountio(Mnt *m, Mntrpc *r)
 			nexterror();
 		}
 		r = mntflushalloc(r);
+		sent = 0;
 		poperror();
 	}
+	if(!sent){
+		r->z = &up->sleep;
+		mountsend(m, r);
+	}
+	mountrecv(m, r);
+	poperror();
+	mntflushfree(m, r);
+}
 
+static void
+mountsend(Mnt *m, Mntrpc *r)
+{
+	Block *b;
+	Mntrpc **tb;
+	int n;
+
+	r->reply.tag = 0;
+	r->reply.type = Tmax;	/* can't ever be a valid message type */
+
+	n = r->request.tag>>TAGSHIFT;
+	if(m->tagrpc[n] == nil){
+		tb = smalloc((TAGMASK+1)*sizeof(Mntrpc*));
+		lock(&m->lk);
+		if(m->tagrpc[n] == nil){
+			m->tagrpc[n] = tb;
+			tb = nil;
+		}
+		unlock(&m->lk);
+		free(tb);
+	}
 	lock(&m->lk);
-	r->z = &up->sleep;
-	r->m = m;
-	r->list = m->queue;
-	m->queue = r;
+	mntqadd(m, r);
 	unlock(&m->lk);
 
 	/* Transmit a file system rpc */
@@ -766,19 +1590,27 @@ mountio(Mnt *m, Mntrpc *r)
 	b->wp += n;
 	poperror();
 	devtab[m->c->type]->bwrite(m->c, b, 0);
+}
 
-	/* Gate readers onto the mount point one at a time */
+static void
+mountrecv(Mnt *m, Mntrpc *r)
+{
+	/*
+	 * Gate readers onto the mount point one at a time.  Done
+	 * is seen under m->lk, which mountmux holds until its
+	 * wakeup is over, lest r->z go with its proc or window
+	 * while it is still being woken.
+	 */
 	for(;;) {
 		lock(&m->lk);
+		if(r->done){
+			unlock(&m->lk);
+			return;
+		}
 		if(m->rip == nil)
 			break;
 		unlock(&m->lk);
 		sleep(r->z, rpcattn, r);
-		if(r->done) {
-			poperror();
-			mntflushfree(m, r);
-			return;
-		}
 	}
 	m->rip = up;
 	unlock(&m->lk);
@@ -788,8 +1620,6 @@ mountio(Mnt *m, Mntrpc *r)
 		mountmux(m, r);
 	}
 	mntgate(m);
-	poperror();
-	mntflushfree(m, r);
 }
 
 static int
@@ -895,38 +1725,34 @@ mntgate(Mnt *m)
 static void
 mountmux(Mnt *m, Mntrpc *r)
 {
-	Mntrpc **l, *q;
+	Mntrpc *q;
 	Rendez *z;
 
 	lock(&m->lk);
-	l = &m->queue;
-	for(q = *l; q != nil; q = q->list) {
-		/* look for a reply to a message */
-		if(q->request.tag == r->reply.tag) {
-			*l = q->list;
-			if(q == r) {
-				q->done = 1;
-				unlock(&m->lk);
-				return;
-			}
-			/*
-			 * Completed someone else.
-			 * Trade pointers to receive buffer.
-			 */
-			q->reply = r->reply;
-			q->b = r->b;
-			r->b = nil;
-			z = q->z;
-			// coherence();
-			q->done = 1;
-			wakeup(z);
-			unlock(&m->lk);
-			return;
-		}
-		l = &q->list;
+	/* look for a reply to a message */
+	if((q = mntqlook(m, r->reply.tag)) == nil){
+		unlock(&m->lk);
+		print("unexpected reply tag %ud; type %d\n", r->reply.tag, r->reply.type);
+		return;
 	}
+	mntqdel(m, q);
+	if(q == r) {
+		q->done = 1;
+		unlock(&m->lk);
+		return;
+	}
+	/*
+	 * Completed someone else.
+	 * Trade pointers to receive buffer.
+	 */
+	q->reply = r->reply;
+	q->b = r->b;
+	r->b = nil;
+	z = q->z;
+	// coherence();
+	q->done = 1;
+	wakeup(z);
 	unlock(&m->lk);
-	print("unexpected reply tag %ud; type %d\n", r->reply.tag, r->reply.type);
 }
 
 /*
@@ -978,18 +1804,10 @@ mntflushfree(Mnt *m, Mntrpc *r)
 static int
 alloctag(void)
 {
-	int i, j;
-	u32int v;
-
-	for(i = 0; i < NMASK; i++){
-		v = mntalloc.tagmask[i];
-		if(v == (u32int)-1)
-			continue;
-		for(j = 0; (v & 1) != 0; j++)
-			v >>= 1;
-		mntalloc.tagmask[i] |= 1<<j;
-		return i<<TAGSHIFT | j;
-	}
+	if(mntalloc.ntagfree > 0)
+		return mntalloc.tagfree[--mntalloc.ntagfree];
+	if(mntalloc.tagnext < NOTAG)
+		return mntalloc.tagnext++;
 	panic("no friggin tags left");
 	return NOTAG;
 }
@@ -997,7 +1815,7 @@ alloctag(void)
 static void
 freetag(int t)
 {
-	mntalloc.tagmask[t>>TAGSHIFT] &= ~(1<<(t&TAGMASK));
+	mntalloc.tagfree[mntalloc.ntagfree++] = t;
 }
 
 static Mntrpc*
@@ -1052,22 +1870,59 @@ mntfree(Mntrpc *r)
 static void
 mntqrm(Mnt *m, Mntrpc *r)
 {
-	Mntrpc **l, *f;
-
 	lock(&m->lk);
 	r->done = 1;
-
-	l = &m->queue;
-	for(f = *l; f != nil; f = f->list) {
-		if(f == r) {
-			*l = r->list;
-			break;
-		}
-		l = &f->list;
-	}
+	if(mntqlook(m, r->request.tag) == r)
+		mntqdel(m, r);
 	unlock(&m->lk);
 }
 
+/*
+ * The pending list of m, indexed by tag in m->tagrpc.
+ * The caller holds m->lk.
+ */
+static void
+mntqadd(Mnt *m, Mntrpc *r)
+{
+	int t;
+
+	t = r->request.tag;
+	if(m->tagrpc[t>>TAGSHIFT] == nil)
+		panic("mntqadd: no tag block");
+	m->tagrpc[t>>TAGSHIFT][t&TAGMASK] = r;
+	r->m = m;
+	r->prev = nil;
+	r->list = m->queue;
+	if(m->queue != nil)
+		m->queue->prev = r;
+	m->queue = r;
+}
+
+static void
+mntqdel(Mnt *m, Mntrpc *r)
+{
+	int t;
+
+	t = r->request.tag;
+	m->tagrpc[t>>TAGSHIFT][t&TAGMASK] = nil;
+	if(r->prev != nil)
+		r->prev->list = r->list;
+	else
+		m->queue = r->list;
+	if(r->list != nil)
+		r->list->prev = r->prev;
+}
+
+static Mntrpc*
+mntqlook(Mnt *m, int t)
+{
+	Mntrpc **b;
+
+	if((b = m->tagrpc[t>>TAGSHIFT]) == nil)
+		return nil;
+	return b[t&TAGMASK];
+}
+
 static Mnt*
 mntchk(Chan *c)
 {
@@ -21,6 +21,8 @@ enum {
 	MaxCipherRecLen	= MaxRecLen + 2048,
 	RecHdrLen	= 5,
 	MaxMacLen	= SHA2_256dlen,
+	MaxHeld		= 4*(MaxCipherRecLen + RecHdrLen),	/* records held for one write */
+	MaxCoalesce	= 100000,	/* µs */
 
 	/* protocol versions we can accept */
 	SSL3Version	= 0x0300,
@@ -145,6 +147,22 @@ struct TlsRec
 	/* output side */
 	OneWay		out;
 
+	/*
+	 * write coalescing, under out.io: application data is
+	 * put in records in held, sealed but for the last, for
+	 * up to coalesce µs or until held fills, then written
+	 * at once by whoever comes first, the writer or this
+	 * connection's flusher.
+	 */
+	int		coalesce;	/* µs; 0 writes each record at once */
+	Block		*held;
+	uchar		*hrec;		/* header of the last record in held */
+	char		hqueued;	/* for the flusher */
+	char		hproc;		/* the flusher is running */
+	char		hgone;		/* the flusher is to exit */
+	Rendez		hr;		/* the flusher sleeps */
+	Rendez		hdone;		/* unhold waits for it to exit */
+
 	/* protections */
 	char		*user;
 	int		perm;
@@ -238,6 +256,8 @@ static void	put24(uchar *p, int);
 static void	put16(uchar *p, int);
 static int	get16(uchar *p);
 static void	tlsSetState(TlsRec *tr, int new, int old);
+static void	flushheld(TlsRec*);
+static void	unhold(TlsRec*);
 static void	rcvAlert(TlsRec *tr, int err);
 static void	sendAlert(TlsRec *tr, int err);
 static void	rcvError(TlsRec *tr, int err, char *msg, ...);
@@ -582,6 +602,7 @@ tlsclose(Chan *c)
 		tlsdevs[CONV(c->qid)] = nil;
 		unlock(&tdlock);
 
+		unhold(tr);
 		if(tr->c != nil && !waserror()){
 			checkstate(tr, 0, SOpen|SHandshake|SRClose);
 			sendAlert(tr, ECloseNotify);
@@ -590,6 +611,8 @@ tlsclose(Chan *c)
 		tlshangup(tr);
 		if(tr->c != nil)
 			cclose(tr->c);
+		if(tr->held != nil)
+			freeb(tr->held);
 		freeSec(tr->in.sec);
 		freeSec(tr->in.new);
 		freeSec(tr->out.sec);
@@ -685,7 +708,11 @@ regurgitate(TlsRec *s, uchar *p, int n)
 }
 
 /*
- *  remove at most n bytes from the queue
+ *  remove at most n bytes from the queue.
+ *  if the first block holds them, it is handed back
+ *  as it is, less what follows, when that is the
+ *  smaller copy; a record is then decrypted where it
+ *  was read.
  */
 static Block*
 qgrab(Block **l, int n)
@@ -699,6 +726,17 @@ qgrab(Block **l, int n)
 		b->next = nil;
 		return b;
 	}
+	i = BLEN(b) - n;
+	if(i > 0 && i < n){
+		bb = allocb(i);
+		memmove(bb->wp, b->rp + n, i);
+		bb->wp += i;
+		bb->next = b->next;
+		*l = bb;
+		b->wp = b->rp + n;
+		b->next = nil;
+		return b;
+	}
 
 	i = 0;
 	for(bb = b; bb != nil && i < n; bb = bb->next)
@@ -1188,6 +1226,8 @@ tlsread(Chan *c, void *a, long n, vlong off)
 			s = seprint(s, e, "EncOut: %s\nHashOut: %s\n", tr->out.sec->encalg, tr->out.sec->hashalg);
 		if(tr->out.new != nil)
 			s = seprint(s, e, "NewEncOut: %s\nNewHashOut: %s\n", tr->out.new->encalg, tr->out.new->hashalg);
+		if(tr->coalesce > 0)
+			s = seprint(s, e, "Coalesce: %d\n", tr->coalesce);
 		if(tr->c != nil)
 			seprint(s, e, "Chan: %s\n", chanpath(tr->c));
 		qunlock(&tr->in.seclock);
@@ -1241,6 +1281,250 @@ tlsread(Chan *c, void *a, long n, vlong off)
 	return n;
 }
 
+/*
+ *  room needed in a record besides the data:
+ *  ivlen in front of it, pad after.
+ */
+static void
+recspace(TlsRec *tr, Secret *sec, int *ivlen, int *pad)
+{
+	*ivlen = 0;
+	*pad = 0;
+	if(sec != nil){
+		*pad = sec->maclen + sec->block;
+		*ivlen = sec->recivlen;
+		if(tr->version >= TLS11Version){
+			if(*ivlen == 0)
+				*ivlen = sec->block;
+		}
+	}
+}
+
+/*
+ *  seal the n bytes at p+RecHdrLen+ivlen as a record,
+ *  with its header at p; returns the length of the whole.
+ *  must be called with tr->out.seclock held
+ */
+static int
+sealrec(TlsRec *tr, int type, uchar *p, int n, int ivlen)
+{
+	uchar aad[8+RecHdrLen];
+	int aadlen;
+	Secret *sec;
+
+	p[0] = type;
+	put16(p+1, tr->version);
+	put16(p+3, n);
+
+	sec = tr->out.sec;
+	if(sec != nil){
+		aadlen = (*tr->packAAD)(tr->out.seq++, p, aad);
+		if(sec->aead_enc != nil)
+			n = (*sec->aead_enc)(sec, aad, aadlen, p + RecHdrLen, p + RecHdrLen + ivlen, n) + ivlen;
+		else {
+			if(ivlen > 0)
+				prng(p + RecHdrLen, ivlen);
+			packMac(sec, aad, aadlen, p + RecHdrLen + ivlen, n, p + RecHdrLen + ivlen + n);
+			n = (*sec->enc)(sec, p + RecHdrLen, ivlen + n + sec->maclen);
+		}
+
+		/* update length */
+		put16(p+3, n);
+	}
+	return RecHdrLen + n;
+}
+
+/*
+ *  write the records held.
+ *  must be called with tr->out.io held
+ */
+static void
+flushheld(TlsRec *tr)
+{
+	OneWay *out;
+	Block *b;
+	int ivlen, pad;
+
+	out = &tr->out;
+	if(waserror()){
+		qunlock(&out->seclock);
+		nexterror();
+	}
+	qlock(&out->seclock);
+	b = tr->held;
+	if(b != nil && tr->hrec != nil){
+		recspace(tr, out->sec, &ivlen, &pad);
+		b->wp = tr->hrec + sealrec(tr, RApplication, tr->hrec, b->wp - (tr->hrec + RecHdrLen + ivlen), ivlen);
+	}
+	tr->held = nil;
+	tr->hrec = nil;
+	qunlock(&out->seclock);
+	poperror();
+	if(b == nil)
+		return;
+
+	if(waserror()){
+		if(strcmp(up->errstr, "interrupted") != 0)
+			tlsError(tr, "channel error");
+		nexterror();
+	}
+	devtab[tr->c->type]->bwrite(tr->c, b, 0);
+	poperror();
+}
+
+static Lock	hlock;	/* hqueued, hproc, hgone */
+
+static int
+flushwork(void *a)
+{
+	TlsRec *tr;
+
+	tr = a;
+	return tr->hqueued || tr->hgone;
+}
+
+/*
+ *  write what tr holds, its delay after the first
+ *  was queued.  each connection that holds data has
+ *  its own flusher, so a peer that is slow to take
+ *  its records only holds up its own.
+ */
+static void
+tlsflusher(void *a)
+{
+	TlsRec *tr;
+
+	tr = a;
+	for(;;){
+		while(waserror())
+			;
+		sleep(&tr->hr, flushwork, tr);
+		poperror();
+		if(tr->hgone)
+			break;
+		if(tr->coalesce > 0)
+			osusleep(tr->coalesce);
+
+		lock(&hlock);
+		tr->hqueued = 0;
+		unlock(&hlock);
+
+		qlock(&tr->out.io);
+		if(!waserror()){
+			checkstate(tr, 0, SHandshake|SOpen|SRClose);
+			flushheld(tr);
+			poperror();
+		}
+		if(tr->held != nil){
+			freeb(tr->held);
+			tr->held = nil;
+			tr->hrec = nil;
+		}
+		qunlock(&tr->out.io);
+	}
+
+	lock(&hlock);
+	tr->hproc = 0;
+	wakeup(&tr->hdone);
+	unlock(&hlock);
+	pexit("", 0);
+}
+
+static int
+nothproc(void *a)
+{
+	return !((TlsRec*)a)->hproc;
+}
+
+/*
+ *  tr is going away: stop its flusher
+ */
+static void
+unhold(TlsRec *tr)
+{
+	lock(&hlock);
+	tr->hgone = 1;
+	unlock(&hlock);
+	wakeup(&tr->hr);
+
+	while(waserror())
+		;
+	sleep(&tr->hdone, nothproc, tr);
+	poperror();
+
+	/* until wakeup is done with tr->hdone */
+	lock(&hlock);
+	unlock(&hlock);
+}
+
+/*
+ *  put b's data in the records held, writing them
+ *  whenever held fills, and leave the rest to the flusher.
+ *  must be called with tr->out.io held
+ */
+static void
+hold(TlsRec *tr, Block *b)
+{
+	OneWay *out;
+	Block *h;
+	int n, room, ivlen, pad, start;
+
+	out = &tr->out;
+	while(BLEN(b) > 0){
+		if(waserror()){
+			qunlock(&out->seclock);
+			nexterror();
+		}
+		qlock(&out->seclock);
+		recspace(tr, out->sec, &ivlen, &pad);
+		h = tr->held;
+		room = 0;
+		if(tr->hrec != nil){
+			room = MaxRecLen - (h->wp - (tr->hrec + RecHdrLen + ivlen));
+			if(room > h->lim - h->wp - pad)
+				room = h->lim - h->wp - pad;
+			if(room <= 0){
+				h->wp = tr->hrec + sealrec(tr, RApplication, tr->hrec, h->wp - (tr->hrec + RecHdrLen + ivlen), ivlen);
+				tr->hrec = nil;
+			}
+		}
+		if(tr->hrec == nil){
+			room = BLEN(b);
+			if(room > MaxRecLen)
+				room = MaxRecLen;
+			if(h != nil && h->lim - h->wp < RecHdrLen + ivlen + room + pad){
+				qunlock(&out->seclock);
+				poperror();
+				flushheld(tr);
+				continue;
+			}
+			if(h == nil)
+				tr->held = h = allocb(MaxHeld);
+			tr->hrec = h->wp;
+			h->wp += RecHdrLen + ivlen;
+		}
+		n = BLEN(b);
+		if(n > room)
+			n = room;
+		memmove(h->wp, b->rp, n);
+		h->wp += n;
+		b->rp += n;
+		qunlock(&out->seclock);
+		poperror();
+	}
+
+	if(tr->held == nil)
+		return;
+	lock(&hlock);
+	tr->hqueued = 1;
+	start = !tr->hproc;
+	tr->hproc = 1;
+	unlock(&hlock);
+	if(start)
+		kproc("tlsflush", tlsflusher, tr);
+	wakeup(&tr->hr);
+}
+
 /*
  *  write a block in tls records
  */
@@ -1249,9 +1533,9 @@ tlsrecwrite(TlsRec *tr, int type, Block *b)
 {
 	Block *volatile bb;
 	Block *nb;
-	uchar *p, aad[8+RecHdrLen];
+	uchar *p;
 	OneWay *volatile out;
-	int n, ivlen, maclen, aadlen, pad, ok;
+	int n, ivlen, pad, ok;
 	Secret *sec;
 
 	out = &tr->out;
@@ -1276,6 +1560,15 @@ if(tr->debug)pdump(BLEN(b), b->rp, "sent:");
 	while(bb != nil){
 		checkstate(tr, type != RApplication, ok);
 
+		if(type == RApplication && tr->coalesce > 0){
+			hold(tr, bb);
+			freeb(bb);
+			bb = nil;
+			break;
+		}
+		if(tr->held != nil)
+			flushheld(tr);
+
 		/*
 		 * get at most one maximal record's input,
 		 * with padding on the front for header and
@@ -1286,19 +1579,8 @@ if(tr->debug)pdump(BLEN(b), b->rp, "sent:");
 			nexterror();
 		}
 		qlock(&out->seclock);
-		maclen = 0;
-		pad = 0;
-		ivlen = 0;
 		sec = out->sec;
-		if(sec != nil){
-			maclen = sec->maclen;
-			pad = maclen + sec->block;
-			ivlen = sec->recivlen;
-			if(tr->version >= TLS11Version){
-				if(ivlen == 0)
-					ivlen = sec->block;
-			}
-		}
+		recspace(tr, sec, &ivlen, &pad);
 		n = BLEN(bb);
 		if(n > MaxRecLen){
 			n = MaxRecLen;
@@ -1318,25 +1600,7 @@ if(tr->debug)pdump(BLEN(b), b->rp, "sent:");
 		}
 
 		p = nb->rp;
-		p[0] = type;
-		put16(p+1, tr->version);
-		put16(p+3, n);
-
-		if(sec != nil){
-			aadlen = (*tr->packAAD)(out->seq++, p, aad);
-			if(sec->aead_enc != nil)
-				n = (*sec->aead_enc)(sec, aad, aadlen, p + RecHdrLen, p + RecHdrLen + ivlen, n) + ivlen;
-			else {
-				if(ivlen > 0)
-					prng(p + RecHdrLen, ivlen);
-				packMac(sec, aad, aadlen, p + RecHdrLen + ivlen, n, p + RecHdrLen + ivlen + n);
-				n = (*sec->enc)(sec, p + RecHdrLen, ivlen + n + maclen);
-			}
-			nb->wp = p + RecHdrLen + n;
-
-			/* update length */
-			put16(p+3, n);
-		}
+		nb->wp = p + sealrec(tr, type, p, n, ivlen);
 		if(type == RChangeCipherSpec){
 			if(out->new == nil)
 				error("change cipher without a new cipher");
@@ -1578,6 +1842,7 @@ tlswrite(Chan *c, void *a, long n, vlong off)
 	Block *volatile b;
 	Cmdbuf *volatile cb;
 	uint m;
+	long us;
 	int ty;
 	char *p, *e;
 	uchar *volatile x;
@@ -1765,6 +2030,15 @@ tlswrite(Chan *c, void *a, long n, vlong off)
 		tr->state = SOpen;
 		unlock(&tr->statelk);
 		tr->opened = 1;
+	}else if(strcmp(cb->f[0], "coalesce") == 0){
+		if(cb->nf != 2)
+			error("usage: coalesce usec");
+		us = strtol(cb->f[1], nil, 0);
+		if(us < 0)
+			error(Ebadarg);
+		if(us > MaxCoalesce)
+			error("coalesce delay too long");
+		tr->coalesce = us;
 	}else if(strcmp(cb->f[0], "alert") == 0){
 		if(cb->nf != 2)
 			error("usage: alert n");
@@ -0,0 +1,145 @@
+#include	"u.h"
+#include	"lib.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	"error.h"
+
+#include	<draw.h>
+#include	<memdraw.h>
+
+/*
+ * Procs to run the bands of large draws (see memimagedraw).
+ * The drawing proc takes bands too and waits for the rest.
+ * $drawprocs sets the number of procs, 0 to draw serially;
+ * $drawbandmin the fewest pixels worth a band.
+ */
+
+enum {
+	Maxband = 8,	/* including the caller; draw.c has 10 Dbufs */
+};
+
+typedef struct Bandproc Bandproc;
+struct Bandproc
+{
+	Rendez	r;
+};
+
+static struct
+{
+	QLock	q;	/* one banded draw at a time */
+	Lock	lk;
+	void	(*fn)(void*, int);
+	void	*arg;
+	int	n;
+	int	next;	/* next band to take */
+	int	left;	/* bands not finished */
+	Rendez	done;
+	int	nproc;
+	Bandproc	proc[Maxband-1];
+} band;
+
+static int
+takeband(void)
+{
+	int i;
+
+	lock(&band.lk);
+	i = -1;
+	if(band.next < band.n)
+		i = band.next++;
+	unlock(&band.lk);
+	return i;
+}
+
+static void
+runbands(void)
+{
+	int i, left;
+
+	while((i = takeband()) >= 0){
+		(*band.fn)(band.arg, i);
+		lock(&band.lk);
+		left = --band.left;
+		unlock(&band.lk);
+		if(left == 0)
+			wakeup(&band.done);
+	}
+}
+
+static int
+bandready(void *a)
+{
+	USED(a);
+	return band.next < band.n;
+}
+
+static int
+bandsdone(void *a)
+{
+	USED(a);
+	return band.left == 0;
+}
+
+static void
+bandproc(void *a)
+{
+	Bandproc *p;
+
+	p = a;
+	for(;;){
+		sleep(&p->r, bandready, nil);
+		runbands();
+	}
+}
+
+static void
+drawbandrun(void (*fn)(void*, int), void *arg, int n)
+{
+	int i;
+
+	qlock(&band.q);
+	lock(&band.lk);
+	band.fn = fn;
+	band.arg = arg;
+	band.n = n;
+	band.next = 0;
+	band.left = n;
+	unlock(&band.lk);
+	for(i=0; i<band.nproc && i<n-1; i++)
+		wakeup(&band.proc[i].r);
+	runbands();
+
+	/* the bands use arg; we cannot leave early on a note */
+	while(waserror())
+		;
+	sleep(&band.done, bandsdone, nil);
+	poperror();
+
+	lock(&band.lk);
+	band.n = 0;
+	band.next = 0;
+	unlock(&band.lk);
+	qunlock(&band.q);
+}
+
+void
+drawbandinit(void)
+{
+	char *s;
+	int i, n;
+
+	n = osncpu()-1;
+	if((s = getenv("drawprocs")) != nil)
+		n = atoi(s);
+	if((s = getenv("drawbandmin")) != nil && atoi(s) > 0)
+		memdrawbandmin = atoi(s);
+	if(n > Maxband-1)
+		n = Maxband-1;
+	for(i=0; i<n; i++)
+		kproc("drawband", bandproc, &band.proc[i]);
+	band.nproc = n;
+	if(n > 0){
+		memdrawnband = n+1;
+		memdrawbandfn = drawbandrun;
+	}
+}
@@ -1,5 +1,6 @@
 #define	ROUND(s, sz)	(((s)+((sz)-1))&~((sz)-1))
 
+extern int		(*aanstats)(char*, int);
 Block*		adjustblock(Block*, int);
 Block*		allocb(int);
 int		blocklen(Block*);
@@ -17,6 +18,14 @@ void		chanrec(Mnt*);
 void		checkb(Block*, char*);
 Chan*		cclone(Chan*);
 void		cclose(Chan*);
+void		cdrop(Chan*);
+int		cenabled(void);
+void		cinit(vlong);
+void		copen(Chan*);
+char*		cprint(char*, char*);
+long		cread(Chan*, uchar*, long, vlong);
+void		cupdate(Chan*, uchar*, long, vlong, int);
+void		cwrite(Chan*, long, vlong);
 char*	clipread(void);
 int		clipwrite(char*);
 void		closeegrp(Egrp*);
@@ -99,8 +108,20 @@ Cmdtab*		lookupcmd(Cmdbuf*, Cmdtab*, int);
 void*		mallocz(ulong, int);
 #define		malloc kmalloc
 void*		malloc(ulong);
+Metacache*	metaalloc(ulong);
+uchar*		metadir(Metacache*, Qid*, long*);
+void		metadirred(Metacache*, Qid*, uchar*, long);
+void		metaflush(Metacache*, Qid*, int);
+void		metafree(Metacache*);
+char*		metaprint(Metacache*, char*, char*);
+void		metaqid(Metacache*, Qid*);
+int		metastat(Metacache*, Qid*, uchar*, int);
+void		metastated(Metacache*, uchar*, int);
+int		metawalk(Metacache*, Qid*, char**, int, Qid*);
+void		metawalked(Metacache*, Qid*, char**, int, Qid*);
 void		mkqid(Qid*, vlong, ulong, int);
 Chan*		mntauth(Chan*, char*);
+int		mntcachestats(char*, int);
 void		mntdump(void);
 long		mntversion(Chan*, char*, int, int);
 Chan*		mntattach(Chan*, Chan*, char*, int);
@@ -219,6 +240,8 @@ void		wlock(RWlock*);
 void		wunlock(RWlock*);
 void		osyield(void);
 void		osmsleep(int);
+void		osusleep(int);
+int		osncpu(void);
 ulong	ticks(void);
 void	osproc(Proc*);
 void	osnewproc(Proc*);
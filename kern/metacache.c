@@ -0,0 +1,458 @@
+#include	"u.h"
+#include	"lib.h"
+#include	"dat.h"
+#include	"fns.h"
+#include	"error.h"
+
+/*
+ * What an MCACHE mount has said about its files: the qids
+ * names walk to, stat results and directory listings, kept
+ * by qid.path for ttl ms.  All a node holds is forgotten when
+ * the server shows its qid with another version, or when a
+ * local change (wstat, create, remove, write) is flushed.
+ */
+
+enum
+{
+	Nhash = 256,
+	Maxnode = 8192,	/* then start over */
+
+	Cwalk = 0,
+	Cstat,
+	Cdir,
+	Ncount,
+};
+
+typedef struct Mname Mname;
+typedef struct Mnode Mnode;
+
+struct Mname
+{
+	Mname	*next;
+	Qid	qid;
+	ulong	time;
+	char	*name;
+};
+
+struct Mnode
+{
+	Mnode	*hash;
+	Qid	qid;
+	int	hasparent;
+	uvlong	parent;	/* qid.path of the directory walked from */
+	Mname	*names;	/* walks from this directory */
+	uchar	*stat;
+	int	nstat;
+	ulong	stime;
+	uchar	*dir;
+	long	ndir;
+	ulong	dtime;
+};
+
+struct Metacache
+{
+	Lock	lk;
+	ulong	ttl;
+	Mnode	*hash[Nhash];
+	int	nnode;
+	ulong	hit[Ncount];
+	ulong	miss[Ncount];
+};
+
+static char *cname[Ncount] = {
+[Cwalk]	"walk",
+[Cstat]	"stat",
+[Cdir]	"dir",
+};
+
+static int
+fresh(Metacache *mc, ulong t)
+{
+	return ticks()-t < mc->ttl;
+}
+
+/* n's stat and listing */
+static void
+stale(Mnode *n)
+{
+	free(n->stat);
+	n->stat = nil;
+	n->nstat = 0;
+	free(n->dir);
+	n->dir = nil;
+	n->ndir = 0;
+}
+
+static void
+forget(Mnode *n)
+{
+	Mname *nm;
+
+	while((nm = n->names) != nil){
+		n->names = nm->next;
+		free(nm);
+	}
+	stale(n);
+}
+
+static void
+clear(Metacache *mc)
+{
+	Mnode *n;
+	int i;
+
+	for(i=0; i<Nhash; i++){
+		while((n = mc->hash[i]) != nil){
+			mc->hash[i] = n->hash;
+			forget(n);
+			free(n);
+		}
+	}
+	mc->nnode = 0;
+}
+
+static Mnode*
+lookup(Metacache *mc, uvlong path)
+{
+	Mnode *n;
+
+	for(n = mc->hash[path%Nhash]; n != nil; n = n->hash)
+		if(n->qid.path == path)
+			return n;
+	return nil;
+}
+
+/* start over when full; done before any node is held */
+static void
+trim(Metacache *mc)
+{
+	if(mc->nnode >= Maxnode)
+		clear(mc);
+}
+
+/*
+ * The node for q, made if need be; nil if out of memory.
+ * Another version of q makes what the node held stale.
+ */
+static Mnode*
+seen(Metacache *mc, Qid *q)
+{
+	Mnode *n;
+
+	if((n = lookup(mc, q->path)) != nil){
+		if(n->qid.vers != q->vers || n->qid.type != q->type){
+			forget(n);
+			n->qid = *q;
+		}
+		return n;
+	}
+	if((n = malloc(sizeof(Mnode))) == nil)
+		return nil;
+	n->qid = *q;
+	n->hash = mc->hash[q->path%Nhash];
+	mc->hash[q->path%Nhash] = n;
+	mc->nnode++;
+	return n;
+}
+
+static void
+addname(Mnode *d, char *name, int len, Qid *q)
+{
+	Mname *nm, **l;
+
+	for(l = &d->names; (nm = *l) != nil; l = &nm->next)
+		if(strncmp(nm->name, name, len) == 0 && nm->name[len] == '\0'){
+			*l = nm->next;
+			free(nm);
+			break;
+		}
+	if((nm = malloc(sizeof(Mname)+len+1)) == nil)
+		return;
+	nm->name = (char*)&nm[1];
+	memmove(nm->name, name, len);
+	nm->name[len] = '\0';
+	nm->qid = *q;
+	nm->time = ticks();
+	nm->next = d->names;
+	d->names = nm;
+}
+
+static void
+setparent(Metacache *mc, Qid *q, uvlong parent)
+{
+	Mnode *n;
+
+	if((n = seen(mc, q)) != nil){
+		n->hasparent = 1;
+		n->parent = parent;
+	}
+}
+
+static void
+setstat(Mnode *n, uchar *stat, int len)
+{
+	free(n->stat);
+	n->nstat = 0;
+	if((n->stat = malloc(len)) == nil)
+		return;
+	memmove(n->stat, stat, len);
+	n->nstat = len;
+	n->stime = ticks();
+}
+
+/* the qid in a stat entry; see convM2D */
+static void
+statqid(uchar *p, Qid *q)
+{
+	p += BIT16SZ+BIT16SZ+BIT32SZ;
+	q->type = p[0];
+	q->vers = GBIT32(p+BIT8SZ);
+	q->path = GBIT64(p+BIT8SZ+BIT32SZ);
+}
+
+Metacache*
+metaalloc(ulong ttl)
+{
+	Metacache *mc;
+
+	mc = smalloc(sizeof(Metacache));
+	mc->ttl = ttl;
+	return mc;
+}
+
+void
+metafree(Metacache *mc)
+{
+	if(mc == nil)
+		return;
+	clear(mc);
+	free(mc);
+}
+
+/* a qid from the server */
+void
+metaqid(Metacache *mc, Qid *q)
+{
+	lock(&mc->lk);
+	trim(mc);
+	seen(mc, q);
+	unlock(&mc->lk);
+}
+
+/*
+ * Walk name[0..nname-1] from q in the cache, filling qid;
+ * 1 if every name was known.
+ */
+int
+metawalk(Metacache *mc, Qid *q, char **name, int nname, Qid *qid)
+{
+	Mnode *d;
+	Mname *nm;
+	Qid *from;
+	int i;
+
+	lock(&mc->lk);
+	from = q;
+	for(i=0; i<nname; i++){
+		if((d = lookup(mc, from->path)) == nil)
+			break;
+		for(nm = d->names; nm != nil; nm = nm->next)
+			if(strcmp(nm->name, name[i]) == 0)
+				break;
+		if(nm == nil || !fresh(mc, nm->time))
+			break;
+		qid[i] = nm->qid;
+		from = &qid[i];
+	}
+	if(i == nname)
+		mc->hit[Cwalk]++;
+	else
+		mc->miss[Cwalk]++;
+	unlock(&mc->lk);
+	return i == nname;
+}
+
+/* the server walked name[0..nqid-1] from q to qid */
+void
+metawalked(Metacache *mc, Qid *q, char **name, int nqid, Qid *qid)
+{
+	Mnode *d;
+	Qid *from;
+	int i;
+
+	lock(&mc->lk);
+	trim(mc);
+	from = q;
+	for(i=0; i<nqid; i++){
+		if((d = seen(mc, from)) == nil)
+			break;
+		addname(d, name[i], strlen(name[i]), &qid[i]);
+		if(strcmp(name[i], "..") != 0)
+			setparent(mc, &qid[i], from->path);
+		from = &qid[i];
+	}
+	unlock(&mc->lk);
+}
+
+/*
+ * Copy q's stat to dp as mntstat would; 0 if it is not known.
+ * The version is not checked: chans keep the qid they were
+ * walked to, and the node has the server's latest.
+ */
+int
+metastat(Metacache *mc, Qid *q, uchar *dp, int n)
+{
+	Mnode *s;
+
+	lock(&mc->lk);
+	s = lookup(mc, q->path);
+	if(s == nil || s->stat == nil || !fresh(mc, s->stime)){
+		mc->miss[Cstat]++;
+		unlock(&mc->lk);
+		return 0;
+	}
+	mc->hit[Cstat]++;
+	if(s->nstat > n){
+		PBIT16(dp, s->nstat-BIT16SZ);
+		n = BIT16SZ;
+	}else{
+		memmove(dp, s->stat, s->nstat);
+		n = s->nstat;
+	}
+	unlock(&mc->lk);
+	return n;
+}
+
+/* the server's stat of a file */
+void
+metastated(Metacache *mc, uchar *stat, int len)
+{
+	Mnode *n;
+	Qid q;
+
+	if(len < STATFIXLEN)
+		return;
+	statqid(stat, &q);
+	lock(&mc->lk);
+	trim(mc);
+	if((n = seen(mc, &q)) != nil)
+		setstat(n, stat, len);
+	unlock(&mc->lk);
+}
+
+/*
+ * A copy of directory q's listing, its length in *np;
+ * nil if it is not known for q's version.
+ */
+uchar*
+metadir(Metacache *mc, Qid *q, long *np)
+{
+	Mnode *d;
+	uchar *p;
+
+	lock(&mc->lk);
+	d = lookup(mc, q->path);
+	if(d == nil || d->dir == nil || d->qid.vers != q->vers || !fresh(mc, d->dtime)
+	|| (p = malloc(d->ndir)) == nil){
+		mc->miss[Cdir]++;
+		unlock(&mc->lk);
+		return nil;
+	}
+	mc->hit[Cdir]++;
+	memmove(p, d->dir, d->ndir);
+	*np = d->ndir;
+	unlock(&mc->lk);
+	return p;
+}
+
+/*
+ * All of directory q as the server listed it; its entries
+ * are also what the names in it walk to and their stats.
+ */
+void
+metadirred(Metacache *mc, Qid *q, uchar *buf, long len)
+{
+	Mnode *d, *n;
+	uchar *p, *e;
+	Qid cq;
+	int l, m;
+
+	lock(&mc->lk);
+	trim(mc);
+	if((d = seen(mc, q)) == nil){
+		unlock(&mc->lk);
+		return;
+	}
+	free(d->dir);
+	d->ndir = 0;
+	if((d->dir = malloc(len)) == nil){
+		unlock(&mc->lk);
+		return;
+	}
+	memmove(d->dir, buf, len);
+	d->ndir = len;
+	d->dtime = ticks();
+	e = buf+len;
+	for(p = buf; p+STATFIXLEN <= e; p += l){
+		l = BIT16SZ+GBIT16(p);
+		if(p+l > e)
+			break;
+		/* the name follows the fixed part, less its own size and the strings' */
+		m = GBIT16(p+STATFIXLEN-4*BIT16SZ);
+		if(STATFIXLEN+m > l)
+			continue;
+		statqid(p, &cq);
+		addname(d, (char*)p+STATFIXLEN-3*BIT16SZ, m, &cq);
+		if((n = seen(mc, &cq)) != nil){
+			n->hasparent = 1;
+			n->parent = q->path;
+			setstat(n, p, l);
+		}
+	}
+	unlock(&mc->lk);
+}
+
+/*
+ * Something local changed q: its stat and listing are stale,
+ * and so are its directory's.  If q may have been removed or
+ * renamed (gone), the names that walked to it are too.
+ */
+void
+metaflush(Metacache *mc, Qid *q, int gone)
+{
+	Mnode *n, *d;
+	Mname *nm, **l;
+
+	lock(&mc->lk);
+	if((n = lookup(mc, q->path)) != nil){
+		if(gone)
+			forget(n);
+		else
+			stale(n);
+		if(n->hasparent && (d = lookup(mc, n->parent)) != nil){
+			stale(d);
+			if(gone)
+			for(l = &d->names; (nm = *l) != nil; ){
+				if(nm->qid.path == q->path){
+					*l = nm->next;
+					free(nm);
+				}else
+					l = &nm->next;
+			}
+		}
+	}
+	unlock(&mc->lk);
+}
+
+char*
+metaprint(Metacache *mc, char *s, char *e)
+{
+	int i;
+
+	lock(&mc->lk);
+	for(i=0; i<Ncount; i++)
+		s = seprint(s, e, " %s %lud %lud", cname[i], mc->hit[i], mc->miss[i]);
+	s = seprint(s, e, " nodes %d", mc->nnode);
+	unlock(&mc->lk);
+	return s;
+}
@@ -17,6 +17,7 @@
 #include <pwd.h>
 #include <errno.h>
 #include <termios.h>
+#include <unistd.h>
 
 #include "lib.h"
 #include "dat.h"
@@ -85,12 +86,34 @@ osmsleep(int ms)
 		panic("select");
 }
 
+void
+osusleep(int us)
+{
+	struct timeval tv;
+
+	tv.tv_sec = us / 1000000;
+	tv.tv_usec = us % 1000000;
+	if(select(0, NULL, NULL, NULL, &tv) < 0)
+		panic("select");
+}
+
 void
 osyield(void)
 {
 	sched_yield();
 }
 
+int
+osncpu(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		n = 1;
+	return n;
+}
+
 void
 oserrstr(void)
 {
@@ -1050,6 +1050,19 @@ qnotfull(void *a)
 	return q->len < q->limit || (q->state & Qclosed);
 }
 
+/*
+ *  readers clear Qflow as they wake the writers; sleeping
+ *  on qnotfull alone misses that when another writer has
+ *  filled the queue again in between.
+ */
+static int
+qunflowed(void *a)
+{
+	Queue *q = a;
+
+	return qnotfull(q) || (q->state & Qflow) == 0;
+}
+
 /*
  *  flow control, wait for queue to get below the limit
  */
@@ -1069,7 +1082,7 @@ qflow(Queue *q)
 			qunlock(&q->wlock);
 			nexterror();
 		}
-		sleep(&q->wr, qnotfull, q);
+		sleep(&q->wr, qunflowed, q);
 		qunlock(&q->wlock);
 		poperror();
 	}
@@ -42,6 +42,7 @@ void	setcolor(ulong, ulong, ulong, ulong);
 void	setcursor(void);
 void	mouseset(Point);
 void	flushmemscreen(Rectangle);
+extern	void	(*flushmemscreenrects)(Rectangle*, int);	/* nil: flushmemscreen each */
 Memdata*attachscreen(Rectangle*, ulong*, int*, int*, int*);
 void	deletescreenimage(void);
 void	resetscreenimage(void);
@@ -50,6 +51,7 @@ extern	QLock drawlock;
 #define	ishwimage(i)	0
 
 void	terminit(void);
+void	drawbandinit(void);
 void	screenresize(Rectangle);
 void	screensize(Rectangle, ulong);
 
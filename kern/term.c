@@ -137,6 +137,7 @@ terminit(void)
 	screenwin();
 	screenputs = termscreenputs;
 	kproc("resize", resizeproc, nil);
+	drawbandinit();
 }
 
 static void
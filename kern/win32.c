@@ -75,12 +75,29 @@ osmsleep(int ms)
 	Sleep((DWORD) ms);
 }
 
+void
+osusleep(int us)
+{
+	Sleep((DWORD) ((us+999)/1000));
+}
+
 void
 osyield(void)
 {
 	Sleep(0);
 }
 
+int
+osncpu(void)
+{
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	if(si.dwNumberOfProcessors < 1)
+		return 1;
+	return si.dwNumberOfProcessors;
+}
+
 static DWORD WINAPI
 tramp(LPVOID vp)
 {
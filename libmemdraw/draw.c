@@ -37,8 +37,12 @@
 	 (CALC22(a1, (rgba1>>8) & MASK, a2, (rgba2>>8) & MASK, tmp2)<<8))
 
 static void mktables(void);
+static void simdinit(void);
 typedef int Subdraw(Memdrawparam*);
 static Subdraw chardraw, alphadraw, memoptdraw;
+static void subdraw(Memdrawparam*);
+static int bandable(Memdrawparam*);
+static void drawbands(Memdrawparam*);
 
 static Memimage*	memones;
 static Memimage*	memzeros;
@@ -58,6 +62,7 @@ memimageinit(void)
 		return 0;
 
 	mktables();
+	simdinit();
 	_memmkcmap();
 
 	fmtinstall('R', Rfmt); 
@@ -137,40 +142,161 @@ memimagedraw(Memimage *dst, Rectangle r, Memimage *src, Point p0, Memimage *mask
 		}
 	}
 
-	/*
-	 * Now that we've clipped the parameters down to be consistent, we 
-	 * simply try sub-drawing routines in order until we find one that was able
-	 * to handle us.  If the sub-drawing routine returns zero, it means it was
-	 * unable to satisfy the request, so we do not return.
-	 */
+	if(memdrawbandfn != nil && memdrawnband > 1 && bandable(&par)){
+		drawbands(&par);
+		return;
+	}
+	subdraw(&par);
+}
+
+/*
+ * The characters of a string: draws of a 1x1 replicated colour
+ * through rectangles of a font image.  The colour and the draw
+ * state are worked out once for the run, and each character is
+ * only clipped before going to the subdraws.  Returns 0, having
+ * drawn nothing, if src or mask do not fit.
+ */
+int
+memimageglyphs(Memimage *dst, Memimage *src, Memimage *mask, Memglyph *g, int n, int op)
+{
+	Memdrawparam par;
+	Rectangle r;
+	Point p0, p1;
+	int i;
 
+	if(!(src->flags&Frepl) || Dx(src->r)!=1 || Dy(src->r)!=1)
+		return 0;
+	if(mask->flags&Frepl)
+		return 0;
+	if(op < Clear || op > SoverD)
+		return 1;
+
+	par.op = op;
+	par.dst = dst;
+	par.src = src;
+	par.mask = mask;
+	par.state = Replsrc|Simplesrc;
+	par.sval = pixelbits(src, src->r.min);
+	par.srgba = imgtorgba(src, par.sval);
+	par.sdval = rgbatoimg(dst, par.srgba);
+	if((par.srgba&0xFF) == 0 && (op&DoutS))
+		return 1;	/* no-op successfully handled */
+
+	for(i=0; i<n; i++){
+		r = g[i].r;
+		p0 = g[i].sp;
+		p1 = g[i].mp;
+		if(drawclip(dst, &r, src, &p0, mask, &p1, &par.sr, &par.mr) == 0)
+			continue;
+		par.r = r;
+		subdraw(&par);
+	}
+	return 1;
+}
+
+/*
+ * Now that we've clipped the parameters down to be consistent, we 
+ * simply try sub-drawing routines in order until we find one that was able
+ * to handle us.  If the sub-drawing routine returns zero, it means it was
+ * unable to satisfy the request, so we do not return.
+ */
+static void
+subdraw(Memdrawparam *par)
+{
 	/*
 	 * Hardware support.  Each video driver provides this function,
 	 * which checks to see if there is anything it can help with.
 	 * There could be an if around this checking to see if dst is in video memory.
 	 */
-	if(hwdraw(&par))
+	if(hwdraw(par))
 		return;
 
 	/*
 	 * Optimizations using memmove and memset.
 	 */
-	if(memoptdraw(&par))
+	if(memoptdraw(par))
 		return;
 
 	/*
 	 * Character drawing.
 	 * Solid source color being painted through a boolean mask onto a high res image.
 	 */
-	if(chardraw(&par))
+	if(chardraw(par))
 		return;
 
 	/*
 	 * General calculation-laden case that does alpha for each pixel.
 	 */
-	alphadraw(&par);
+	alphadraw(par);
+}
+
+/*
+ * Banded drawing.  The bands write disjoint rows of dst, so they
+ * may run at once provided no band reads what another writes:
+ * src and mask must not share dst's data.  Each band is the
+ * draw drawclip would have produced for its part of r.
+ */
+int	memdrawnband = 1;
+int	memdrawbandmin = 128*1024;
+void	(*memdrawbandfn)(void (*)(void*, int), void*, int);
+
+typedef struct Band Band;
+struct Band
+{
+	Memdrawparam	*par;
+	int	n;
+};
+
+static int
+bandable(Memdrawparam *par)
+{
+	if(par->src->data == par->dst->data || par->mask->data == par->dst->data)
+		return 0;
+	return Dx(par->r)*Dy(par->r) >= 2*memdrawbandmin && Dy(par->r) > 1;
+}
+
+static int
+bandy(Memimage *img, int y)
+{
+	if(img->flags&Frepl)
+		return drawreplxy(img->r.min.y, img->r.max.y, y);
+	return y;
 }
 
+static void
+drawband(void *a, int i)
+{
+	Band *b;
+	Memdrawparam par;
+	int y0, y1, dy;
+
+	b = a;
+	par = *b->par;
+	dy = Dy(par.r);
+	y0 = dy*i/b->n;
+	y1 = dy*(i+1)/b->n;
+	par.r.min.y += y0;
+	par.r.max.y = par.r.min.y + (y1-y0);
+	par.sr.min.y = bandy(par.src, par.sr.min.y+y0);
+	par.sr.max.y = par.sr.min.y + (y1-y0);
+	par.mr.min.y = bandy(par.mask, par.mr.min.y+y0);
+	par.mr.max.y = par.mr.min.y + (y1-y0);
+	subdraw(&par);
+}
+
+static void
+drawbands(Memdrawparam *par)
+{
+	Band b;
+
+	b.par = par;
+	b.n = Dx(par->r)*Dy(par->r)/memdrawbandmin;
+	if(b.n > memdrawnband)
+		b.n = memdrawnband;
+	if(b.n > Dy(par->r))
+		b.n = Dy(par->r);
+	memdrawbandfn(drawband, &b, b.n);
+}
 
 /*
  * Clip the destination rectangle further based on the properties of the 
@@ -424,6 +550,9 @@ static Readfn	greymaskread, replread, readptr;
 static Writefn	nullwrite;
 static Calcfn	alphacalc0, alphacalc14, alphacalc2810, alphacalc3679, alphacalc5, alphacalc11, alphacalcS;
 static Calcfn	boolcalc14, boolcalc236789, boolcalc1011;
+static Calcfn	alphacalc14v, alphacalc2810v, alphacalc3679v, alphacalc11v, alphacalcSv;
+
+static int	simdn;	/* pixels per vector step; 0 if no vector kernels */
 
 static Readfn*	readfn(Memimage*);
 static Readfn*	readalphafn(Memimage*);
@@ -653,7 +782,7 @@ alphadraw(Memdrawparam *par)
 			if(mask->chan == GREY1 && !(src->flags&Falpha))
 				calc = boolcalc[op];
 			else if(op == SoverD && !(src->flags&Falpha))
-				calc = alphacalcS;
+				calc = simdn ? alphacalcSv : alphacalcS;
 		}
 	}
 
@@ -834,11 +963,12 @@ alphacalc14(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 static void
 alphacalc2810(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 {
-	int fs, sadelta;
+	int fs, sadelta, dadelta;
 	int i, ma, da, q;
 	ulong t, t1;
 
 	sadelta = bsrc.alpha == &ones ? 0 : bsrc.delta;
+	dadelta = bdst.alpha == &ones ? 0 : bdst.delta;
 	q = bsrc.delta == 4 && bdst.delta == 4 && chanmatch(&bdst, &bsrc);
 
 	for(i=0; i<dx; i++){
@@ -860,7 +990,7 @@ alphacalc2810(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 				bsrc.rgba++;
 				bdst.rgba++;
 				bmask.alpha += bmask.delta;
-				bdst.alpha += bdst.delta;
+				bdst.alpha += dadelta;
 				continue;
 			}
 			*bdst.red = CALC11(fs, *bsrc.red, t);
@@ -885,11 +1015,12 @@ alphacalc2810(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 static void
 alphacalc3679(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 {
-	int fs, fd, sadelta;
+	int fs, fd, sadelta, dadelta;
 	int i, sa, ma, da, q;
 	ulong t, t1;
 
 	sadelta = bsrc.alpha == &ones ? 0 : bsrc.delta;
+	dadelta = bdst.alpha == &ones ? 0 : bdst.delta;
 	q = bsrc.delta == 4 && bdst.delta == 4 && chanmatch(&bdst, &bsrc);
 
 	for(i=0; i<dx; i++){
@@ -919,7 +1050,7 @@ alphacalc3679(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 				bdst.rgba++;
 				bsrc.alpha += sadelta;
 				bmask.alpha += bmask.delta;
-				bdst.alpha += bdst.delta;
+				bdst.alpha += dadelta;
 				continue;
 			}
 			*bdst.red = CALC12(fs, *bsrc.red, fd, *bdst.red, t);
@@ -1198,6 +1329,255 @@ boolcalc1011(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
 		}
 	}
 }
+/*
+ * Vector calculators.  When the pixels are 32-bit words with
+ * matching channels (the q case in the calculators above), the
+ * per-pixel factors are computed here and the channel arithmetic
+ * is handed to the kernels in drawsimd.c.  Anything else, and the
+ * tail of a scan line shorter than a vector, goes to the scalar
+ * calculator, which remains the reference implementation.
+ */
+typedef void	Blend11fn(uchar*, uchar*, uchar*, int);
+typedef void	Blend12fn(uchar*, uchar*, uchar*, uchar*, int, ulong);
+typedef void	Select32fn(uchar*, uchar*, uchar*, int);
+
+extern int	_memdrawsimdinit(Blend11fn**, Blend12fn**, Select32fn**);
+
+enum {
+	NVCHUNK = 64	/* factors computed per kernel call; multiple of every vector width */
+};
+
+static Blend11fn	*blend11;
+static Blend12fn	*blend12;
+static Select32fn	*select32;
+
+static void
+simdinit(void)
+{
+	simdn = _memdrawsimdinit(&blend11, &blend12, &select32);
+	if(simdn == 0)
+		return;
+
+	alphacalc[DoutS] = alphacalc14v;
+	alphacalc[DinS] = alphacalc14v;
+	alphacalc[SoutD] = alphacalc2810v;
+	alphacalc[SinD] = alphacalc2810v;
+	alphacalc[S] = alphacalc2810v;
+	alphacalc[DxorS] = alphacalc3679v;
+	alphacalc[DatopS] = alphacalc3679v;
+	alphacalc[DoverS] = alphacalc3679v;
+	alphacalc[SatopD] = alphacalc3679v;
+	alphacalc[SoverD] = alphacalc11v;
+}
+
+static int
+vecok(Buffer *bdst, Buffer *bsrc, int dx, int grey)
+{
+	return simdn && dx >= simdn && !grey
+		&& bsrc->delta == 4 && bdst->delta == 4 && chanmatch(bdst, bsrc);
+}
+
+/*
+ * Move a buffer n pixels to the right, as the calculators do.
+ */
+static void
+bufskip(Buffer *b, int n)
+{
+	n *= b->delta;
+	if(b->rgba != nil)
+		b->rgba = (ulong*)((uchar*)b->rgba + n);
+	if(b->red != nil)
+		b->red += n;
+	if(b->grn != nil)
+		b->grn += n;
+	if(b->blu != nil)
+		b->blu += n;
+	if(b->grey != nil)
+		b->grey += n;
+	if(b->alpha != &ones)
+		b->alpha += n;
+}
+
+static void
+alphacalc14v(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
+{
+	uchar fd[NVCHUNK];
+	int i, n, vx, sadelta, sa, ma, f;
+	ulong t;
+
+	if(!vecok(&bdst, &bsrc, dx, grey)){
+		alphacalc14(bdst, bsrc, bmask, dx, grey, op);
+		return;
+	}
+	sadelta = bsrc.alpha == &ones ? 0 : bsrc.delta;
+	vx = dx - dx%simdn;
+	for(i=0; i<vx; i+=n){
+		n = vx-i;
+		if(n > NVCHUNK)
+			n = NVCHUNK;
+		for(f=0; f<n; f++){
+			sa = bsrc.alpha[f*sadelta];
+			ma = bmask.alpha[f*bmask.delta];
+			fd[f] = CALC11(sa, ma, t);
+			if(op == DoutS)
+				fd[f] = 255-fd[f];
+		}
+		blend11((uchar*)bdst.rgba, (uchar*)bdst.rgba, fd, n);
+		bufskip(&bdst, n);
+		bufskip(&bsrc, n);
+		bufskip(&bmask, n);
+	}
+	if(vx < dx)
+		alphacalc14(bdst, bsrc, bmask, dx-vx, grey, op);
+}
+
+static void
+alphacalc2810v(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
+{
+	uchar fs[NVCHUNK];
+	int i, n, vx, dadelta, ma, da, f;
+	ulong t;
+
+	if(!vecok(&bdst, &bsrc, dx, grey)){
+		alphacalc2810(bdst, bsrc, bmask, dx, grey, op);
+		return;
+	}
+	dadelta = bdst.alpha == &ones ? 0 : bdst.delta;
+	vx = dx - dx%simdn;
+	for(i=0; i<vx; i+=n){
+		n = vx-i;
+		if(n > NVCHUNK)
+			n = NVCHUNK;
+		for(f=0; f<n; f++){
+			ma = bmask.alpha[f*bmask.delta];
+			da = bdst.alpha[f*dadelta];
+			if(op == SoutD)
+				da = 255-da;
+			fs[f] = ma;
+			if(op != S)
+				fs[f] = CALC11(ma, da, t);
+		}
+		blend11((uchar*)bdst.rgba, (uchar*)bsrc.rgba, fs, n);
+		bufskip(&bdst, n);
+		bufskip(&bsrc, n);
+		bufskip(&bmask, n);
+	}
+	if(vx < dx)
+		alphacalc2810(bdst, bsrc, bmask, dx-vx, grey, op);
+}
+
+static void
+alphacalc3679v(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
+{
+	uchar fs[NVCHUNK], fd[NVCHUNK];
+	int i, n, vx, sadelta, dadelta, sa, ma, da, f;
+	ulong t;
+
+	if(!vecok(&bdst, &bsrc, dx, grey)){
+		alphacalc3679(bdst, bsrc, bmask, dx, grey, op);
+		return;
+	}
+	sadelta = bsrc.alpha == &ones ? 0 : bsrc.delta;
+	dadelta = bdst.alpha == &ones ? 0 : bdst.delta;
+	vx = dx - dx%simdn;
+	for(i=0; i<vx; i+=n){
+		n = vx-i;
+		if(n > NVCHUNK)
+			n = NVCHUNK;
+		for(f=0; f<n; f++){
+			sa = bsrc.alpha[f*sadelta];
+			ma = bmask.alpha[f*bmask.delta];
+			da = bdst.alpha[f*dadelta];
+			if(op == SatopD)
+				fs[f] = CALC11(ma, da, t);
+			else
+				fs[f] = CALC11(ma, 255-da, t);
+			if(op == DoverS)
+				fd[f] = 255;
+			else{
+				fd[f] = CALC11(sa, ma, t);
+				if(op != DatopS)
+					fd[f] = 255-fd[f];
+			}
+		}
+		blend12((uchar*)bdst.rgba, (uchar*)bsrc.rgba, fs, fd, n, 0);
+		bufskip(&bdst, n);
+		bufskip(&bsrc, n);
+		bufskip(&bmask, n);
+	}
+	if(vx < dx)
+		alphacalc3679(bdst, bsrc, bmask, dx-vx, grey, op);
+}
+
+static void
+alphacalc11v(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
+{
+	uchar fs[NVCHUNK], fd[NVCHUNK];
+	int i, n, vx, sadelta, sa, ma, f;
+	ulong t;
+
+	if(!vecok(&bdst, &bsrc, dx, grey)){
+		alphacalc11(bdst, bsrc, bmask, dx, grey, op);
+		return;
+	}
+	sadelta = bsrc.alpha == &ones ? 0 : bsrc.delta;
+	vx = dx - dx%simdn;
+	for(i=0; i<vx; i+=n){
+		n = vx-i;
+		if(n > NVCHUNK)
+			n = NVCHUNK;
+		for(f=0; f<n; f++){
+			sa = bsrc.alpha[f*sadelta];
+			ma = bmask.alpha[f*bmask.delta];
+			fs[f] = ma;
+			fd[f] = 255-CALC11(sa, ma, t);
+		}
+		blend12((uchar*)bdst.rgba, (uchar*)bsrc.rgba, fs, fd, n, 0);
+		bufskip(&bdst, n);
+		bufskip(&bsrc, n);
+		bufskip(&bmask, n);
+	}
+	if(vx < dx)
+		alphacalc11(bdst, bsrc, bmask, dx-vx, grey, op);
+}
+
+/*
+ * alphacalcS leaves a missing destination alpha alone,
+ * so the kernel must not touch the unused byte of the word.
+ */
+static void
+alphacalcSv(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int grey, int op)
+{
+	uchar fs[NVCHUNK], fd[NVCHUNK];
+	int i, n, vx, ma, f;
+	ulong keep;
+	uchar *drgb;
+
+	if(!vecok(&bdst, &bsrc, dx, grey) || bdst.alpha != &ones){
+		alphacalcS(bdst, bsrc, bmask, dx, grey, op);
+		return;
+	}
+	drgb = (uchar*)bdst.rgba;
+	keep = 0xFF << 8*(6 - (bdst.red-drgb) - (bdst.grn-drgb) - (bdst.blu-drgb));
+	vx = dx - dx%simdn;
+	for(i=0; i<vx; i+=n){
+		n = vx-i;
+		if(n > NVCHUNK)
+			n = NVCHUNK;
+		for(f=0; f<n; f++){
+			ma = bmask.alpha[f*bmask.delta];
+			fs[f] = ma;
+			fd[f] = 255-ma;
+		}
+		blend12((uchar*)bdst.rgba, (uchar*)bsrc.rgba, fs, fd, n, keep);
+		bufskip(&bdst, n);
+		bufskip(&bsrc, n);
+		bufskip(&bmask, n);
+	}
+	if(vx < dx)
+		alphacalcS(bdst, bsrc, bmask, dx-vx, grey, op);
+}
+
 /*
  * Replicated cached scan line read.  Call the function listed in the Param,
  * but cache the result so that for replicated images we only do the work once.
@@ -1769,6 +2149,21 @@ boolcopy32(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int i, int o)
 			*w = *r;
 }
 
+static void
+boolcopy32v(Buffer bdst, Buffer bsrc, Buffer bmask, int dx, int i, int o)
+{
+	int vx;
+
+	vx = dx - dx%simdn;
+	select32(bdst.red, bsrc.red, bmask.grey, vx);
+	if(vx < dx){
+		bdst.red += 4*vx;
+		bsrc.red += 4*vx;
+		bmask.grey += vx;
+		boolcopy32(bdst, bsrc, bmask, dx-vx, i, o);
+	}
+}
+
 static Buffer
 genconv(Param *p, uchar *buf, int y)
 {
@@ -1879,7 +2274,7 @@ boolcopyfn(Memimage *img, Memimage *mask)
 	case 24:
 		return boolcopy24;
 	case 32:
-		return boolcopy32;
+		return simdn ? boolcopy32v : boolcopy32;
 	default:
 		assert(0 /* boolcopyfn */);
 	}
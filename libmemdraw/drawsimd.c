@@ -0,0 +1,166 @@
+#include <u.h>
+#include <libc.h>
+#include <draw.h>
+#include <memdraw.h>
+
+/*
+ * Vector versions of the inner loops of the alphadraw calculators.
+ * They work on runs of 32-bit pixels whose channels are in the same
+ * place in src and dst (see chanmatch in draw.c); the per-pixel
+ * factors are computed by the caller into byte arrays, one per pixel.
+ * The pixel count must be a multiple of the width returned by
+ * _memdrawsimdinit; the caller finishes any tail with the scalar code.
+ *
+ * The arithmetic is the CALC11/CALC12 rounding divide by 255 done
+ * in 16-bit lanes, which gives the same bytes as the word-at-a-time
+ * CALC41/CALC42 paths for premultiplied pixels.
+ *
+ * The kernels are written with gcc/clang vector extensions and
+ * instantiated once per vector width: 16 bytes (SSE2 on amd64,
+ * NEON on arm64, both always present) and 32 bytes (AVX2, chosen
+ * at run time).
+ */
+
+typedef void	Blend11fn(uchar*, uchar*, uchar*, int);
+typedef void	Blend12fn(uchar*, uchar*, uchar*, uchar*, int, ulong);
+typedef void	Select32fn(uchar*, uchar*, uchar*, int);
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && (defined(__GNUC__) || defined(__clang__))
+
+/*
+ * N is the number of pixels per step; the vectors hold 4*N bytes.
+ */
+#define SIMDKERNELS(sfx, N, ATTR) \
+typedef uchar	u8x##sfx __attribute__((vector_size(4*N)));\
+typedef ushort	u16x##sfx __attribute__((vector_size(8*N)));\
+typedef uchar	a8x##sfx __attribute__((vector_size(N)));\
+typedef ulong	u32x##sfx __attribute__((vector_size(4*N)));\
+\
+ATTR static void \
+widen##sfx(u16x##sfx *r, uchar *p)\
+{\
+	u8x##sfx v;\
+\
+	memmove(&v, p, sizeof v);\
+	*r = __builtin_convertvector(v, u16x##sfx);\
+}\
+\
+/* replicate one factor byte per pixel into each of its four channels */\
+ATTR static void \
+factor##sfx(u16x##sfx *r, uchar *a)\
+{\
+	a8x##sfx f;\
+	u32x##sfx w;\
+	u8x##sfx b;\
+\
+	memmove(&f, a, sizeof f);\
+	w = __builtin_convertvector(f, u32x##sfx) * 0x01010101;\
+	memmove(&b, &w, sizeof b);\
+	*r = __builtin_convertvector(b, u16x##sfx);\
+}\
+\
+ATTR static void \
+store##sfx(uchar *p, u16x##sfx *t)\
+{\
+	u8x##sfx v;\
+\
+	v = __builtin_convertvector((*t + (*t>>8)) >> 8, u8x##sfx);\
+	memmove(p, &v, sizeof v);\
+}\
+\
+ATTR static void \
+blend11##sfx(uchar *d, uchar *v, uchar *a, int n)\
+{\
+	u16x##sfx f, x, t;\
+	int i;\
+\
+	for(i=0; i<n; i+=N, d+=4*N, v+=4*N, a+=N){\
+		factor##sfx(&f, a);\
+		widen##sfx(&x, v);\
+		t = f*x + 128;\
+		store##sfx(d, &t);\
+	}\
+}\
+\
+ATTR static void \
+blend12##sfx(uchar *d, uchar *s, uchar *a1, uchar *a2, int n, ulong keep)\
+{\
+	u32x##sfx k, o, r;\
+	u16x##sfx f1, f2, x1, x2, t;\
+	int i;\
+\
+	for(i=0; i<n; i+=N, d+=4*N, s+=4*N, a1+=N, a2+=N){\
+		factor##sfx(&f1, a1);\
+		factor##sfx(&f2, a2);\
+		widen##sfx(&x1, s);\
+		widen##sfx(&x2, d);\
+		t = f1*x1 + f2*x2 + 128;\
+		if(keep){\
+			k = (u32x##sfx){} + keep;\
+			memmove(&o, d, sizeof o);\
+			store##sfx(d, &t);\
+			memmove(&r, d, sizeof r);\
+			r = (r & ~k) | (o & k);\
+			memmove(d, &r, sizeof r);\
+		}else\
+			store##sfx(d, &t);\
+	}\
+}\
+\
+ATTR static void \
+select32##sfx(uchar *d, uchar *s, uchar *m, int n)\
+{\
+	a8x##sfx f;\
+	u32x##sfx vd, vs, sel;\
+	int i;\
+\
+	for(i=0; i<n; i+=N, d+=4*N, s+=4*N, m+=N){\
+		memmove(&f, m, sizeof f);\
+		sel = (u32x##sfx)(__builtin_convertvector(f, u32x##sfx) != 0);\
+		memmove(&vd, d, sizeof vd);\
+		memmove(&vs, s, sizeof vs);\
+		vd = (vs & sel) | (vd & ~sel);\
+		memmove(d, &vd, sizeof vd);\
+	}\
+}
+
+SIMDKERNELS(v4, 4, )
+
+#ifdef __x86_64__
+SIMDKERNELS(v8, 8, __attribute__((target("avx2"))))
+#endif
+
+/*
+ * Choose the widest kernels the processor supports.
+ * Returns 0 if there are none.
+ */
+int
+_memdrawsimdinit(Blend11fn **b11, Blend12fn **b12, Select32fn **sel)
+{
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		*b11 = blend11v8;
+		*b12 = blend12v8;
+		*sel = select32v8;
+		return 8;
+	}
+#endif
+	*b11 = blend11v4;
+	*b12 = blend12v4;
+	*sel = select32v4;
+	return 4;
+}
+
+#else
+
+int
+_memdrawsimdinit(Blend11fn **b11, Blend12fn **b12, Select32fn **sel)
+{
+	USED(b11);
+	USED(b12);
+	USED(sel);
+	return 0;
+}
+
+#endif
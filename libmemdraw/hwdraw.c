@@ -3,10 +3,411 @@
 #include <draw.h>
 #include <memdraw.h>
 
+/*
+ * There is no video hardware behind drawterm's images, so hwdraw
+ * is used for loops specialised to the draws that dominate a
+ * session: a 32-bit XRGB32 or ARGB32 destination, an ARGB32 or
+ * 1x1 replicated source, a GREY8, GREY1 or opaque mask, and S or
+ * SoverD.  They run before memoptdraw, chardraw and alphadraw and
+ * must leave exactly the bytes those would have, so the cases
+ * below mirror the path the general code takes for each input.
+ */
+
+/* as in draw.c */
+#define CALC11(a, v, tmp) \
+	(tmp=(a)*(v)+128, (tmp+(tmp>>8))>>8)
+
+#define CALC12(a1, v1, a2, v2, tmp) \
+	(tmp=(a1)*(v1)+(a2)*(v2)+128, (tmp+(tmp>>8))>>8)
+
+#define MASK 0xFF00FF
+
+#define CALC21(a, vvuu, tmp) \
+	(tmp=(a)*(vvuu)+0x00800080, ((tmp+((tmp>>8)&MASK))>>8)&MASK)
+
+#define CALC41(a, rgba, tmp1, tmp2) \
+	(CALC21(a, rgba & MASK, tmp1) | \
+	 (CALC21(a, (rgba>>8)&MASK, tmp2)<<8))
+
+#define CALC22(a1, vvuu1, a2, vvuu2, tmp) \
+	(tmp=(a1)*(vvuu1)+(a2)*(vvuu2)+0x00800080, ((tmp+((tmp>>8)&MASK))>>8)&MASK)
+
+#define CALC42(a1, rgba1, a2, rgba2, tmp1, tmp2) \
+	(CALC22(a1, rgba1 & MASK, a2, rgba2 & MASK, tmp1) | \
+	 (CALC22(a1, (rgba1>>8) & MASK, a2, (rgba2>>8) & MASK, tmp2)<<8))
+
+enum {
+	Mopaque,
+	Mgrey8,
+	Mgrey1,
+};
+
+/*
+ * Mask scan line: either a byte per pixel or a bit per pixel
+ * starting at bit mx of *m.
+ */
+typedef struct Mrow Mrow;
+struct Mrow
+{
+	int	type;
+	uchar	*m;
+	int	mx;
+};
+
+static int
+maskat(Mrow *mr, int x)
+{
+	switch(mr->type){
+	case Mgrey8:
+		return mr->m[x];
+	case Mgrey1:
+		x += mr->mx;
+		return (mr->m[x>>3]>>(7-(x&7)))&1 ? 255 : 0;
+	}
+	return 255;
+}
+
+static int
+masktype(Memdrawparam *p)
+{
+	Memimage *mask;
+
+	mask = p->mask;
+	if(p->state&Fullmask)
+		return Mopaque;
+	if(p->state&Replmask)
+		return -1;
+	if(mask->chan == GREY8)
+		return Mgrey8;
+	if(mask->chan == GREY1)
+		return Mgrey1;
+	return -1;
+}
+
+static void
+maskrow(Memdrawparam *p, Mrow *mr, int y)
+{
+	Point pt;
+
+	if(mr->type == Mopaque)
+		return;
+	pt = Pt(p->mr.min.x, p->mr.min.y+y);
+	mr->m = byteaddr(p->mask, pt);
+	mr->mx = pt.x&7;
+}
+
+/*
+ * ARGB32 source, not replicated.  This is alphadraw with the
+ * word-at-a-time calculators: alphacalc11 for SoverD and
+ * alphacalc2810 for S, the latter also for an opaque mask since
+ * memoptdraw will not copy a source with alpha.
+ */
+static int
+argbdraw(Memdrawparam *p, int mt)
+{
+	ulong *dp, *sp, s, d, t, t1;
+	int x, y, dx, dy, ma, sa, fd;
+	Mrow mr;
+
+	if(p->src->data == p->dst->data)
+		return 0;
+
+	dx = Dx(p->r);
+	dy = Dy(p->r);
+	mr.type = mt;
+	for(y=0; y<dy; y++){
+		dp = (ulong*)byteaddr(p->dst, Pt(p->r.min.x, p->r.min.y+y));
+		sp = (ulong*)byteaddr(p->src, Pt(p->sr.min.x, p->sr.min.y+y));
+		maskrow(p, &mr, y);
+		if(p->op == S){
+			for(x=0; x<dx; x++){
+				ma = maskat(&mr, x);
+				if(ma == 255)
+					dp[x] = sp[x];
+				else
+					dp[x] = CALC41(ma, sp[x], t, t1);
+			}
+			continue;
+		}
+		for(x=0; x<dx; x++){
+			ma = maskat(&mr, x);
+			if(ma == 0)
+				continue;
+			s = sp[x];
+			sa = ((uchar*)&sp[x])[3];
+			if(ma == 255 && sa == 255){
+				dp[x] = s;
+				continue;
+			}
+			d = dp[x];
+			fd = 255-CALC11(sa, ma, t);
+			dp[x] = CALC42(ma, s, fd, d, t, t1);
+		}
+	}
+	return 1;
+}
+
+/*
+ * Boolean mask, opaque replicated source, SoverD: chardraw.
+ */
+static int
+chardraw32(Memdrawparam *p)
+{
+	ulong *dp, v;
+	uchar *mp, bits, b[4];
+	int x, y, dx, dy, mx;
+
+	dx = Dx(p->r);
+	dy = Dy(p->r);
+
+	/* make little endian */
+	b[0] = p->sdval;
+	b[1] = p->sdval>>8;
+	b[2] = p->sdval>>16;
+	b[3] = p->sdval>>24;
+	v = *(ulong*)b;
+	for(y=0; y<dy; y++){
+		dp = (ulong*)byteaddr(p->dst, Pt(p->r.min.x, p->r.min.y+y));
+		mp = byteaddr(p->mask, Pt(p->mr.min.x, p->mr.min.y+y));
+		mx = p->mr.min.x&7;
+		bits = *mp++ << mx;
+		for(x=0; x<dx; x++){
+			if(mx == 8){
+				bits = *mp++;
+				mx = 0;
+				if(bits == 0 && x+8 <= dx){
+					x += 7;
+					mx = 8;
+					continue;
+				}
+			}
+			if(bits&0x80)
+				dp[x] = v;
+			bits <<= 1;
+			mx++;
+		}
+	}
+	return 1;
+}
+
+/*
+ * 1x1 replicated source through a mask.  The general code reads
+ * the replicated source into a buffer laid out differently from
+ * the destination, so it calculates channel by channel and leaves
+ * the unused byte of XRGB32 alone; we do the same.
+ */
+static int
+repldraw(Memdrawparam *p, int mt)
+{
+	uchar *dp, c[4];
+	ulong t;
+	int i, x, y, dx, dy, ma, fd, sa, salpha, dalpha;
+	Mrow mr;
+
+	if(p->src->data == p->dst->data)
+		return 0;
+
+	dx = Dx(p->r);
+	dy = Dy(p->r);
+	sa = p->srgba&0xFF;
+	salpha = (p->src->flags&Falpha) != 0;
+	dalpha = (p->dst->flags&Falpha) != 0;
+
+	/* SoverD or S of an opaque colour through an opaque mask is memoptdraw's */
+	if(mt == Mopaque && sa == 255)
+		return 0;
+	/* boolean mask and no source alpha is chardraw's */
+	if(mt == Mgrey1 && !salpha && p->op == SoverD)
+		return chardraw32(p);
+
+	/* source channels in destination byte order */
+	c[0] = p->srgba>>8;	/* blue */
+	c[1] = p->srgba>>16;	/* green */
+	c[2] = p->srgba>>24;	/* red */
+	c[3] = sa;
+
+	mr.type = mt;
+	for(y=0; y<dy; y++){
+		dp = byteaddr(p->dst, Pt(p->r.min.x, p->r.min.y+y));
+		maskrow(p, &mr, y);
+		for(x=0; x<dx; x++, dp+=4){
+			ma = maskat(&mr, x);
+			/* CALC11(255, v) is v: the solid part of a glyph */
+			if(ma == 255 && (p->op == S || !salpha)){
+				dp[0] = c[0];
+				dp[1] = c[1];
+				dp[2] = c[2];
+				if(dalpha)
+					dp[3] = p->op == S ? sa : 255;
+				continue;
+			}
+			if(p->op == S){
+				/* alphacalc2810, or boolcalc1011 for a boolean mask */
+				for(i=0; i<3; i++)
+					dp[i] = CALC11(ma, c[i], t);
+				if(dalpha)
+					dp[3] = CALC11(ma, sa, t);
+				continue;
+			}
+			if(ma == 0)
+				continue;
+			if(salpha){
+				/* alphacalc11 */
+				fd = 255-CALC11(sa, ma, t);
+				for(i=0; i<3; i++)
+					dp[i] = CALC12(ma, c[i], fd, dp[i], t);
+				if(dalpha)
+					dp[3] = CALC12(ma, sa, fd, dp[3], t);
+			}else{
+				/* alphacalcS */
+				fd = 255-ma;
+				for(i=0; i<3; i++)
+					dp[i] = CALC12(ma, c[i], fd, dp[i], t);
+				if(dalpha)
+					dp[3] = ma+CALC11(fd, dp[3], t);
+			}
+		}
+	}
+	return 1;
+}
+
+static int
+hwdraw32(Memdrawparam *p)
+{
+	int mt;
+
+	if(p->dst->chan != XRGB32 && p->dst->chan != ARGB32)
+		return 0;
+	if(p->op != S && p->op != SoverD)
+		return 0;
+	if((mt = masktype(p)) < 0)
+		return 0;
+	if(p->state&Simplesrc)
+		return repldraw(p, mt);
+	if(!(p->state&Replsrc) && p->src->chan == ARGB32)
+		return argbdraw(p, mt);
+	return 0;
+}
+
+/*
+ * Hits and misses per combination of destination, source and
+ * mask channels, replication and operator.
+ */
+typedef struct Hwstat Hwstat;
+struct Hwstat
+{
+	ulong	dchan;
+	ulong	schan;
+	ulong	mchan;
+	ulong	state;
+	int	op;
+	ulong	hit;
+	ulong	miss;
+};
+
+enum {
+	NHWSTAT = 128,
+};
+
+static Hwstat	hwstat[NHWSTAT];
+static Hwstat	hwother;	/* table full */
+static int	hwlock;	/* bands draw in parallel; see drawbands */
+
+static Hwstat*
+hwlookup(Memdrawparam *p)
+{
+	Hwstat *h;
+	ulong state, k;
+	int i;
+
+	state = p->state&(Replsrc|Simplesrc|Replmask|Simplemask|Fullmask);
+	k = p->dst->chan*31 + p->src->chan*7 + p->mask->chan*3 + state*5 + p->op;
+	for(i=0; i<NHWSTAT; i++){
+		h = &hwstat[(k+i)%NHWSTAT];
+		if(h->dchan == 0){
+			h->dchan = p->dst->chan;
+			h->schan = p->src->chan;
+			h->mchan = p->mask->chan;
+			h->state = state;
+			h->op = p->op;
+			return h;
+		}
+		if(h->dchan == p->dst->chan && h->schan == p->src->chan
+		&& h->mchan == p->mask->chan && h->state == state && h->op == p->op)
+			return h;
+	}
+	return &hwother;
+}
+
 int
 hwdraw(Memdrawparam *p)
 {
-	USED(p);
-	return 0;	/* could not satisfy request */
+	Hwstat *h;
+	int ok;
+
+	/* loadmemimage tells us of loads with only dst set */
+	if(p->src == nil || p->mask == nil)
+		return 0;
+	ok = hwdraw32(p);
+	while(tas(&hwlock))
+		;
+	h = hwlookup(p);
+	if(ok)
+		h->hit++;
+	else
+		h->miss++;
+	hwlock = 0;
+	return ok;	/* 0: could not satisfy request */
 }
 
+static char*
+replname(ulong state, int simple, int repl)
+{
+	if(state&simple)
+		return "1x1";
+	if(state&repl)
+		return "repl";
+	return "-";
+}
+
+/*
+ * Print the table, busiest first, into buf.
+ */
+int
+hwdrawstats(char *buf, int nbuf)
+{
+	Hwstat *h, *best;
+	char *p, *e, d[16], s[16], m[16];
+	uchar done[NHWSTAT];
+	int i, n;
+
+	p = buf;
+	e = buf+nbuf;
+	if(p < e)
+		*p = 0;
+	memset(done, 0, sizeof done);
+	while(tas(&hwlock))
+		;
+	for(n=0; n<NHWSTAT; n++){
+		best = nil;
+		for(i=0; i<NHWSTAT; i++){
+			h = &hwstat[i];
+			if(h->dchan == 0 || done[i])
+				continue;
+			if(best == nil || h->hit+h->miss > best->hit+best->miss)
+				best = h;
+		}
+		if(best == nil)
+			break;
+		done[best-hwstat] = 1;
+		p = seprint(p, e, "%s %s %s %s %s %d %lud %lud\n",
+			chantostr(d, best->dchan),
+			chantostr(s, best->schan), replname(best->state, Simplesrc, Replsrc),
+			chantostr(m, best->mchan), replname(best->state, Simplemask, Replmask),
+			best->op, best->hit, best->miss);
+	}
+	if(hwother.hit+hwother.miss)
+		p = seprint(p, e, "other %lud %lud\n", hwother.hit, hwother.miss);
+	hwlock = 0;
+	return p-buf;
+}
@@ -183,3 +183,44 @@ memdraw(Memimage *dst, Rectangle r, Memimage *src, Point p0, Memimage *mask, Poi
 	d.mask = mask;
 	_memlayerop(ldrawop, dst, r, r, &d);
 }
+
+/*
+ * The characters of a string (see memimageglyphs).  Only a
+ * plain image or a clear layer is drawn here; the layer's clip
+ * becomes the screen's for the run.  Returns 0, having drawn
+ * nothing, if dst is obscured or the images do not fit.
+ */
+int
+memdrawglyphs(Memimage *dst, Memimage *src, Memimage *mask, Memglyph *g, int n, int op)
+{
+	Memlayer *dl;
+	Memimage *screen;
+	Rectangle clipr, oclipr;
+	int i, ok;
+
+	if(src->layer || mask->layer)
+		return 0;
+	dl = dst->layer;
+	if(dl == nil)
+		return memimageglyphs(dst, src, mask, g, n, op);
+	if(!dl->clear)
+		return 0;
+
+	clipr = dst->clipr;
+	if(!rectclip(&clipr, dst->r))
+		return 1;
+	screen = dl->screen->image;
+	clipr = rectaddpt(clipr, dl->delta);
+	oclipr = screen->clipr;
+	if(!rectclip(&clipr, oclipr))
+		return 1;
+	for(i=0; i<n; i++)
+		g[i].r = rectaddpt(g[i].r, dl->delta);
+	screen->clipr = clipr;
+	ok = memimageglyphs(screen, src, mask, g, n, op);
+	screen->clipr = oclipr;
+	if(!ok)
+		for(i=0; i<n; i++)
+			g[i].r = rectsubpt(g[i].r, dl->delta);
+	return ok;
+}
@@ -1,6 +1,19 @@
 #include "os.h"
 #include <libsec.h>
 
+/*
+ * Set by aesni_init where the processor can do better:
+ * counter mode, and GHASH by carry-less multiply on whole
+ * blocks, for which aesgcm_hinit fills in what it needs
+ * in place of prepareM's tables.  aesgcm_ctrghash does
+ * both over a message in one pass, hashing the ciphertext
+ * after encrypting (enc) or before decrypting it.
+ */
+void	(*aesgcm_ctr)(AESstate*, uchar*, ulong);
+void	(*aesgcm_hinit)(AESGCMstate*);
+void	(*aesgcm_ghash)(AESGCMstate*, uchar*, ulong, ulong[4]);
+void	(*aesgcm_ctrghash)(AESGCMstate*, uchar*, ulong, ulong[4], int);
+
 static void
 load128(uchar b[16], ulong W[4])
 {
@@ -57,7 +70,13 @@ static void
 ghash1(AESGCMstate *s, ulong X[4], ulong Y[4])
 {
 	ulong *Xi, i;
+	uchar tmp[16];
 
+	if(aesgcm_ghash != nil){
+		store128(X, tmp);
+		(*aesgcm_ghash)(s, tmp, 16, Y);
+		return;
+	}
 	X[0] ^= Y[0], X[1] ^= Y[1], X[2] ^= Y[2], X[3] ^= Y[3];
 	if(0){
 		gfmul(X, s->H, Y);
@@ -80,6 +99,11 @@ ghashn(AESGCMstate *s, uchar *dat, ulong len, ulong Y[4])
 	uchar tmp[16];
 	ulong X[4];
 
+	if(aesgcm_ghash != nil && len >= 16){
+		(*aesgcm_ghash)(s, dat, len & ~15, Y);
+		dat += len & ~15;
+		len &= 15;
+	}
 	while(len >= 16){
 		load128(dat, X);
 		ghash1(s, X, Y);
@@ -113,6 +137,10 @@ aesxctrn(AESstate *s, uchar *dat, ulong len)
 	uchar ctr[AESbsize];
 	ulong i;
 
+	if(aesgcm_ctr != nil){
+		(*aesgcm_ctr)(s, dat, len);
+		return;
+	}
 	memmove(ctr, s->ivec, AESbsize);
 	while(len > 0){
 		for(i=AESbsize-1; i>=AESbsize-4; i--)
@@ -154,7 +182,10 @@ setupAESGCMstate(AESGCMstate *s, uchar *key, int keylen, uchar *iv, int ivlen)
 	aes_encrypt(s->a.ekey, s->a.rounds, s->a.ivec, s->a.ivec);
 	load128(s->a.ivec, s->H);
 	memset(s->a.ivec, 0, AESbsize);
-	prepareM(s->H, s->M);
+	if(aesgcm_hinit != nil)
+		(*aesgcm_hinit)(s);
+	else
+		prepareM(s->H, s->M);
 
 	if(iv != nil && ivlen > 0)
 		aesgcm_setiv(s, iv, ivlen);
@@ -166,8 +197,12 @@ aesgcm_encrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], AE
 	ulong L[4], Y[4] = {0};
 
 	ghashn(s, aad, naad, Y);
-	aesxctrn(&s->a, dat, ndat);
-	ghashn(s, dat, ndat, Y);
+	if(aesgcm_ctrghash != nil)
+		(*aesgcm_ctrghash)(s, dat, ndat, Y, 1);
+	else {
+		aesxctrn(&s->a, dat, ndat);
+		ghashn(s, dat, ndat, Y);
+	}
 	L[0] = ndat << 3;
 	L[1] = ndat >> 29;
 	L[2] = naad << 3;
@@ -177,6 +212,7 @@ aesgcm_encrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], AE
 	aesxctr1(&s->a, s->a.ivec, tag, 16);
 }
 
+/* dat is left as it was if the tag does not match */
 int
 aesgcm_decrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], AESGCMstate *s)
 {
@@ -184,7 +220,10 @@ aesgcm_decrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], AE
 	uchar tmp[16];
 
 	ghashn(s, aad, naad, Y);
-	ghashn(s, dat, ndat, Y);
+	if(aesgcm_ctrghash != nil)
+		(*aesgcm_ctrghash)(s, dat, ndat, Y, 0);
+	else
+		ghashn(s, dat, ndat, Y);
 	L[0] = ndat << 3;
 	L[1] = ndat >> 29;
 	L[2] = naad << 3;
@@ -192,8 +231,12 @@ aesgcm_decrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], AE
 	ghash1(s, L, Y);
 	store128(Y, tmp);
 	aesxctr1(&s->a, s->a.ivec, tmp, 16);
-	if(tsmemcmp(tag, tmp, 16) != 0)
+	if(tsmemcmp(tag, tmp, 16) != 0){
+		if(aesgcm_ctrghash != nil)
+			aesxctrn(&s->a, dat, ndat);
 		return -1;
-	aesxctrn(&s->a, dat, ndat);
+	}
+	if(aesgcm_ctrghash == nil)
+		aesxctrn(&s->a, dat, ndat);
 	return 0;
 }
@@ -1,5 +1,365 @@
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define AESNI	__attribute__((target("aes,pclmul,ssse3,sse4.1")))
+#include <immintrin.h>
+#endif
+
+#include "os.h"
+#include <libsec.h>
+
+/*
+ * AES rounds with the AES-NI instructions, and GCM's GHASH
+ * with PCLMULQDQ, where the processor has them.  aesni_init
+ * is called by setupAESstate before the first key is set up;
+ * it returns the key setup to use, or nil to stay with the
+ * tables in aes.c.
+ *
+ * The expanded keys are the round keys as bytes, one
+ * after another: ekey for aesenc, dkey the reverse with
+ * InvMixColumns applied, for aesdec.
+ */
+
+#ifdef AESNI
+
+extern void	(*aesgcm_ctr)(AESstate*, uchar*, ulong);
+extern void	(*aesgcm_hinit)(AESGCMstate*);
+extern void	(*aesgcm_ghash)(AESGCMstate*, uchar*, ulong, ulong[4]);
+extern void	(*aesgcm_ctrghash)(AESGCMstate*, uchar*, ulong, ulong[4], int);
+
+AESNI static u32int
+subword(u32int w)
+{
+	return _mm_cvtsi128_si32(_mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, w, 0), 0));
+}
+
+/* FIPS-197 key expansion, on little-endian words */
+AESNI static int
+setup(ulong erk[], ulong drk[], uchar key[], int nkey)
+{
+	static uchar rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+	u32int *w, t;
+	__m128i *ek, *dk;
+	int nk, Nr, i;
+
+	if(nkey != 16 && nkey != 24 && nkey != 32)
+		return 0;
+	nk = nkey/4;
+	Nr = nk+6;
+	w = (u32int*)erk;
+	for(i=0; i<nk; i++)
+		w[i] = key[4*i] | key[4*i+1]<<8 | key[4*i+2]<<16 | (u32int)key[4*i+3]<<24;
+	for(; i<4*(Nr+1); i++){
+		t = w[i-1];
+		if(i%nk == 0)
+			t = subword(t>>8 | t<<24) ^ rcon[i/nk-1];
+		else if(nk > 6 && i%nk == 4)
+			t = subword(t);
+		w[i] = w[i-nk] ^ t;
+	}
+
+	ek = (__m128i*)erk;
+	dk = (__m128i*)drk;
+	dk[0] = ek[Nr];
+	for(i=1; i<Nr; i++)
+		dk[i] = _mm_aesimc_si128(ek[Nr-i]);
+	dk[Nr] = ek[0];
+	return Nr;
+}
+
+AESNI static inline __m128i
+enc1(__m128i *k, int Nr, __m128i x)
+{
+	int i;
+
+	x = _mm_xor_si128(x, k[0]);
+	for(i=1; i<Nr; i++)
+		x = _mm_aesenc_si128(x, k[i]);
+	return _mm_aesenclast_si128(x, k[Nr]);
+}
+
+AESNI static void
+aesniencrypt(ulong rk[], int Nr, uchar pt[16], uchar ct[16])
+{
+	_mm_storeu_si128((__m128i*)ct, enc1((__m128i*)rk, Nr, _mm_loadu_si128((__m128i*)pt)));
+}
+
+AESNI static void
+aesnidecrypt(ulong rk[], int Nr, uchar ct[16], uchar pt[16])
+{
+	__m128i *k, x;
+	int i;
+
+	k = (__m128i*)rk;
+	x = _mm_xor_si128(_mm_loadu_si128((__m128i*)ct), k[0]);
+	for(i=1; i<Nr; i++)
+		x = _mm_aesdec_si128(x, k[i]);
+	_mm_storeu_si128((__m128i*)pt, _mm_aesdeclast_si128(x, k[Nr]));
+}
+
+/* counter block n after the one in ivec, as aes_gcm.c counts */
+AESNI static inline __m128i
+ctrblock(__m128i iv, u32int n)
+{
+	return _mm_insert_epi32(iv, __builtin_bswap32(n), 3);
+}
+
+/* four blocks at a time, so the rounds overlap */
+AESNI static void
+ctr(AESstate *s, uchar *dat, ulong len)
+{
+	__m128i *k, iv, x0, x1, x2, x3;
+	u32int c;
+	uchar tmp[AESbsize];
+	int Nr, i;
+	ulong j;
+
+	k = s->ekey;
+	Nr = s->rounds;
+	iv = _mm_loadu_si128((__m128i*)s->ivec);
+	c = (u32int)s->ivec[12]<<24 | s->ivec[13]<<16 | s->ivec[14]<<8 | s->ivec[15];
+	for(; len >= 4*AESbsize; len -= 4*AESbsize, dat += 4*AESbsize){
+		x0 = _mm_xor_si128(ctrblock(iv, c+1), k[0]);
+		x1 = _mm_xor_si128(ctrblock(iv, c+2), k[0]);
+		x2 = _mm_xor_si128(ctrblock(iv, c+3), k[0]);
+		x3 = _mm_xor_si128(ctrblock(iv, c+4), k[0]);
+		c += 4;
+		for(i=1; i<Nr; i++){
+			x0 = _mm_aesenc_si128(x0, k[i]);
+			x1 = _mm_aesenc_si128(x1, k[i]);
+			x2 = _mm_aesenc_si128(x2, k[i]);
+			x3 = _mm_aesenc_si128(x3, k[i]);
+		}
+		x0 = _mm_aesenclast_si128(x0, k[Nr]);
+		x1 = _mm_aesenclast_si128(x1, k[Nr]);
+		x2 = _mm_aesenclast_si128(x2, k[Nr]);
+		x3 = _mm_aesenclast_si128(x3, k[Nr]);
+		_mm_storeu_si128((__m128i*)dat, _mm_xor_si128(x0, _mm_loadu_si128((__m128i*)dat)));
+		_mm_storeu_si128((__m128i*)(dat+16), _mm_xor_si128(x1, _mm_loadu_si128((__m128i*)(dat+16))));
+		_mm_storeu_si128((__m128i*)(dat+32), _mm_xor_si128(x2, _mm_loadu_si128((__m128i*)(dat+32))));
+		_mm_storeu_si128((__m128i*)(dat+48), _mm_xor_si128(x3, _mm_loadu_si128((__m128i*)(dat+48))));
+	}
+	for(; len >= AESbsize; len -= AESbsize, dat += AESbsize){
+		x0 = enc1(k, Nr, ctrblock(iv, ++c));
+		_mm_storeu_si128((__m128i*)dat, _mm_xor_si128(x0, _mm_loadu_si128((__m128i*)dat)));
+	}
+	if(len > 0){
+		_mm_storeu_si128((__m128i*)tmp, enc1(k, Nr, ctrblock(iv, ++c)));
+		for(j=0; j<len; j++)
+			dat[j] ^= tmp[j];
+	}
+}
+
+/*
+ * GHASH after Gueron and Kounavis, "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing
+ * the GCM Mode": blocks are byte-reversed, so a block as
+ * aes_gcm.c's load128 has it (four little-endian words)
+ * loads as is.  Products are summed unreduced, then shifted
+ * left a bit, since GCM's bits are reflected, and reduced.
+ */
+AESNI static inline void
+clmul(__m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+	__m128i m;
+
+	m = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+	*lo = _mm_xor_si128(*lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(m, 8)));
+	*hi = _mm_xor_si128(*hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(m, 8)));
+}
+
+AESNI static inline __m128i
+reduce(__m128i lo, __m128i hi)
+{
+	__m128i a, b, c;
+
+	a = _mm_srli_epi32(lo, 31);
+	b = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	c = _mm_srli_si128(a, 12);
+	b = _mm_slli_si128(b, 4);
+	a = _mm_slli_si128(a, 4);
+	lo = _mm_or_si128(lo, a);
+	hi = _mm_or_si128(_mm_or_si128(hi, b), c);
+
+	a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+	b = _mm_srli_si128(a, 4);
+	lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+	c = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+	lo = _mm_xor_si128(lo, _mm_xor_si128(c, b));
+	return _mm_xor_si128(hi, lo);
+}
+
+AESNI static inline __m128i
+gfmul(__m128i a, __m128i b)
+{
+	__m128i lo, hi;
+
+	lo = hi = _mm_setzero_si128();
+	clmul(a, b, &lo, &hi);
+	return reduce(lo, hi);
+}
+
+/* H, H², H³ and H⁴ in the first of the unused tables */
+AESNI static void
+hinit(AESGCMstate *s)
+{
+	__m128i h, *p;
+	int i;
+
+	p = (__m128i*)s->M[0][0];
+	h = _mm_loadu_si128((__m128i*)s->H);
+	_mm_storeu_si128(p, h);
+	for(i=1; i<4; i++)
+		_mm_storeu_si128(p+i, gfmul(_mm_loadu_si128(p+i-1), h));
+}
+
+/* len is a multiple of 16 */
+AESNI static void
+ghash(AESGCMstate *s, uchar *dat, ulong len, ulong Y[4])
+{
+	__m128i rev, y, h1, h2, h3, h4, lo, hi, *p;
+
+	rev = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	p = (__m128i*)s->M[0][0];
+	h1 = _mm_loadu_si128(p);
+	h2 = _mm_loadu_si128(p+1);
+	h3 = _mm_loadu_si128(p+2);
+	h4 = _mm_loadu_si128(p+3);
+	y = _mm_loadu_si128((__m128i*)Y);
+	for(; len >= 64; len -= 64, dat += 64){
+		lo = hi = _mm_setzero_si128();
+		clmul(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)dat), rev)), h4, &lo, &hi);
+		clmul(_mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(dat+16)), rev), h3, &lo, &hi);
+		clmul(_mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(dat+32)), rev), h2, &lo, &hi);
+		clmul(_mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(dat+48)), rev), h1, &lo, &hi);
+		y = reduce(lo, hi);
+	}
+	for(; len >= 16; len -= 16, dat += 16)
+		y = gfmul(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)dat), rev)), h1);
+	_mm_storeu_si128((__m128i*)Y, y);
+}
+
+/*
+ * Counter mode and GHASH in one pass, four blocks at a time.
+ * Sealing, the four blocks just encrypted are hashed while
+ * the rounds for the next four run; opening, the blocks are
+ * hashed as they are decrypted.
+ */
+AESNI static void
+ctrghash(AESGCMstate *s, uchar *dat, ulong len, ulong Y[4], int enc)
+{
+	__m128i *k, iv, rev, y, h1, h2, h3, h4, lo, hi, *p;
+	__m128i x0, x1, x2, x3, q0, q1, q2, q3;
+	u32int c;
+	uchar ks[AESbsize], blk[AESbsize];
+	int Nr, i, have;
+	ulong j, n;
+
+	k = s->a.ekey;
+	Nr = s->a.rounds;
+	iv = _mm_loadu_si128((__m128i*)s->a.ivec);
+	c = (u32int)s->a.ivec[12]<<24 | s->a.ivec[13]<<16 | s->a.ivec[14]<<8 | s->a.ivec[15];
+	rev = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	p = (__m128i*)s->M[0][0];
+	h1 = _mm_loadu_si128(p);
+	h2 = _mm_loadu_si128(p+1);
+	h3 = _mm_loadu_si128(p+2);
+	h4 = _mm_loadu_si128(p+3);
+	y = _mm_loadu_si128((__m128i*)Y);
+	q0 = q1 = q2 = q3 = _mm_setzero_si128();
+	have = 0;
+	for(; len >= 4*AESbsize; len -= 4*AESbsize, dat += 4*AESbsize){
+		x0 = _mm_xor_si128(ctrblock(iv, c+1), k[0]);
+		x1 = _mm_xor_si128(ctrblock(iv, c+2), k[0]);
+		x2 = _mm_xor_si128(ctrblock(iv, c+3), k[0]);
+		x3 = _mm_xor_si128(ctrblock(iv, c+4), k[0]);
+		c += 4;
+		if(!enc){
+			q0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)dat), rev);
+			q1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(dat+16)), rev);
+			q2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(dat+32)), rev);
+			q3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(dat+48)), rev);
+			have = 1;
+		}
+		if(have){
+			lo = hi = _mm_setzero_si128();
+			clmul(_mm_xor_si128(y, q0), h4, &lo, &hi);
+			clmul(q1, h3, &lo, &hi);
+			clmul(q2, h2, &lo, &hi);
+			clmul(q3, h1, &lo, &hi);
+			y = reduce(lo, hi);
+			have = 0;
+		}
+		for(i=1; i<Nr; i++){
+			x0 = _mm_aesenc_si128(x0, k[i]);
+			x1 = _mm_aesenc_si128(x1, k[i]);
+			x2 = _mm_aesenc_si128(x2, k[i]);
+			x3 = _mm_aesenc_si128(x3, k[i]);
+		}
+		x0 = _mm_xor_si128(_mm_aesenclast_si128(x0, k[Nr]), _mm_loadu_si128((__m128i*)dat));
+		x1 = _mm_xor_si128(_mm_aesenclast_si128(x1, k[Nr]), _mm_loadu_si128((__m128i*)(dat+16)));
+		x2 = _mm_xor_si128(_mm_aesenclast_si128(x2, k[Nr]), _mm_loadu_si128((__m128i*)(dat+32)));
+		x3 = _mm_xor_si128(_mm_aesenclast_si128(x3, k[Nr]), _mm_loadu_si128((__m128i*)(dat+48)));
+		_mm_storeu_si128((__m128i*)dat, x0);
+		_mm_storeu_si128((__m128i*)(dat+16), x1);
+		_mm_storeu_si128((__m128i*)(dat+32), x2);
+		_mm_storeu_si128((__m128i*)(dat+48), x3);
+		if(enc){
+			q0 = _mm_shuffle_epi8(x0, rev);
+			q1 = _mm_shuffle_epi8(x1, rev);
+			q2 = _mm_shuffle_epi8(x2, rev);
+			q3 = _mm_shuffle_epi8(x3, rev);
+			have = 1;
+		}
+	}
+	if(have){
+		lo = hi = _mm_setzero_si128();
+		clmul(_mm_xor_si128(y, q0), h4, &lo, &hi);
+		clmul(q1, h3, &lo, &hi);
+		clmul(q2, h2, &lo, &hi);
+		clmul(q3, h1, &lo, &hi);
+		y = reduce(lo, hi);
+	}
+
+	/* the rest a block at a time, the last padded with zeros */
+	for(; len > 0; len -= n, dat += n){
+		n = len < AESbsize ? len : AESbsize;
+		_mm_storeu_si128((__m128i*)ks, enc1(k, Nr, ctrblock(iv, ++c)));
+		memset(blk, 0, AESbsize);
+		if(!enc)
+			memmove(blk, dat, n);
+		for(j=0; j<n; j++)
+			dat[j] ^= ks[j];
+		if(enc)
+			memmove(blk, dat, n);
+		y = gfmul(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)blk), rev)), h1);
+	}
+	_mm_storeu_si128((__m128i*)Y, y);
+}
+
+void*
+aesni_init(void)
+{
+	__builtin_cpu_init();
+	if(!__builtin_cpu_supports("aes") || !__builtin_cpu_supports("ssse3") || !__builtin_cpu_supports("sse4.1"))
+		return nil;
+	aes_encrypt = aesniencrypt;
+	aes_decrypt = aesnidecrypt;
+	aesgcm_ctr = ctr;
+	if(__builtin_cpu_supports("pclmul")){
+		aesgcm_hinit = hinit;
+		aesgcm_ghash = ghash;
+		aesgcm_ctrghash = ctrghash;
+	}
+	return setup;
+}
+
+#else
+
 void*
 aesni_init(void)
 {
-	return 0;
+	return nil;
 }
+
+#endif
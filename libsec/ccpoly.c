@@ -1,6 +1,12 @@
 #include "os.h"
 #include <libsec.h>
 
+enum {
+	Chunk = 1024,	/* encrypted and authenticated while in the cache */
+};
+
+static uchar zeros[16];
+
 static void
 ccpolyotk(Chachastate *cs, DigestState *ds)
 {
@@ -16,7 +22,6 @@ ccpolyotk(Chachastate *cs, DigestState *ds)
 static void
 ccpolypad(uchar *buf, ulong nbuf, DigestState *ds)
 {
-	static uchar zeros[16] = {0};
 	ulong npad;
 
 	if(nbuf == 0)
@@ -44,6 +49,28 @@ ccpolylen(ulong n, uchar tag[16], DigestState *ds)
 	poly1305(info, 8, nil, 0, tag, ds);
 }
 
+/*
+ * Encrypt (or decrypt) dat and authenticate the ciphertext
+ * in one pass, a chunk at a time, padding as ccpolypad.
+ */
+static void
+ccpolydat(uchar *dat, ulong ndat, Chachastate *cs, DigestState *ds, int enc)
+{
+	ulong n, npad;
+
+	npad = ndat % 16;
+	for(; ndat > 0; ndat -= n, dat += n){
+		n = ndat < Chunk ? ndat : Chunk;
+		if(enc)
+			chacha_encrypt(dat, n, cs);
+		poly1305(dat, n, nil, 0, nil, ds);
+		if(!enc)
+			chacha_encrypt(dat, n, cs);
+	}
+	if(cs->ivwords != 2 && npad != 0)
+		poly1305(zeros, 16 - npad, nil, 0, nil, ds);
+}
+
 void
 ccpoly_encrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], Chachastate *cs)
 {
@@ -53,18 +80,17 @@ ccpoly_encrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], Ch
 	if(cs->ivwords == 2){
 		poly1305(aad, naad, nil, 0, nil, &ds);
 		ccpolylen(naad, nil, &ds);
-		chacha_encrypt(dat, ndat, cs);
-		poly1305(dat, ndat, nil, 0, nil, &ds);
+		ccpolydat(dat, ndat, cs, &ds, 1);
 		ccpolylen(ndat, tag, &ds);
 	} else {
 		ccpolypad(aad, naad, &ds);
-		chacha_encrypt(dat, ndat, cs);
-		ccpolypad(dat, ndat, &ds);
+		ccpolydat(dat, ndat, cs, &ds, 1);
 		ccpolylen(naad, nil, &ds);
 		ccpolylen(ndat, tag, &ds);
 	}
 }
 
+/* dat is left as it was if the tag does not match */
 int
 ccpoly_decrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], Chachastate *cs)
 {
@@ -75,16 +101,18 @@ ccpoly_decrypt(uchar *dat, ulong ndat, uchar *aad, ulong naad, uchar tag[16], Ch
 	if(cs->ivwords == 2){
 		poly1305(aad, naad, nil, 0, nil, &ds);
 		ccpolylen(naad, nil, &ds);
-		poly1305(dat, ndat, nil, 0, nil, &ds);
+		ccpolydat(dat, ndat, cs, &ds, 0);
 		ccpolylen(ndat, tmp, &ds);
 	} else {
 		ccpolypad(aad, naad, &ds);
-		ccpolypad(dat, ndat, &ds);
+		ccpolydat(dat, ndat, cs, &ds, 0);
 		ccpolylen(naad, nil, &ds);
 		ccpolylen(ndat, tmp, &ds);
 	}
-	if(tsmemcmp(tag, tmp, 16) != 0)
+	if(tsmemcmp(tag, tmp, 16) != 0){
+		chacha_setblock(cs, 1);
+		chacha_encrypt(dat, ndat, cs);
 		return -1;
-	chacha_encrypt(dat, ndat, cs);
+	}
 	return 0;
 }
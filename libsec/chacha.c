@@ -13,6 +13,10 @@ and including the changes to block number and nonce defined in RFC7539
 /* from chachablock.$O */
 extern void _chachablock(u32int x[16], int rounds);
 
+/* from chachavec.$O: runs of whole blocks, the number done */
+extern void *chachavec_init(void);
+static ulong (*chachablocks)(Chachastate*, uchar*, uchar*, ulong);
+
 /* little-endian data order */
 #define	GET4(p)		((p)[0]|((p)[1]<<8)|((p)[2]<<16)|((p)[3]<<24))
 #define	PUT4(p,v)	(p)[0]=(v);(p)[1]=(v)>>8;(p)[2]=(v)>>16;(p)[3]=(v)>>24
@@ -39,6 +43,12 @@ load(u32int *d, uchar *s, int nw)
 void
 setupChachastate(Chachastate *s, uchar *key, ulong keylen, uchar *iv, ulong ivlen, int rounds)
 {
+	static int vecinit;
+
+	if(!vecinit){
+		chachablocks = chachavec_init();
+		vecinit = 1;
+	}
 	if(keylen != 256/8 && keylen != 128/8)
 		sysfatal("invalid chacha key length");
 	if(ivlen != 64/8 && ivlen != 96/8
@@ -192,11 +202,20 @@ void
 chacha_encrypt2(uchar *src, uchar *dst, ulong bytes, Chachastate *s)
 {
 	uchar tmp[ChachaBsize];
-
-	for(; bytes >= ChachaBsize; bytes -= ChachaBsize){
+	ulong n;
+
+	while(bytes >= ChachaBsize){
+		if(chachablocks != nil && (n = (*chachablocks)(s, src, dst, bytes/ChachaBsize)) > 0){
+			n *= ChachaBsize;
+			bytes -= n;
+			src += n;
+			dst += n;
+			continue;
+		}
 		encryptblock(s, src, dst);
 		src += ChachaBsize;
 		dst += ChachaBsize;
+		bytes -= ChachaBsize;
 	}
 	if(bytes > 0){
 		memmove(tmp, src, bytes);
@@ -0,0 +1,175 @@
+#include "os.h"
+#include <libsec.h>
+
+/*
+ * ChaCha blocks four or eight at a time, each lane of a vector
+ * holding a word of one block, in GCC's vector extensions:
+ * SSE2 on amd64, NEON on arm64, and AVX2 for eight lanes where
+ * the processor has it.  chachavec_init is called from
+ * setupChachastate before the first key; it returns what
+ * chacha_encrypt2 is to use for runs of whole blocks, or nil.
+ */
+
+#if (defined(__x86_64__) || defined(__aarch64__)) && (defined(__GNUC__) || defined(__clang__))
+
+typedef u32int V4 __attribute__((vector_size(16)));
+
+#ifdef __clang__
+#define SHUF(a, b, ...)	__builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+#define SHUF(a, b, ...)	__builtin_shuffle(a, b, (__typeof__(a)){__VA_ARGS__})
+#endif
+
+#define ROT(v, n)	((v)<<(n) | (v)>>(32-(n)))
+
+#define QR(a, b, c, d) \
+	a += b; d ^= a; d = ROT(d, 16); \
+	c += d; b ^= c; b = ROT(b, 12); \
+	a += b; d ^= a; d = ROT(d, 8); \
+	c += d; b ^= c; b = ROT(b, 7);
+
+#define ROUNDS(x, n) \
+	for(r = n; r > 0; r -= 2){ \
+		QR(x[0], x[4], x[8], x[12]) \
+		QR(x[1], x[5], x[9], x[13]) \
+		QR(x[2], x[6], x[10], x[14]) \
+		QR(x[3], x[7], x[11], x[15]) \
+		QR(x[0], x[5], x[10], x[15]) \
+		QR(x[1], x[6], x[11], x[12]) \
+		QR(x[2], x[7], x[8], x[13]) \
+		QR(x[3], x[4], x[9], x[14]) \
+	}
+
+static void
+xor4(uchar *src, uchar *dst, V4 k)
+{
+	V4 v;
+
+	memmove(&v, src, sizeof v);
+	v ^= k;
+	memmove(dst, &v, sizeof v);
+}
+
+/* n blocks, four at a time, counting as encryptblock does */
+static ulong
+blocks4(Chachastate *s, uchar *src, uchar *dst, ulong n)
+{
+	V4 x[16], t0, t1, t2, t3;
+	ulong nb;
+	int i, g, r;
+
+	for(nb = 0; nb+4 <= n; nb += 4){
+		if(s->ivwords != 3 && s->input[12] > ~(u32int)0-4)
+			break;	/* leave the carry to encryptblock */
+		for(i=0; i<16; i++)
+			x[i] = (V4){0, 0, 0, 0} + s->input[i];
+		x[12] += (V4){0, 1, 2, 3};
+		ROUNDS(x, s->rounds)
+		for(i=0; i<16; i++)
+			x[i] += s->input[i];
+		x[12] += (V4){0, 1, 2, 3};
+		for(g=0; g<16; g+=4){
+			t0 = SHUF(x[g], x[g+1], 0, 4, 1, 5);
+			t1 = SHUF(x[g+2], x[g+3], 0, 4, 1, 5);
+			t2 = SHUF(x[g], x[g+1], 2, 6, 3, 7);
+			t3 = SHUF(x[g+2], x[g+3], 2, 6, 3, 7);
+			xor4(src+4*g, dst+4*g, SHUF(t0, t1, 0, 1, 4, 5));
+			xor4(src+64+4*g, dst+64+4*g, SHUF(t0, t1, 2, 3, 6, 7));
+			xor4(src+128+4*g, dst+128+4*g, SHUF(t2, t3, 0, 1, 4, 5));
+			xor4(src+192+4*g, dst+192+4*g, SHUF(t2, t3, 2, 3, 6, 7));
+		}
+		s->input[12] += 4;
+		src += 4*ChachaBsize;
+		dst += 4*ChachaBsize;
+	}
+	return nb;
+}
+
+#ifdef __x86_64__
+
+typedef u32int V8 __attribute__((vector_size(32)));
+
+#define AVX2	__attribute__((target("avx2")))
+
+AVX2 static void
+xor8(uchar *src, uchar *dst, V8 k)
+{
+	V4 v, h;
+
+	memmove(&h, &k, sizeof h);
+	memmove(&v, src, sizeof v);
+	v ^= h;
+	memmove(dst, &v, sizeof v);
+	memmove(&h, (uchar*)&k+16, sizeof h);
+	memmove(&v, src+4*ChachaBsize, sizeof v);
+	v ^= h;
+	memmove(dst+4*ChachaBsize, &v, sizeof v);
+}
+
+/*
+ * As blocks4, with blocks 0-3 in the low halves and 4-7 in
+ * the high; the shuffles work within halves, so each result
+ * holds a row of block j and of block j+4.
+ */
+AVX2 static ulong
+blocks8(Chachastate *s, uchar *src, uchar *dst, ulong n)
+{
+	V8 x[16], t0, t1, t2, t3;
+	ulong nb;
+	int i, g, r;
+
+	for(nb = 0; nb+8 <= n; nb += 8){
+		if(s->ivwords != 3 && s->input[12] > ~(u32int)0-8)
+			break;
+		for(i=0; i<16; i++)
+			x[i] = (V8){0, 0, 0, 0, 0, 0, 0, 0} + s->input[i];
+		x[12] += (V8){0, 1, 2, 3, 4, 5, 6, 7};
+		ROUNDS(x, s->rounds)
+		for(i=0; i<16; i++)
+			x[i] += s->input[i];
+		x[12] += (V8){0, 1, 2, 3, 4, 5, 6, 7};
+		for(g=0; g<16; g+=4){
+			t0 = SHUF(x[g], x[g+1], 0, 8, 1, 9, 4, 12, 5, 13);
+			t1 = SHUF(x[g+2], x[g+3], 0, 8, 1, 9, 4, 12, 5, 13);
+			t2 = SHUF(x[g], x[g+1], 2, 10, 3, 11, 6, 14, 7, 15);
+			t3 = SHUF(x[g+2], x[g+3], 2, 10, 3, 11, 6, 14, 7, 15);
+			xor8(src+4*g, dst+4*g, SHUF(t0, t1, 0, 1, 8, 9, 4, 5, 12, 13));
+			xor8(src+64+4*g, dst+64+4*g, SHUF(t0, t1, 2, 3, 10, 11, 6, 7, 14, 15));
+			xor8(src+128+4*g, dst+128+4*g, SHUF(t2, t3, 0, 1, 8, 9, 4, 5, 12, 13));
+			xor8(src+192+4*g, dst+192+4*g, SHUF(t2, t3, 2, 3, 10, 11, 6, 7, 14, 15));
+		}
+		s->input[12] += 8;
+		src += 8*ChachaBsize;
+		dst += 8*ChachaBsize;
+	}
+	return nb + blocks4(s, src, dst, n-nb);
+}
+
+void*
+chachavec_init(void)
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return blocks8;
+	return blocks4;
+}
+
+#else
+
+void*
+chachavec_init(void)
+{
+	return blocks4;
+}
+
+#endif
+
+#else
+
+void*
+chachavec_init(void)
+{
+	return nil;
+}
+
+#endif
@@ -9,24 +9,35 @@ pbkdf2_x(uchar *p, ulong plen, uchar *s, ulong slen,
 {
 	uchar block[256], tmp[256];
 	ulong i, j, k, n;
-	DigestState *ds;
+	DigestState *key, ds;
 
 	assert(xlen <= (int)sizeof(tmp));
 
+	/*
+	 * every round is keyed with the password; hash its inner
+	 * pad once and start each round from a copy of that state.
+	 */
+	key = (*x)(nil, 0, p, plen, nil, nil);
+	if(key == nil)
+		return;
+	key->malloced = 0;
 	for(i = 1; dlen > 0; i++, d += n, dlen -= n){
 		tmp[3] = i;
 		tmp[2] = i >> 8;
 		tmp[1] = i >> 16;
 		tmp[0] = i >> 24;
-		ds = (*x)(s, slen, p, plen, nil, nil);
-		(*x)(tmp, 4, p, plen, block, ds);
+		ds = *key;
+		(*x)(s, slen, p, plen, nil, &ds);
+		(*x)(tmp, 4, p, plen, block, &ds);
 		memmove(tmp, block, xlen);
 		for(j = 1; j < rounds; j++){
-			(*x)(tmp, xlen, p, plen, tmp, nil);
+			ds = *key;
+			(*x)(tmp, xlen, p, plen, tmp, &ds);
 			for(k=0; k<(ulong)xlen; k++)
 				block[k] ^= tmp[k];
 		}
 		n = dlen > (ulong)xlen ? (ulong)xlen : dlen;
 		memmove(d, block, n); 
 	}
+	free(key);
 }
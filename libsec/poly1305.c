@@ -2,7 +2,8 @@
 #include <libsec.h>
 
 /*
-	poly1305 implementation using 32 bit * 32 bit = 64 bit multiplication and 64 bit addition
+	poly1305 implementation using 32 bit * 32 bit = 64 bit multiplication and 64 bit addition,
+	or 64 bit * 64 bit = 128 bit where the compiler has it
 
 	derived from http://github.com/floodberry/poly1305-donna
 */
@@ -10,65 +11,163 @@
 #define U8TO32(p)	((u32int)(p)[0] | (u32int)(p)[1]<<8 | (u32int)(p)[2]<<16 | (u32int)(p)[3]<<24)
 #define U32TO8(p, v)	(p)[0]=(v), (p)[1]=(v)>>8, (p)[2]=(v)>>16, (p)[3]=(v)>>24
 
-/* (r,s) = (key[0:15],key[16:31]), the one time key */
-DigestState*
-poly1305(uchar *m, ulong len, uchar *key, ulong klen, uchar *digest, DigestState *s)
+#ifdef __SIZEOF_INT128__
+
+/* r in bstate[0-2], h in bstate[3-5], pad in bstate[6-7]; limbs of 44, 44 and 42 bits */
+
+typedef unsigned __int128 u128int;
+
+#define U8TO64(p)	((u64int)U8TO32(p) | (u64int)U8TO32((p)+4)<<32)
+#define U64TO8(p, v)	U32TO8(p, (u32int)(v)), U32TO8((p)+4, (u32int)((v)>>32))
+
+static void
+seed(DigestState *s, uchar *key)
 {
-	u32int r0,r1,r2,r3,r4, s1,s2,s3,s4, h0,h1,h2,h3,h4, g0,g1,g2,g3,g4;
-	u64int d0,d1,d2,d3,d4, f;
-	u32int hibit, mask, c;
+	u64int t0, t1;
 
-	if(s == nil){
-		s = malloc(sizeof(*s));
-		if(s == nil)
-			return nil;
-		memset(s, 0, sizeof(*s));
-		s->malloced = 1;
-	}
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	t0 = U8TO64(&key[0]);
+	t1 = U8TO64(&key[8]);
+	s->bstate[0] = t0 & 0xffc0fffffffULL;
+	s->bstate[1] = (t0>>44 | t1<<20) & 0xfffffc0ffffULL;
+	s->bstate[2] = (t1>>24) & 0x00ffffffc0fULL;
 
-	if(s->seeded == 0){
-		assert(klen == 32);
+	/* h = 0 */
+	s->bstate[3] = 0;
+	s->bstate[4] = 0;
+	s->bstate[5] = 0;
+
+	/* save pad for later */
+	s->bstate[6] = U8TO64(&key[16]);
+	s->bstate[7] = U8TO64(&key[24]);
+}
 
-		/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
-		s->state[0] = (U8TO32(&key[ 0])     ) & 0x3ffffff;
-		s->state[1] = (U8TO32(&key[ 3]) >> 2) & 0x3ffff03;
-		s->state[2] = (U8TO32(&key[ 6]) >> 4) & 0x3ffc0ff;
-		s->state[3] = (U8TO32(&key[ 9]) >> 6) & 0x3f03fff;
-		s->state[4] = (U8TO32(&key[12]) >> 8) & 0x00fffff;
-
-		/* h = 0 */
-		s->state[5] = 0;
-		s->state[6] = 0;
-		s->state[7] = 0;
-		s->state[8] = 0;
-		s->state[9] = 0;
-
-		/* save pad for later */
-		s->state[10] = U8TO32(&key[16]);
-		s->state[11] = U8TO32(&key[20]);
-		s->state[12] = U8TO32(&key[24]);
-		s->state[13] = U8TO32(&key[28]);
+static void
+blocks(DigestState *s, uchar *m, ulong len, int last)
+{
+	u64int r0,r1,r2, s1,s2, h0,h1,h2, c, t0, t1, hibit;
+	u128int d0,d1,d2;
 
-		s->seeded = 1;
-	}
+	r0 = s->bstate[0];
+	r1 = s->bstate[1];
+	r2 = s->bstate[2];
 
-	if(s->blen){
-		c = 16 - s->blen;
-		if(c > len)
-			c = len;
-		memmove(s->buf + s->blen, m, c);
-		len -= c, m += c;
-		s->blen += c;
-		if(s->blen == 16){
-			s->blen = 0;
-			poly1305(s->buf, 16, key, klen, nil, s);
-		} else if(len == 0){
-			m = s->buf;
-			len = s->blen;
-			s->blen = 0;
-		}
+	h0 = s->bstate[3];
+	h1 = s->bstate[4];
+	h2 = s->bstate[5];
+
+	s1 = r1 * (5 << 2);
+	s2 = r2 * (5 << 2);
+
+	hibit = last ? 0 : (u64int)1<<40;	/* 1<<128 */
+
+	for(; len >= 16; len -= 16, m += 16){
+		/* h += m[i] */
+		t0 = U8TO64(&m[0]);
+		t1 = U8TO64(&m[8]);
+		h0 += t0 & 0xfffffffffffULL;
+		h1 += (t0>>44 | t1<<20) & 0xfffffffffffULL;
+		h2 += (t1>>24 & 0x3ffffffffffULL) | hibit;
+
+		/* h *= r */
+		d0 = (u128int)h0*r0 + (u128int)h1*s2 + (u128int)h2*s1;
+		d1 = (u128int)h0*r1 + (u128int)h1*r0 + (u128int)h2*s2;
+		d2 = (u128int)h0*r2 + (u128int)h1*r1 + (u128int)h2*r0;
+
+		/* (partial) h %= p */
+		           c = (u64int)(d0 >> 44); h0 = (u64int)d0 & 0xfffffffffffULL;
+		d1 += c;   c = (u64int)(d1 >> 44); h1 = (u64int)d1 & 0xfffffffffffULL;
+		d2 += c;   c = (u64int)(d2 >> 42); h2 = (u64int)d2 & 0x3ffffffffffULL;
+		h0 += c*5; c = h0 >> 44; h0 &= 0xfffffffffffULL;
+		h1 += c;
 	}
 
+	s->bstate[3] = h0;
+	s->bstate[4] = h1;
+	s->bstate[5] = h2;
+}
+
+static void
+finish(DigestState *s, uchar *digest)
+{
+	u64int h0,h1,h2, g0,g1,g2, c, t0, t1;
+
+	h0 = s->bstate[3];
+	h1 = s->bstate[4];
+	h2 = s->bstate[5];
+
+	             c = h1 >> 44; h1 &= 0xfffffffffffULL;
+	h2 +=     c; c = h2 >> 42; h2 &= 0x3ffffffffffULL;
+	h0 += c * 5; c = h0 >> 44; h0 &= 0xfffffffffffULL;
+	h1 +=     c; c = h1 >> 44; h1 &= 0xfffffffffffULL;
+	h2 +=     c; c = h2 >> 42; h2 &= 0x3ffffffffffULL;
+	h0 += c * 5; c = h0 >> 44; h0 &= 0xfffffffffffULL;
+	h1 +=     c;
+
+	/* compute h + -p */
+	g0 = h0 + 5; c = g0 >> 44; g0 &= 0xfffffffffffULL;
+	g1 = h1 + c; c = g1 >> 44; g1 &= 0xfffffffffffULL;
+	g2 = h2 + c - ((u64int)1 << 42);
+
+	/* select h if h < p, or h + -p if h >= p */
+	c = (g2 >> 63) - 1;
+	g0 &= c;
+	g1 &= c;
+	g2 &= c;
+	c = ~c;
+	h0 = (h0 & c) | g0;
+	h1 = (h1 & c) | g1;
+	h2 = (h2 & c) | g2;
+
+	/* digest = (h + pad) % (2^128) */
+	t0 = s->bstate[6];
+	t1 = s->bstate[7];
+	h0 += t0 & 0xfffffffffffULL; c = h0 >> 44; h0 &= 0xfffffffffffULL;
+	h1 += ((t0>>44 | t1<<20) & 0xfffffffffffULL) + c; c = h1 >> 44; h1 &= 0xfffffffffffULL;
+	h2 += (t1>>24 & 0x3ffffffffffULL) + c; h2 &= 0x3ffffffffffULL;
+
+	h0 = h0 | h1<<44;
+	h1 = h1>>20 | h2<<24;
+
+	U64TO8(&digest[0], h0);
+	U64TO8(&digest[8], h1);
+}
+
+#else
+
+/* r in state[0-4], h in state[5-9], pad in state[10-13]; limbs of 26 bits */
+
+static void
+seed(DigestState *s, uchar *key)
+{
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	s->state[0] = (U8TO32(&key[ 0])     ) & 0x3ffffff;
+	s->state[1] = (U8TO32(&key[ 3]) >> 2) & 0x3ffff03;
+	s->state[2] = (U8TO32(&key[ 6]) >> 4) & 0x3ffc0ff;
+	s->state[3] = (U8TO32(&key[ 9]) >> 6) & 0x3f03fff;
+	s->state[4] = (U8TO32(&key[12]) >> 8) & 0x00fffff;
+
+	/* h = 0 */
+	s->state[5] = 0;
+	s->state[6] = 0;
+	s->state[7] = 0;
+	s->state[8] = 0;
+	s->state[9] = 0;
+
+	/* save pad for later */
+	s->state[10] = U8TO32(&key[16]);
+	s->state[11] = U8TO32(&key[20]);
+	s->state[12] = U8TO32(&key[24]);
+	s->state[13] = U8TO32(&key[28]);
+}
+
+static void
+blocks(DigestState *s, uchar *m, ulong len, int last)
+{
+	u32int r0,r1,r2,r3,r4, s1,s2,s3,s4, h0,h1,h2,h3,h4;
+	u64int d0,d1,d2,d3,d4;
+	u32int hibit, c;
+
 	r0 = s->state[0];
 	r1 = s->state[1];
 	r2 = s->state[2];
@@ -86,10 +185,9 @@ poly1305(uchar *m, ulong len, uchar *key, ulong klen, uchar *digest, DigestState
 	s3 = r3 * 5;
 	s4 = r4 * 5;
 
-	hibit = 1<<24;	/* 1<<128 */
+	hibit = last ? 0 : 1<<24;	/* 1<<128 */
 
-	while(len >= 16){
-Block:
+	for(; len >= 16; len -= 16, m += 16){
 		/* h += m[i] */
 		h0 += (U8TO32(&m[0])     ) & 0x3ffffff;
 		h1 += (U8TO32(&m[3]) >> 2) & 0x3ffffff;
@@ -112,32 +210,27 @@ Block:
 		d4 += c;      c = (u32int)(d4 >> 26); h4 = (u32int)d4 & 0x3ffffff;
 		h0 += c * 5;  c = (h0 >> 26); h0 = h0 & 0x3ffffff;
 		h1 += c;
-
-		len -= 16, m += 16;
 	}
 
-	if(len){
-		s->blen = len;
-		memmove(s->buf, m, len);
-	}
+	s->state[5] = h0;
+	s->state[6] = h1;
+	s->state[7] = h2;
+	s->state[8] = h3;
+	s->state[9] = h4;
+}
 
-	if(digest == nil){
-		s->state[5] = h0;
-		s->state[6] = h1;
-		s->state[7] = h2;
-		s->state[8] = h3;
-		s->state[9] = h4;
-		return s;
-	}
+static void
+finish(DigestState *s, uchar *digest)
+{
+	u32int h0,h1,h2,h3,h4, g0,g1,g2,g3,g4;
+	u64int f;
+	u32int mask, c;
 
-	if(len){
-		m = s->buf;
-		m[len++] = 1;
-		while(len < 16)
-			m[len++] = 0;
-		hibit = 0;
-		goto Block;
-	}
+	h0 = s->state[5];
+	h1 = s->state[6];
+	h2 = s->state[7];
+	h3 = s->state[8];
+	h4 = s->state[9];
 
 	             c = h1 >> 26; h1 = h1 & 0x3ffffff;
 	h2 +=     c; c = h2 >> 26; h2 = h2 & 0x3ffffff;
@@ -172,7 +265,7 @@ Block:
 	h1 = (h1 >>  6) | (h2 << 20);
 	h2 = (h2 >> 12) | (h3 << 14);
 	h3 = (h3 >> 18) | (h4 <<  8);
-	
+
 	/* digest = (h + pad) % (2^128) */
 	f = (u64int)h0 + s->state[10]            ; h0 = (u32int)f;
 	f = (u64int)h1 + s->state[11] + (f >> 32); h1 = (u32int)f;
@@ -183,6 +276,66 @@ Block:
 	U32TO8(&digest[4], h1);
 	U32TO8(&digest[8], h2);
 	U32TO8(&digest[12], h3);
+}
+
+#endif
+
+/* (r,s) = (key[0:15],key[16:31]), the one time key */
+DigestState*
+poly1305(uchar *m, ulong len, uchar *key, ulong klen, uchar *digest, DigestState *s)
+{
+	ulong c;
+
+	if(s == nil){
+		s = malloc(sizeof(*s));
+		if(s == nil)
+			return nil;
+		memset(s, 0, sizeof(*s));
+		s->malloced = 1;
+	}
+
+	if(s->seeded == 0){
+		assert(klen == 32);
+		seed(s, key);
+		s->seeded = 1;
+	}
+
+	if(s->blen){
+		c = 16 - s->blen;
+		if(c > len)
+			c = len;
+		memmove(s->buf + s->blen, m, c);
+		len -= c, m += c;
+		s->blen += c;
+		if(s->blen == 16){
+			s->blen = 0;
+			blocks(s, s->buf, 16, 0);
+		}
+	}
+
+	if(len >= 16){
+		blocks(s, m, len & ~15, 0);
+		m += len & ~15;
+		len &= 15;
+	}
+
+	if(len){
+		s->blen = len;
+		memmove(s->buf, m, len);
+	}
+
+	if(digest == nil)
+		return s;
+
+	if(s->blen){
+		m = s->buf;
+		len = s->blen;
+		m[len++] = 1;
+		while(len < 16)
+			m[len++] = 0;
+		blocks(s, m, 16, 1);
+	}
+	finish(s, digest);
 
 	if(s->malloced){
 		memset(s, 0, sizeof(*s));
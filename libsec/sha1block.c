@@ -7,8 +7,8 @@
 #define F2(x,y,z)	(0x8f1bbcdc + (((x) & (y)) | (((x) | (y)) & (z))))
 #define F3(x,y,z)	(0xca62c1d6 + ((x) ^ (y) ^ (z)))
 
-void
-_sha1block(uchar *p, ulong len, u32int *s)
+static void
+sha1block(uchar *p, ulong len, u32int *s)
 {
 	u32int w[16], a, b, c, d, e;
 	uchar *end;
@@ -135,3 +135,16 @@ _sha1block(uchar *p, ulong len, u32int *s)
 		s[4] += e;
 	}
 }
+
+void
+_sha1block(uchar *p, ulong len, u32int *s)
+{
+	static void (*block)(uchar*, ulong, u32int*);
+
+	if(block == nil){
+		extern void *sha1ni_init(void);
+		if((block = sha1ni_init()) == nil)
+			block = sha1block;
+	}
+	(*block)(p, len, s);
+}
@@ -19,7 +19,7 @@
  * first 32 bits of the fractional parts of cube roots of
  * first 64 primes (2..311).
  */
-static u32int K256[64] = {
+u32int _sha2K256[64] = {
 	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
 	0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
 	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
@@ -38,8 +38,8 @@ static u32int K256[64] = {
 	0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2,
 };
 
-void
-_sha2block64(uchar *p, ulong len, u32int *s)
+static void
+sha2block64(uchar *p, ulong len, u32int *s)
 {
 	u32int w[16], a, b, c, d, e, f, g, h;
 	uchar *end;
@@ -62,7 +62,7 @@ _sha2block64(uchar *p, ulong len, u32int *s)
 	} else { \
 		w[i&15] += sigma1(w[(i-2)&15]) + w[(i-7)&15] + sigma0(w[(i-15)&15]); \
 	} \
-	h += SIGMA1(e) + Ch(e,f,g) + K256[i] + w[i&15]; \
+	h += SIGMA1(e) + Ch(e,f,g) + _sha2K256[i] + w[i&15]; \
 	d += h; \
 	h += SIGMA0(a) + Maj(a,b,c);
 
@@ -148,3 +148,16 @@ _sha2block64(uchar *p, ulong len, u32int *s)
 		s[7] += h;
 	}
 }
+
+void
+_sha2block64(uchar *p, ulong len, u32int *s)
+{
+	static void (*block)(uchar*, ulong, u32int*);
+
+	if(block == nil){
+		extern void *sha256ni_init(void);
+		if((block = sha256ni_init()) == nil)
+			block = sha2block64;
+	}
+	(*block)(p, len, s);
+}
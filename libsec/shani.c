@@ -0,0 +1,168 @@
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SHANI	__attribute__((target("sha,sse4.1,ssse3")))
+#include <immintrin.h>
+#endif
+
+#include "os.h"
+
+/*
+ * SHA-1 and SHA-256 blocks with the SHA extensions on amd64,
+ * where the processor has them.  sha1ni_init and sha256ni_init
+ * are called by _sha1block and _sha2block64 before the first
+ * block; they return the block function to use, or nil to stay
+ * with the portable code.  As that code, these take whole 64-byte
+ * blocks and the state as host-order words, a first.
+ *
+ * The instructions do the rounds without tables or branches
+ * on the data, so the time taken depends only on the length.
+ */
+
+extern u32int _sha2K256[64];
+
+#ifdef SHANI
+
+/*
+ * sha256rnds2 does two rounds, on the state as ABEF and CDGH;
+ * the round constants are added to the message beforehand.
+ */
+#define R256(m, i) \
+	k = _mm_add_epi32(m, _mm_loadu_si128((__m128i*)&_sha2K256[4*(i)])); \
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, k); \
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(k, 0x0E));
+
+/* W[i..i+3] into m0, from m0 = W[i-16..], m1 = W[i-12..], m2 = W[i-8..], m3 = W[i-4..] */
+#define W256(m0, m1, m2, m3) \
+	m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), \
+		_mm_alignr_epi8(m3, m2, 4)), m3);
+
+SHANI static void
+sha256block(uchar *p, ulong len, u32int *s)
+{
+	__m128i abef, cdgh, sabef, scdgh, m0, m1, m2, m3, k, bswap;
+	uchar *end;
+
+	bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	k = _mm_shuffle_epi32(_mm_loadu_si128((__m128i*)&s[0]), 0xB1);	/* CDAB */
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((__m128i*)&s[4]), 0x1B);	/* EFGH */
+	abef = _mm_alignr_epi8(k, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, k, 0xF0);
+	for(end = p+len; p < end; p += 64){
+		sabef = abef;
+		scdgh = cdgh;
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+48)), bswap);
+		R256(m0, 0) R256(m1, 1) R256(m2, 2) R256(m3, 3)
+		W256(m0, m1, m2, m3) R256(m0, 4)
+		W256(m1, m2, m3, m0) R256(m1, 5)
+		W256(m2, m3, m0, m1) R256(m2, 6)
+		W256(m3, m0, m1, m2) R256(m3, 7)
+		W256(m0, m1, m2, m3) R256(m0, 8)
+		W256(m1, m2, m3, m0) R256(m1, 9)
+		W256(m2, m3, m0, m1) R256(m2, 10)
+		W256(m3, m0, m1, m2) R256(m3, 11)
+		W256(m0, m1, m2, m3) R256(m0, 12)
+		W256(m1, m2, m3, m0) R256(m1, 13)
+		W256(m2, m3, m0, m1) R256(m2, 14)
+		W256(m3, m0, m1, m2) R256(m3, 15)
+		abef = _mm_add_epi32(abef, sabef);
+		cdgh = _mm_add_epi32(cdgh, scdgh);
+	}
+	k = _mm_shuffle_epi32(abef, 0x1B);	/* FEBA */
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);	/* DCHG */
+	_mm_storeu_si128((__m128i*)&s[0], _mm_blend_epi16(k, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i*)&s[4], _mm_alignr_epi8(cdgh, k, 8));
+}
+
+/*
+ * sha1rnds4 does four rounds on ABCD, given E added to the
+ * message words; sha1nexte makes the next E from the A of
+ * four rounds back.  The message words for a group are made
+ * over the three groups before it, by msg1, xor and msg2.
+ */
+#define R1(f, ein, eout, m) \
+	ein = _mm_sha1nexte_epu32(ein, m); \
+	eout = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, ein, f);
+#define M1(a, b)	a = _mm_sha1msg1_epu32(a, b);
+#define M2(a, b)	a = _mm_sha1msg2_epu32(a, b);
+#define X1(a, b)	a = _mm_xor_si128(a, b);
+
+SHANI static void
+sha1block(uchar *p, ulong len, u32int *s)
+{
+	__m128i abcd, e0, e1, sabcd, se0, m0, m1, m2, m3, bswap;
+	uchar *end;
+
+	bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i*)s), 0x1B);
+	e0 = _mm_set_epi32(s[4], 0, 0, 0);
+	for(end = p+len; p < end; p += 64){
+		sabcd = abcd;
+		se0 = e0;
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+0)), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+16)), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+32)), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i*)(p+48)), bswap);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		R1(0, e1, e0, m1)		M1(m0, m1)
+		R1(0, e0, e1, m2)		M1(m1, m2) X1(m0, m2)
+		R1(0, e1, e0, m3) M2(m0, m3) M1(m2, m3) X1(m1, m3)
+		R1(0, e0, e1, m0) M2(m1, m0) M1(m3, m0) X1(m2, m0)
+		R1(1, e1, e0, m1) M2(m2, m1) M1(m0, m1) X1(m3, m1)
+		R1(1, e0, e1, m2) M2(m3, m2) M1(m1, m2) X1(m0, m2)
+		R1(1, e1, e0, m3) M2(m0, m3) M1(m2, m3) X1(m1, m3)
+		R1(1, e0, e1, m0) M2(m1, m0) M1(m3, m0) X1(m2, m0)
+		R1(1, e1, e0, m1) M2(m2, m1) M1(m0, m1) X1(m3, m1)
+		R1(2, e0, e1, m2) M2(m3, m2) M1(m1, m2) X1(m0, m2)
+		R1(2, e1, e0, m3) M2(m0, m3) M1(m2, m3) X1(m1, m3)
+		R1(2, e0, e1, m0) M2(m1, m0) M1(m3, m0) X1(m2, m0)
+		R1(2, e1, e0, m1) M2(m2, m1) M1(m0, m1) X1(m3, m1)
+		R1(2, e0, e1, m2) M2(m3, m2) M1(m1, m2) X1(m0, m2)
+		R1(3, e1, e0, m3) M2(m0, m3) M1(m2, m3) X1(m1, m3)
+		R1(3, e0, e1, m0) M2(m1, m0) M1(m3, m0) X1(m2, m0)
+		R1(3, e1, e0, m1) M2(m2, m1)		X1(m3, m1)
+		R1(3, e0, e1, m2) M2(m3, m2)
+		R1(3, e1, e0, m3)
+		e0 = _mm_sha1nexte_epu32(e0, se0);
+		abcd = _mm_add_epi32(abcd, sabcd);
+	}
+	_mm_storeu_si128((__m128i*)s, _mm_shuffle_epi32(abcd, 0x1B));
+	s[4] = _mm_extract_epi32(e0, 3);
+}
+
+void*
+sha1ni_init(void)
+{
+	__builtin_cpu_init();
+	if(!__builtin_cpu_supports("sse4.1") || !__builtin_cpu_supports("ssse3"))
+		return nil;
+	if(!__builtin_cpu_supports("sha"))
+		return nil;
+	return sha1block;
+}
+
+void*
+sha256ni_init(void)
+{
+	return sha1ni_init() != nil ? sha256block : nil;
+}
+
+#else
+
+void*
+sha1ni_init(void)
+{
+	return nil;
+}
+
+void*
+sha256ni_init(void)
+{
+	return nil;
+}
+
+#endif